@@ -0,0 +1,207 @@
+/*
+   eph2asc - program to convert a JPL binary ephemeris to JPL ASCII
+             format, the reverse of asc2eph, e.g. to hand an ephemeris
+             written here to other software that reads JPL ASCII files.
+
+         Writes the ASCII header file and one ASCII data file holding
+         every block.  Numbers are written by ephcom_format_block(), with
+         the digits that read back as exactly the binary value, so
+         asc2eph turns the output into the same binary ephemeris.
+
+         Blocks are read and formatted in chunks by parallel threads,
+         into a ring of buffers that this thread writes out in block
+         order.
+
+         Format:
+
+            eph2asc binary-input ascii-header-output ascii-data-output [threads]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <pthread.h>
+#include <unistd.h>    //sysconf()
+#include "ephcom.h"
+
+#define EPH2ASC_CHUNK 64   /* Blocks formatted by a thread at a time */
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_writeascii_header(FILE *outfp, struct ephcom_Header *header);
+int ephcom_pread_block(int fd, struct ephcom_Header *header,
+                       int blocknum, double *datablock);
+int ephcom_format_block(struct ephcom_Header *header, int blocknum, double *datablock,
+                        char *buf);
+
+
+/*
+   The ephemeris, and the ring of chunk buffers, shared by all threads.
+   Chunk c goes in slot c modulo nslots once the chunk before it in that
+   slot has been written.
+*/
+struct eph2asc_Job {
+    struct ephcom_Header *header;
+    int fd;
+    int nblocks, nchunks;
+    int nslots;
+    char **buf;            /* Formatted blocks of each slot */
+    int *chunk;            /* Chunk in each slot, or -1 if the slot is free */
+    int *nbytes;           /* Bytes in each slot: 0 until formatted, -1 on error */
+    int nextchunk;         /* Next chunk for a thread to take */
+    pthread_mutex_t lock;
+    pthread_cond_t changed; /* A slot was filled or freed */
+};
+
+
+/*
+   eph2asc_worker() - Thread body: take chunks in order, wait for a free
+   slot, and read and format each block of the chunk into it.
+*/
+static void *eph2asc_worker(void *arg) {
+
+    struct eph2asc_Job *job = arg;
+    double *datablock;
+    int c, s, n, blocknum, last;
+
+    datablock = (double *)malloc(job->header->ncoeff * sizeof(double));
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        c = job->nextchunk++;
+        if (c >= job->nchunks) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        s = c % job->nslots;
+        while (job->chunk[s] != -1)
+            pthread_cond_wait(&job->changed, &job->lock);
+        job->chunk[s] = c;
+        job->nbytes[s] = 0;
+        pthread_mutex_unlock(&job->lock);
+
+        n = 0;
+        last = (c + 1) * EPH2ASC_CHUNK < job->nblocks ? (c + 1) * EPH2ASC_CHUNK : job->nblocks;
+        for (blocknum=c * EPH2ASC_CHUNK; blocknum<last && n>=0; blocknum++) {
+            if (ephcom_pread_block(job->fd, job->header, blocknum, datablock) <= 0)
+                n = -1;
+            else
+                n += ephcom_format_block(job->header, blocknum, datablock, &job->buf[s][n]);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->nbytes[s] = n;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+    }
+    free(datablock);
+
+    return(NULL);
+}
+
+
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1;
+    struct eph2asc_Job job;
+    pthread_t thread[64];
+    int nthreads;
+    int i, c, s, n;
+    FILE *infp, *outfp;
+
+    if (argc < 4) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-input ascii-header-output ascii-data-output [threads]\n\n",
+           argv[0]);
+        exit(1);
+    }
+    nthreads = argc > 4 ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > 64) nthreads = 64;
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+/*
+   Neither output may exist, checked before either is created.
+*/
+    for (i=2; i<=3; i++) {
+        if ((outfp = fopen(argv[i],"r")) != NULL) {    //先用只读方式打开，判断文件是否存在
+            fprintf(stderr,"\nERROR: Output ASCII file %s already exists.\n\n", argv[i]);
+            exit(1);
+        }
+    }
+    for (i=2; i<=3; i++) {
+        if ((outfp = fopen(argv[i],"wb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[i]);
+            exit(1);
+        }
+        if (i == 2) {
+            ephcom_readbinary_header(infp, &header1);
+            ephcom_writeascii_header(outfp, &header1);
+            fclose(outfp);
+        }
+    }
+/*
+   Start the threads, then write each chunk as soon as it is formatted.
+*/
+    job.header = &header1;
+    job.fd = fileno(infp);
+    job.nblocks = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+    job.nchunks = (job.nblocks + EPH2ASC_CHUNK - 1) / EPH2ASC_CHUNK;
+    job.nslots = 2 * nthreads;
+    job.buf = (char **)malloc(job.nslots * sizeof(char *));
+    job.chunk = (int *)malloc(job.nslots * sizeof(int));
+    job.nbytes = (int *)malloc(job.nslots * sizeof(int));
+    for (s=0; s<job.nslots; s++) {
+        job.buf[s] = (char *)malloc(EPH2ASC_CHUNK * EPHCOM_ASCIIBLOCK(header1.ncoeff));
+        job.chunk[s] = -1;
+    }
+    job.nextchunk = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+    for (i=0; i<nthreads; i++)
+        if (pthread_create(&thread[i], NULL, eph2asc_worker, &job) != 0)
+            break;
+    nthreads = i;
+    if (nthreads == 0) {
+        fprintf(stderr,"\nERROR: Can't start a thread.\n\n");
+        exit(1);
+    }
+
+    for (c=0; c<job.nchunks; c++) {
+        s = c % job.nslots;
+        pthread_mutex_lock(&job.lock);
+        while (job.chunk[s] != c || job.nbytes[s] == 0)
+            pthread_cond_wait(&job.changed, &job.lock);
+        n = job.nbytes[s];
+        pthread_mutex_unlock(&job.lock);
+        if (n < 0) {
+            fprintf(stderr,"\nERROR: Can't read data blocks %d to %d of %s.\n\n",
+                    c * EPH2ASC_CHUNK + 1, (c + 1) * EPH2ASC_CHUNK, argv[1]);
+            exit(1);
+        }
+        if (fwrite(job.buf[s], 1, n, outfp) != (size_t)n) {
+            fprintf(stderr,"\nERROR: Can't write %s.\n\n", argv[3]);
+            exit(1);
+        }
+        pthread_mutex_lock(&job.lock);
+        job.chunk[s] = -1;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+    for (i=0; i<nthreads; i++)
+        pthread_join(thread[i], NULL);
+
+    if (fclose(outfp) != 0) {
+        fprintf(stderr,"\nERROR: Can't write %s.\n\n", argv[3]);
+        exit(1);
+    }
+    fclose(infp);
+
+    printf("\nWrote the ASCII header and %d data blocks, %d coefficients per data block, with %d threads.\n\n",
+           job.nblocks, header1.ncoeff, nthreads);
+
+    return 0;
+}
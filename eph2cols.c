@@ -0,0 +1,293 @@
+/*
+   eph2cols - program to export the Chebyshev coefficients of a JPL binary
+              ephemeris as columns for analysis tools: flat arrays of one
+              type each, which can be mapped into memory and used as they
+              are, and a text schema describing them.
+
+         There is one row per coefficient of every series in every block,
+         in the order ephcom_parse_block() lists them, with columns:
+
+            block        int32    data block number, from 0
+            start, end   float64  Julian days the block covers
+            body         int8     series, 1 (Mercury) to 13 (Libration)
+            subinterval  int16    subinterval of the block, from 0
+            coordinate   int8     0 to 2 (x y z, nutation psi eps,
+                                  libration phi theta psi)
+            coefficient  int16    Chebyshev degree, from 0
+            value        float64  the coefficient
+
+         Every block has the same number of rows, so a block's rows have a
+         fixed place in each column.  Blocks are read and spread into
+         columns in chunks by parallel threads, each writing its chunk
+         straight to its place in the output with pwrite().  The columns
+         follow one another, each starting on a 4096-byte boundary, in
+         this machine's byte order; the schema gives their offsets.
+
+         Format:
+
+            eph2cols binary-input columns-output schema-output [threads]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <pthread.h>
+#include <unistd.h>    //pwrite(), ftruncate(), sysconf()
+#include "ephcom.h"
+
+#define EPH2COLS_CHUNK 64   /* Blocks spread into columns by a thread at a time */
+#define EPH2COLS_ALIGN 4096 /* Columns start on multiples of this */
+#define EPH2COLS_NCOLS 8
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_pread_block(int fd, struct ephcom_Header *header,
+                       int blocknum, double *datablock);
+int ephcom_hostorder(void);
+
+
+/*
+   The columns, in the order they are written.
+*/
+static struct {
+    char *name;
+    char *type;
+    int size;
+} eph2cols_column[EPH2COLS_NCOLS] = {
+    {"block", "int32", 4},       {"start", "float64", 8},
+    {"end", "float64", 8},       {"body", "int8", 1},
+    {"subinterval", "int16", 2}, {"coordinate", "int8", 1},
+    {"coefficient", "int16", 2}, {"value", "float64", 8}};
+
+/*
+   The ephemeris, the rows of one block, and where the columns go, shared
+   by all threads.
+*/
+struct eph2cols_Job {
+    struct ephcom_Header *header;
+    int infd, outfd;
+    int nblocks;
+    int nrows;             /* Rows per block */
+    int *word;             /* Block word (from 0) of each row */
+    signed char *body, *coordinate;
+    short *subinterval, *coefficient;
+    long long offset[EPH2COLS_NCOLS]; /* Byte offset of each column */
+    int nextblock;         /* First block of the next chunk for a thread to take */
+    int failed;            /* Set, with a message on stderr, if a block fails */
+    pthread_mutex_t lock;
+};
+
+
+/*
+   eph2cols_worker() - Thread body: take chunks of blocks, spread each
+   into rows, and write the chunk's part of every column.
+*/
+static void *eph2cols_worker(void *arg) {
+
+    struct eph2cols_Job *job = arg;
+    double *datablock;
+    char *buf[EPH2COLS_NCOLS];
+    int first, last, blocknum, i, j;
+    long r;
+    size_t nbytes;
+
+    datablock = (double *)malloc(job->header->ncoeff * sizeof(double));
+    for (i=0; i<EPH2COLS_NCOLS; i++)
+        buf[i] = (char *)malloc((size_t)EPH2COLS_CHUNK * job->nrows * eph2cols_column[i].size);
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        first = job->failed ? job->nblocks : job->nextblock;
+        job->nextblock += EPH2COLS_CHUNK;
+        pthread_mutex_unlock(&job->lock);
+        if (first >= job->nblocks)
+            break;
+        last = first + EPH2COLS_CHUNK < job->nblocks ? first + EPH2COLS_CHUNK : job->nblocks;
+
+        for (r=0, blocknum=first; blocknum<last; blocknum++) {
+            if (ephcom_pread_block(job->infd, job->header, blocknum, datablock) <= 0) {
+                fprintf(stderr,"\nERROR: Can't read data block %d.\n\n", blocknum + 1);
+                break;
+            }
+            for (j=0; j<job->nrows; j++, r++) {
+                ((int *)buf[0])[r] = blocknum;
+                ((double *)buf[1])[r] = datablock[0];
+                ((double *)buf[2])[r] = datablock[1];
+                ((signed char *)buf[3])[r] = job->body[j];
+                ((short *)buf[4])[r] = job->subinterval[j];
+                ((signed char *)buf[5])[r] = job->coordinate[j];
+                ((short *)buf[6])[r] = job->coefficient[j];
+                ((double *)buf[7])[r] = datablock[job->word[j]];
+            }
+        }
+        for (i=0; i<EPH2COLS_NCOLS && blocknum == last; i++) {
+            nbytes = (size_t)r * eph2cols_column[i].size;
+            if (pwrite(job->outfd, buf[i], nbytes, (off_t)(job->offset[i] +
+                       (long long)first * job->nrows * eph2cols_column[i].size)) != (ssize_t)nbytes) {
+                fprintf(stderr,"\nERROR: Can't write column %s.\n\n", eph2cols_column[i].name);
+                break;
+            }
+        }
+        if (i < EPH2COLS_NCOLS) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    for (i=0; i<EPH2COLS_NCOLS; i++)
+        free(buf[i]);
+    free(datablock);
+
+    return(NULL);
+}
+
+
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1;
+    struct eph2cols_Job job;
+    pthread_t thread[64];
+    int nthreads;
+    int ptr, ncf, nsub, ncoords;
+    int i, k, sub, coord, coef;
+    long long nrows, end;
+    FILE *infp, *outfp, *colfp, *schemafp;
+/*
+   Names of the objects in Chebyshev coefficient arrays.
+*/
+    static char *ephcom_coeffname[13] = {
+        "Mercury", "Venus", "EMBary", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune",
+        "Pluto", "Moon", "Sun", "Nutation", "Libration"};
+
+    if (argc < 4) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-input columns-output schema-output [threads]\n\n",
+           argv[0]);
+        exit(1);
+    }
+    nthreads = argc > 4 ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > 64) nthreads = 64;
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+/*
+   Neither output may exist.  The schema is only created once the
+   columns are complete.
+*/
+    for (i=2; i<=3; i++) {
+        if ((outfp = fopen(argv[i],"r")) != NULL) {    //先用只读方式打开，判断文件是否存在
+            fprintf(stderr,"\nERROR: Output file %s already exists.\n\n", argv[i]);
+            exit(1);
+        }
+    }
+    if ((colfp = fopen(argv[2],"wb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[2]);
+        exit(1);
+    }
+
+    ephcom_readbinary_header(infp, &header1);
+    job.header = &header1;
+    job.infd = fileno(infp);
+    job.outfd = fileno(colfp);
+    job.nblocks = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+/*
+   The rows of one block: every coefficient of every series present, in
+   block order within each series.
+*/
+    job.nrows = 0;
+    for (i=0; i<13; i++) {
+        ncf  = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+        nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+        if (ncf > 0 && nsub > 0)
+            job.nrows += ncf * nsub * (i == 11 ? 2 : 3);
+    }
+    if (job.nrows == 0 || job.nblocks <= 0) {
+        fprintf(stderr,"\nERROR: %s has no coefficients.\n\n", argv[1]);
+        exit(1);
+    }
+    job.word = (int *)malloc(job.nrows * sizeof(int));
+    job.body = (signed char *)malloc(job.nrows);
+    job.coordinate = (signed char *)malloc(job.nrows);
+    job.subinterval = (short *)malloc(job.nrows * sizeof(short));
+    job.coefficient = (short *)malloc(job.nrows * sizeof(short));
+    for (k=0, i=0; i<13; i++) {
+        ptr  = i == 12 ? header1.lpt[0] : header1.ipt[i][0];
+        ncf  = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+        nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+        ncoords = (i == 11 ? 2 : 3);
+        if (ncf <= 0 || nsub <= 0)
+            continue;
+        for (sub=0; sub<nsub; sub++)
+            for (coord=0; coord<ncoords; coord++)
+                for (coef=0; coef<ncf; coef++, k++) {
+                    job.word[k] = ptr - 1 + (sub * ncoords + coord) * ncf + coef;
+                    job.body[k] = i + 1;
+                    job.subinterval[k] = sub;
+                    job.coordinate[k] = coord;
+                    job.coefficient[k] = coef;
+                }
+    }
+/*
+   Lay out the columns and size the file, so each chunk can be written
+   to its place as soon as it is ready.
+*/
+    nrows = (long long)job.nblocks * job.nrows;
+    for (end=0, i=0; i<EPH2COLS_NCOLS; i++) {
+        job.offset[i] = (end + EPH2COLS_ALIGN - 1) / EPH2COLS_ALIGN * EPH2COLS_ALIGN;
+        end = job.offset[i] + nrows * eph2cols_column[i].size;
+    }
+    if (ftruncate(job.outfd, (off_t)end) != 0) {
+        fprintf(stderr,"\nERROR: Can't make %s %lld bytes long.\n\n", argv[2], end);
+        exit(1);
+    }
+
+    job.nextblock = 0;
+    job.failed = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    for (i=1; i<nthreads; i++)
+        if (pthread_create(&thread[i], NULL, eph2cols_worker, &job) != 0)
+            break;
+    nthreads = i;
+    eph2cols_worker(&job);     /* This thread works too */
+    for (i=1; i<nthreads; i++)
+        pthread_join(thread[i], NULL);
+    if (job.failed)
+        exit(1);
+    if (fclose(colfp) != 0) {
+        fprintf(stderr,"\nERROR: Can't write %s.\n\n", argv[2]);
+        exit(1);
+    }
+    fclose(infp);
+/*
+   The schema, created last so it only exists for a complete export.
+*/
+    if ((schemafp = fopen(argv[3],"wb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[3]);
+        exit(1);
+    }
+    fprintf(schemafp, "# eph2cols schema: one row per Chebyshev coefficient of %s\n", argv[1]);
+    fprintf(schemafp, "# column name type byte-offset; every column holds all rows\n");
+    fprintf(schemafp, "file %s\n", argv[2]);
+    fprintf(schemafp, "byteorder %s\n",
+            ephcom_hostorder() == EPHCOM_LITTLEENDIAN ? "little" : "big");
+    fprintf(schemafp, "rows %lld\n", nrows);
+    fprintf(schemafp, "blocks %d\n", job.nblocks);
+    fprintf(schemafp, "rowsperblock %d\n", job.nrows);
+    for (i=0; i<EPH2COLS_NCOLS; i++)
+        fprintf(schemafp, "column %s %s %lld\n", eph2cols_column[i].name,
+                eph2cols_column[i].type, job.offset[i]);
+    for (i=0; i<13; i++)
+        fprintf(schemafp, "body %d %s\n", i + 1, ephcom_coeffname[i]);
+    if (fclose(schemafp) != 0) {
+        fprintf(stderr,"\nERROR: Can't write %s.\n\n", argv[3]);
+        exit(1);
+    }
+
+    printf("\nWrote %lld rows (%d data blocks of %d coefficients) in %d columns, with %d threads.\n\n",
+           nrows, job.nblocks, job.nrows, EPH2COLS_NCOLS, nthreads);
+
+    return 0;
+}
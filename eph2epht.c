@@ -0,0 +1,154 @@
+/*
+   eph2epht - program to lay out a JPL binary ephemeris body-major, so
+              that a scan of one body over a long time reads only that
+              body's coefficients, in one sequential stream.
+
+         A JPL file interleaves every body in each data block, so reading
+         the Moon over a century reads every byte of every block.  The
+         body-major container keeps the two header records as they are,
+         then stores the block times and each series' coefficients as
+         columns, block after block (see ephcom_readt_index() for the
+         layout).  ephcom_readbinary_header() recognizes the container,
+         ephcom_readbinary_block() gathers whole blocks from it bit for
+         bit, and ephcom_readt_series() reads one series alone.
+
+         The input is read once; each column is written in runs of
+         EPH2EPHT_RUN blocks.
+
+         Format:
+
+            eph2epht binary-input-file container-output-file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <string.h>    //memcmp()
+#include "ephcom.h"
+
+#define EPH2EPHT_RUN 256  /* Blocks buffered for each column before writing */
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_readbinary_block(FILE *infp, struct ephcom_Header *header,
+                            int blocknum, double *datablock);
+int ephcom_series_extent(struct ephcom_Header *header, int series, int *first);
+int ephcom_outint(FILE *outfp, unsigned u);
+void ephcom_swap64(void *buf, int n);
+int ephcom_hostorder(void);
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1;
+    double *datablock;     /* Coefficients of one data block */
+    double *checkblock;    /* Same block, put back together from its series */
+    double *run[14];       /* Block times, then each series, for EPH2EPHT_RUN blocks */
+    long long column[14];  /* File offset of each column */
+    int first[14], n[14];  /* Where each column's values lie in a data block */
+    int nblocks;           /* Data blocks in the ephemeris */
+    int nrun;              /* Blocks in the current run */
+    int i, j, k;
+    long headerbytes;      /* Bytes in the two header records */
+    long long offset;
+    char *headerbuf;
+    FILE *infp, *outfp;
+
+    if (argc < 3) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-input container-output\n\n",
+           argv[0]);
+        exit(1);
+    }
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+
+    if ((outfp = fopen(argv[2],"r")) == NULL) {    //先用只读方式打开，判断文件是否存在
+        if ((outfp = fopen(argv[2],"wb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[2]);
+            exit(1);
+        }
+    }
+    else {
+        fprintf(stderr,"\nERROR: Output ephemeris file %s already exists.\n\n", argv[2]);
+        exit(1);
+    }
+
+    ephcom_readbinary_header(infp, &header1);
+    if (header1.toffset != NULL) {
+        fprintf(stderr,"\nERROR: %s is already a body-major container.\n\n", argv[1]);
+        exit(1);
+    }
+    nblocks = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+/*
+   Copy the two header records as they are, with the container tag after
+   them, and work out where each column goes.
+*/
+    headerbytes = 2L * header1.ncoeff * 8;
+    headerbuf = (char *)malloc(headerbytes);
+    rewind(infp);
+    if (fread(headerbuf, 1, headerbytes, infp) != (size_t)headerbytes) {
+        fprintf(stderr,"\nERROR: %s is too short for its header.\n\n", argv[1]);
+        exit(1);
+    }
+    fwrite(headerbuf, 1, headerbytes, outfp);
+    free(headerbuf);
+
+    fwrite(EPHCOM_TMAGIC, 1, 8, outfp);
+    ephcom_outint(outfp, nblocks);
+    ephcom_outint(outfp, 0);
+    offset = headerbytes + 16;
+    for (j=0; j<14; j++) {
+        n[j] = ephcom_series_extent(&header1, j - 1, &first[j]);
+        column[j] = offset;
+        offset += (long long)nblocks * n[j] * 8;
+        run[j] = (double *)malloc((EPH2EPHT_RUN * n[j] + 1) * sizeof(double));
+    }
+/*
+   Split each block into its columns, checking that they put the whole
+   block back together, and write each column a run at a time.  Values
+   go out in the byte order of the header records.
+*/
+    datablock  = (double *)malloc(header1.ncoeff * sizeof(double));
+    checkblock = (double *)malloc(header1.ncoeff * sizeof(double));
+    for (i=0; i<nblocks; i+=nrun) {
+        nrun = nblocks - i < EPH2EPHT_RUN ? nblocks - i : EPH2EPHT_RUN;
+        for (k=0; k<nrun; k++) {
+            if (ephcom_readbinary_block(infp, &header1, i + k, datablock) <= 0) {
+                fprintf(stderr,"\nERROR: %s ends before data block %d.\n\n", argv[1], i + k + 1);
+                exit(1);
+            }
+            memset(checkblock, 0, header1.ncoeff * sizeof(double));
+            for (j=0; j<14; j++) {
+                memcpy(&run[j][k * n[j]], &datablock[first[j]], n[j] * sizeof(double));
+                memcpy(&checkblock[first[j]], &datablock[first[j]], n[j] * sizeof(double));
+            }
+            if (memcmp(datablock, checkblock, header1.ncoeff * sizeof(double)) != 0) {
+                fprintf(stderr,"\nERROR: data block %d has coefficients outside its series.\n\n",
+                        i + k + 1);
+                exit(1);
+            }
+        }
+        for (j=0; j<14; j++) {
+            if (n[j] == 0)
+                continue;
+            if (header1.byteorder != ephcom_hostorder())
+                ephcom_swap64(run[j], nrun * n[j]);
+            fseek(outfp, (long)(column[j] + (long long)i * n[j] * 8), SEEK_SET);
+            fwrite(run[j], 8, (size_t)nrun * n[j], outfp);
+        }
+    }
+
+    fclose(outfp);
+    fclose(infp);
+
+    printf("Laid out %d data blocks of %d coefficients body-major.\n\n", nblocks, header1.ncoeff);
+    for (j=1; j<14; j++)
+        if (n[j] > 0)
+            printf("Series %2d: %4d coefficients a block, from byte %lld.\n", j, n[j], column[j]);
+    printf("\n");
+
+    return 0;
+}
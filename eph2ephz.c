@@ -0,0 +1,133 @@
+/*
+   eph2ephz - program to pack a JPL binary ephemeris into a compressed
+              container.
+
+         Every data block is compressed on its own, and a block directory
+         placed after the two (unchanged) header records gives the file
+         offset of each one, so any block can still be read directly.
+         ephcom_readbinary_header() recognizes the container, and
+         ephcom_readbinary_block() unpacks blocks bit for bit, so all
+         interpolation results are identical to those from the input file.
+
+         Format:
+
+            eph2ephz binary-input-file container-output-file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <string.h>    //memcmp()
+#include "ephcom.h"
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_readbinary_block(FILE *infp, struct ephcom_Header *header,
+                            int blocknum, double *datablock);
+int ephcom_zpack_block(struct ephcom_Header *header, double *datablock,
+                       unsigned char *zblock);
+int ephcom_zunpack_block(struct ephcom_Header *header, unsigned char *zblock,
+                         int nbytes, double *datablock);
+int ephcom_outint(FILE *outfp, unsigned u);
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1;
+    double *datablock;     /* Coefficients of one data block */
+    double *checkblock;    /* Same block, unpacked again for verification */
+    unsigned char *zblock; /* One compressed data block */
+    long long *offset;     /* File offset of each compressed block */
+    int nblocks;           /* Data blocks in the ephemeris */
+    int nbytes;            /* Bytes in one compressed block */
+    int i, j;
+    long headerbytes;      /* Bytes in the two header records */
+    char *headerbuf;
+    FILE *infp, *outfp;
+
+    if (argc < 3) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-input container-output\n\n",
+           argv[0]);
+        exit(1);
+    }
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+
+    if ((outfp = fopen(argv[2],"r")) == NULL) {    //先用只读方式打开，判断文件是否存在
+        if ((outfp = fopen(argv[2],"wb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[2]);
+            exit(1);
+        }
+    }
+    else {
+        fprintf(stderr,"\nERROR: Output ephemeris file %s already exists.\n\n", argv[2]);
+        exit(1);
+    }
+
+    ephcom_readbinary_header(infp, &header1);
+    if (header1.zoffset != NULL) {
+        fprintf(stderr,"\nERROR: %s is already a compressed container.\n\n", argv[1]);
+        exit(1);
+    }
+    nblocks = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+/*
+   Copy the two header records as they are, then leave room for the
+   block directory, which is filled in once all block sizes are known.
+*/
+    headerbytes = 2L * header1.ncoeff * 8;
+    headerbuf = (char *)malloc(headerbytes);
+    rewind(infp);
+    if (fread(headerbuf, 1, headerbytes, infp) != (size_t)headerbytes) {
+        fprintf(stderr,"\nERROR: %s is too short for its header.\n\n", argv[1]);
+        exit(1);
+    }
+    fwrite(headerbuf, 1, headerbytes, outfp);
+    free(headerbuf);
+
+    fwrite(EPHCOM_ZMAGIC, 1, 8, outfp);
+    ephcom_outint(outfp, nblocks);
+    ephcom_outint(outfp, 0);
+    offset = (long long *)malloc((nblocks + 1) * sizeof(long long));
+    offset[0] = headerbytes + 16 + 8L * (nblocks + 1);
+    fseek(outfp, (long)offset[0], SEEK_SET);
+/*
+   Pack each block, check that it unpacks to the same bits, and write it.
+*/
+    datablock  = (double *)malloc(header1.ncoeff * sizeof(double));
+    checkblock = (double *)malloc(header1.ncoeff * sizeof(double));
+    zblock = (unsigned char *)malloc(1 + 8 * header1.ncoeff);
+    for (i=0; i<nblocks; i++) {
+        if (ephcom_readbinary_block(infp, &header1, i, datablock) <= 0) {
+            fprintf(stderr,"\nERROR: %s ends before data block %d.\n\n", argv[1], i + 1);
+            exit(1);
+        }
+        nbytes = ephcom_zpack_block(&header1, datablock, zblock);
+        if (ephcom_zunpack_block(&header1, zblock, nbytes, checkblock) != header1.ncoeff ||
+            memcmp(datablock, checkblock, header1.ncoeff * sizeof(double)) != 0) {
+            fprintf(stderr,"\nERROR: data block %d does not unpack exactly.\n\n", i + 1);
+            exit(1);
+        }
+        fwrite(zblock, 1, nbytes, outfp);
+        offset[i + 1] = offset[i] + nbytes;
+    }
+/*
+   Now write the block directory, 8-byte offsets in big-endian order.
+*/
+    fseek(outfp, headerbytes + 16, SEEK_SET);
+    for (i=0; i<=nblocks; i++)
+        for (j=56; j>=0; j-=8)
+            fputc((int)((offset[i] >> j) & 0xff), outfp);
+
+    fclose(outfp);
+    fclose(infp);
+
+    printf("Packed %d data blocks of %d coefficients.\n\n", nblocks, header1.ncoeff);
+    printf("%s: %ld bytes of data blocks in %lld bytes (%.1f%%).\n\n",
+           argv[2], (long)nblocks * header1.ncoeff * 8, offset[nblocks] - offset[0],
+           100.0 * (offset[nblocks] - offset[0]) / ((double)nblocks * header1.ncoeff * 8));
+
+    return 0;
+}
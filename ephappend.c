@@ -0,0 +1,174 @@
+/*
+   ephappend - program to extend a JPL binary ephemeris in place with the
+               data blocks of another binary ephemeris that carries on
+               from where it ends, e.g. the latest fit of a local
+               ephemeris, without rewriting the blocks already there.
+
+         The extension must have the same block layout (ncoeff, ipt[][]
+         and lpt[]) and days per block.  Its blocks that end at or before
+         the ephemeris's stop epoch ss[1] are skipped; the rest must start
+         exactly at ss[1] and follow on from one another without gaps.
+         It must also be a fit of the same DE number with the same AU and
+         EMRAT (to within EPHAPPEND_TOLERANCE, as ephcom_set_open()
+         allows), as the constants stay those of the ephemeris being
+         extended.
+
+         Only the new blocks are written, at (blocknum + 2) * ncoeff * 8
+         bytes as usual, in the file's own byte order.  Once they are on
+         disk (fsync), the new ss[1] is written with one 8-byte write
+         and synced, so a reader sees either the old ephemeris or the
+         whole new one; a run that is interrupted before then leaves the
+         old one as it was, and can be run again.  The "Final Epoch"
+         title line is updated last.
+
+         Compressed (eph2ephz) and body-major (eph2epht) containers can't
+         be extended in place; rebuild them from the extended binary.
+
+         Format:
+
+            ephappend binary-ephemeris binary-extension
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <string.h>    //memcmp(), strlen()
+#include <math.h>      //fabs()
+#include <unistd.h>    //pwrite(), fsync()
+#include "ephcom.h"
+
+#define EPHAPPEND_SS1OFFSET (3*84 + 400*6 + 8) /* Byte offset of ss[1] in the file */
+#define EPHAPPEND_TTLOFFSET (2*84)             /* Byte offset of the "Final Epoch" title */
+#define EPHAPPEND_TOLERANCE 1.0e-9             /* Relative difference allowed in AU, EMRAT */
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_readbinary_block(FILE *infp, struct ephcom_Header *header,
+                            int blocknum, double *datablock);
+int ephcom_hostorder(void);
+void ephcom_swap64(void *, int);
+int ephcom_jd2cal(double tjd, int idate[6], int calendar_type);
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1, header2; /* Ephemeris and extension headers */
+    double *datablock;
+    double stopjd;      /* End of the ephemeris, with the blocks written so far */
+    double ss1;         /* stopjd as it goes in the file */
+    int nblocks1, nblocks2;
+    int nnew;           /* Blocks appended */
+    int i, blocknum, fd;
+    int idate[6];
+    char title[EPHCOM_MAXLINE + 1];
+    char *month[12] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN",
+                       "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
+    FILE *infp, *outfp;
+
+    if (argc < 3) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-ephemeris binary-extension\n\n",
+           argv[0]);
+        exit(1);
+    }
+
+    if ((outfp = fopen(argv[1],"r+b")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for update.\n\n", argv[1]);
+        exit(1);
+    }
+    if ((infp = fopen(argv[2],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[2]);
+        exit(1);
+    }
+
+    ephcom_readbinary_header(outfp, &header1);
+    ephcom_readbinary_header(infp, &header2);
+    if (header1.zoffset != NULL || header1.toffset != NULL) {
+        fprintf(stderr,"\nERROR: %s is a compressed or body-major container.\n", argv[1]);
+        fprintf(stderr,"       Only a plain binary ephemeris can be extended in place.\n\n");
+        exit(1);
+    }
+    if (header2.ncoeff != header1.ncoeff || header2.ss[2] != header1.ss[2] ||
+        memcmp(header2.ipt, header1.ipt, sizeof(header1.ipt)) != 0 ||
+        memcmp(header2.lpt, header1.lpt, sizeof(header1.lpt)) != 0) {
+        fprintf(stderr,"\nERROR: %s doesn't have the block layout and span of %s.\n\n",
+                argv[2], argv[1]);
+        exit(1);
+    }
+    if (header2.numde != header1.numde ||
+        fabs(header2.au - header1.au) > EPHAPPEND_TOLERANCE * fabs(header1.au) ||
+        fabs(header2.emrat - header1.emrat) > EPHAPPEND_TOLERANCE * fabs(header1.emrat)) {
+        fprintf(stderr,"\nERROR: %s and %s have different DE numbers, AU or EMRAT.\n\n",
+                argv[2], argv[1]);
+        exit(1);
+    }
+    nblocks1 = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+    nblocks2 = (int)((header2.ss[1] - header2.ss[0]) / header2.ss[2] + 0.5);
+/*
+   Write the new blocks after the last one, in the file's byte order.
+*/
+    fd = fileno(outfp);
+    datablock = (double *)malloc(header1.ncoeff * sizeof(double));
+    stopjd = header1.ss[1];
+    nnew = 0;
+    for (blocknum=0; blocknum<nblocks2; blocknum++) {
+        if (ephcom_readbinary_block(infp, &header2, blocknum, datablock) <= 0) {
+            fprintf(stderr,"\nERROR: %s ends before data block %d.\n\n", argv[2], blocknum + 1);
+            exit(1);
+        }
+        if (datablock[1] <= header1.ss[1])
+            continue;   /* Already in the ephemeris */
+        if (datablock[0] != stopjd || datablock[1] - datablock[0] != header1.ss[2]) {
+            fprintf(stderr,
+                    "\nERROR: Block %d of %s (%.9f to %.9f) doesn't follow on from JD %.9f.\n\n",
+                    blocknum + 1, argv[2], datablock[0], datablock[1], stopjd);
+            exit(1);
+        }
+        stopjd = datablock[1];
+        if (header1.byteorder != ephcom_hostorder())
+            ephcom_swap64(datablock, header1.ncoeff);
+        if (pwrite(fd, datablock, header1.ncoeff * sizeof(double),
+                   (off_t)(nblocks1 + nnew + 2) * header1.ncoeff * 8) !=
+            (ssize_t)(header1.ncoeff * sizeof(double))) {
+            fprintf(stderr,"\nERROR: Can't write data block %d of %s.\n\n",
+                    nblocks1 + nnew + 1, argv[1]);
+            exit(1);
+        }
+        nnew++;
+    }
+    fclose(infp);
+    if (nnew == 0) {
+        printf("\n%s has no blocks after JD %.9f; %s is unchanged.\n\n",
+               argv[2], header1.ss[1], argv[1]);
+        return 0;
+    }
+/*
+   The blocks are on disk before the header says they are there: ss[1]
+   goes last, in one write.
+*/
+    ss1 = stopjd;
+    if (header1.byteorder != ephcom_hostorder())
+        ephcom_swap64(&ss1, 1);
+    if (fsync(fd) != 0 || pwrite(fd, &ss1, 8, EPHAPPEND_SS1OFFSET) != 8 || fsync(fd) != 0) {
+        fprintf(stderr,"\nERROR: Can't update the stop epoch of %s.\n\n", argv[1]);
+        exit(1);
+    }
+/*
+   The title line with the final epoch, as ephcom_writebinary_header()
+   writes it.
+*/
+    ephcom_jd2cal(stopjd, idate, 0);
+    sprintf(title,"Final Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
+            stopjd, idate[0], month[idate[1]-1], idate[2], idate[3], idate[4], idate[5]);
+    for (i=strlen(title); i<84; i++)
+        title[i] = ' ';
+    if (pwrite(fd, title, 84, EPHAPPEND_TTLOFFSET) != 84 || fsync(fd) != 0) {
+        fprintf(stderr,"\nERROR: Can't update the title of %s.\n\n", argv[1]);
+        exit(1);
+    }
+    fclose(outfp);
+
+    printf("\nAppended %d data blocks; %s now has %d data blocks, JD %.9f to %.9f.\n\n",
+           nnew, argv[1], nblocks1 + nnew, header1.ss[0], stopjd);
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*
+   ephbatch.c - evaluate one body relative to another at a very large
+                number of epochs, given in any order, in parallel threads.
+
+         Epochs are bucketed by data block with a counting sort on the
+         block number, (JD - ss[0]) / ss[2], and each bucket is cut into
+         units of at most EPHBATCH_CHUNK epochs.  The units are dealt out
+         in contiguous runs, one run per thread; a thread takes units from
+         the front of its own run and, when that is empty, steals the back
+         half of another thread's run.  Both ends of a run are one atomic
+         word, so taking and stealing are single compare-and-swaps.
+
+         Each thread has its own data block and Chebyshev scratch area
+         (see ephcom_cheby_r()), reads blocks with ephcom_pread_block() so
+         no thread waits on the FILE * of another, only reads a block when
+         its next unit is in a different one, and writes each result
+         straight to the epoch's place in the caller's output array.
+
+         Needs POSIX threads and pread(), and a C11 compiler for atomics.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>    //sysconf()
+#include <stdatomic.h>
+#include "ephcom.h"
+
+#define EPHBATCH_CHUNK      4096 /* Most epochs in one unit of work */
+#define EPHBATCH_MAXTHREADS 256
+
+
+int ephcom_pread_block(int fd, struct ephcom_Header *header,
+                       int blocknum, double *datablock);
+int ephcom_interp_series_r(struct ephcom_Header *header, double *datablock,
+                           int series, double jd, double *pv,
+                           struct ephcom_ChebyScratch *scratch);
+
+
+/*
+   One unit of work: epochs order[first..last-1], all in data block block.
+*/
+struct ephbatch_Unit {
+    int block;
+    int first, last;
+};
+
+/*
+   A thread's run of units, first in the high 32 bits and one past the
+   last in the low 32 bits, alone on its cache line.
+*/
+struct ephbatch_Run {
+    _Atomic unsigned long long range;
+    char pad[64 - sizeof(unsigned long long)];
+};
+
+struct ephbatch_Job {
+    struct ephcom_Header *header;
+    int fd;
+    int ntarg, ncntr;
+    double posscale;          /* km or AU */
+    double velscale;          /* ... per day or per second */
+    double (*et2)[2];
+    double (*r)[6];
+    int *order;               /* Epoch numbers, sorted by block */
+    struct ephbatch_Unit *unit;
+    int nthreads;
+    struct ephbatch_Run *run;
+    atomic_int failed;        /* Epochs whose block couldn't be read */
+};
+
+struct ephbatch_Thread {
+    struct ephbatch_Job *job;
+    int id;
+};
+
+
+#define EPHBATCH_RANGE(lo, hi) (((unsigned long long)(lo) << 32) | (unsigned)(hi))
+
+
+/*
+   ephbatch_take() - Take the first unit of run.  Returns it, or -1 if the
+   run is empty.
+*/
+static int ephbatch_take(struct ephbatch_Run *run) {
+
+    unsigned long long range;
+    unsigned lo, hi;
+
+    range = atomic_load(&run->range);
+    do {
+        lo = (unsigned)(range >> 32);
+        hi = (unsigned)range;
+        if (lo >= hi)
+            return(-1);
+    } while (!atomic_compare_exchange_weak(&run->range, &range, EPHBATCH_RANGE(lo + 1, hi)));
+
+    return((int)lo);
+}
+
+
+/*
+   ephbatch_steal() - Take the back half of another thread's run for
+   thread id: the first unit taken is returned, the rest become id's run.
+   Returns -1 if every other run is empty.
+*/
+static int ephbatch_steal(struct ephbatch_Job *job, int id) {
+
+    int i, victim;
+    unsigned long long range;
+    unsigned lo, hi, mid;
+
+    for (i=1; i<job->nthreads; i++) {
+        victim = (id + i) % job->nthreads;
+        range = atomic_load(&job->run[victim].range);
+        for (;;) {
+            lo = (unsigned)(range >> 32);
+            hi = (unsigned)range;
+            if (lo >= hi)
+                break;
+            mid = lo + (hi - lo) / 2;     /* Leave the victim [lo, mid) */
+            if (atomic_compare_exchange_weak(&job->run[victim].range, &range,
+                                             EPHBATCH_RANGE(lo, mid))) {
+                atomic_store(&job->run[id].range, EPHBATCH_RANGE(mid + 1, hi));
+                return((int)mid);
+            }
+        }
+    }
+
+    return(-1);
+}
+
+
+/*
+   ephbatch_body() - Barycentric position and velocity of body (1 to 13,
+   as for ephcom_pleph()) at jd in the block in datablock, km and km/day.
+*/
+static void ephbatch_body(struct ephcom_Header *header, double *datablock, int body,
+                          double jd, struct ephcom_ChebyScratch *scratch, double *pv) {
+
+    int j;
+    double moon[6];
+
+    switch (body) {
+        case EPHCOM_SSBARY:
+            for (j=0; j<6; j++)
+                pv[j] = 0.0;
+            break;
+        case EPHCOM_EARTH:
+        case EPHCOM_MOON:
+            ephcom_interp_series_r(header, datablock, 2, jd, pv, scratch);
+            ephcom_interp_series_r(header, datablock, 9, jd, moon, scratch);
+            for (j=0; j<6; j++)
+                pv[j] += moon[j] * (body == EPHCOM_EARTH ? -1.0 / (1.0 + header->emrat) :
+                                    header->emrat / (1.0 + header->emrat));
+            break;
+        case EPHCOM_EMBARY:
+            ephcom_interp_series_r(header, datablock, 2, jd, pv, scratch);
+            break;
+        default:
+            ephcom_interp_series_r(header, datablock, body - 1, jd, pv, scratch);
+            break;
+    }
+}
+
+
+/*
+   ephbatch_worker() - Thread body: evaluate units until none are left.
+*/
+static void *ephbatch_worker(void *arg) {
+
+    struct ephbatch_Thread *self = arg;
+    struct ephbatch_Job *job = self->job;
+    struct ephcom_ChebyScratch scratch;
+    struct ephbatch_Unit *unit;
+    double *datablock;
+    double target[6], center[6];
+    double jd;
+    int u, i, j, k;
+    int block;                /* Block now in datablock */
+
+    memset(&scratch, 0, sizeof(scratch));
+    datablock = (double *)malloc(job->header->ncoeff * sizeof(double));
+    block = -1;
+    for (;;) {
+        if ((u = ephbatch_take(&job->run[self->id])) < 0 &&
+            (u = ephbatch_steal(job, self->id)) < 0)
+            break;
+        unit = &job->unit[u];
+        if (unit->block != block) {
+            block = unit->block;
+            if (ephcom_pread_block(job->fd, job->header, block, datablock) <= 0) {
+                for (i=unit->first; i<unit->last; i++)
+                    memset(job->r[job->order[i]], 0, 6 * sizeof(double));
+                atomic_fetch_add(&job->failed, unit->last - unit->first);
+                block = -1;
+                continue;
+            }
+        }
+        for (i=unit->first; i<unit->last; i++) {
+            k = job->order[i];
+            jd = job->et2[k][0] + job->et2[k][1];
+            if ((job->ntarg == EPHCOM_MOON && job->ncntr == EPHCOM_EARTH) ||
+                (job->ntarg == EPHCOM_EARTH && job->ncntr == EPHCOM_MOON)) {
+                /* Geocentric Moon as it is in the file, at full precision */
+                ephcom_interp_series_r(job->header, datablock, 9, jd, target, &scratch);
+                for (j=0; j<6; j++) {
+                    if (job->ntarg == EPHCOM_EARTH)
+                        target[j] = -target[j];
+                    center[j] = 0.0;
+                }
+            }
+            else {
+                ephbatch_body(job->header, datablock, job->ntarg, jd, &scratch, target);
+                ephbatch_body(job->header, datablock, job->ncntr, jd, &scratch, center);
+            }
+            for (j=0; j<3; j++) {
+                job->r[k][j]     = (target[j] - center[j]) * job->posscale;
+                job->r[k][j + 3] = (target[j + 3] - center[j + 3]) * job->velscale;
+            }
+        }
+    }
+    free(datablock);
+    free(scratch.pc);
+    free(scratch.vc);
+
+    return(NULL);
+}
+
+
+
+
+/*
+   ephcom_pleph_batch() - Position and velocity of body ntarg relative to
+   body ncntr (numbered as for ephcom_pleph(), 1 to 13) at each of the n
+   epochs et2[k][0] + et2[k][1] (Julian Days, in any order), into r[k][],
+   in km (km = 1) or AU, per day or per second (seconds = 1), using
+   nthreads threads (0 for one per processor).  infp is only used for its
+   file descriptor; header must come from it.  Epochs outside the
+   ephemeris get r[k][] = 0.  Returns the number of epochs evaluated, or
+   -1 if a body number is out of range or memory runs out.
+*/
+int ephcom_pleph_batch(FILE *infp, struct ephcom_Header *header,
+                       int ntarg, int ncntr, int km, int seconds,
+                       int n, double et2[][2], double r[][6], int nthreads) {
+
+    struct ephbatch_Job job;
+    struct ephbatch_Thread self[EPHBATCH_MAXTHREADS];
+    pthread_t thread[EPHBATCH_MAXTHREADS];
+    int *block;               /* Block number of each epoch, -1 if none */
+    int *start;               /* First place in order[] for each block */
+    int nblocks, nunits, nout;
+    int i, k, b, t, first, per;
+    double jd;
+
+    if (ntarg < 1 || ntarg > 13 || ncntr < 1 || ncntr > 13)
+        return(-1);
+    if (nthreads <= 0)
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > EPHBATCH_MAXTHREADS) nthreads = EPHBATCH_MAXTHREADS;
+/*
+   Counting sort of the epochs by block.
+*/
+    nblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+    block = (int *)malloc(n * sizeof(int));
+    start = (int *)calloc(nblocks + 1, sizeof(int));
+    nout = 0;
+    for (k=0; k<n; k++) {
+        jd = et2[k][0] + et2[k][1];
+        if (jd < header->ss[0] || jd > header->ss[1]) {
+            block[k] = -1;
+            memset(r[k], 0, 6 * sizeof(double));
+            nout++;
+            continue;
+        }
+        block[k] = (int)((jd - header->ss[0]) / header->ss[2]);
+        if (block[k] >= nblocks) /* jd is the very end of the file */
+            block[k] = nblocks - 1;
+        start[block[k] + 1]++;
+    }
+    nunits = 0;
+    for (b=0; b<nblocks; b++) {
+        nunits += (start[b + 1] + EPHBATCH_CHUNK - 1) / EPHBATCH_CHUNK;
+        start[b + 1] += start[b];
+    }
+    job.order = (int *)malloc((n - nout > 0 ? n - nout : 1) * sizeof(int));
+    for (k=0; k<n; k++)
+        if (block[k] >= 0)
+            job.order[start[block[k]]++] = k;
+    for (b=nblocks; b>0; b--)  /* Each start[] moved to the next block's */
+        start[b] = start[b - 1];
+    start[0] = 0;
+    free(block);
+/*
+   Cut the buckets into units, and deal the units out in even runs.
+*/
+    job.unit = (struct ephbatch_Unit *)malloc((nunits > 0 ? nunits : 1) *
+                                             sizeof(struct ephbatch_Unit));
+    for (i=0, b=0; b<nblocks; b++) {
+        for (first=start[b]; first<start[b + 1]; first+=EPHBATCH_CHUNK) {
+            job.unit[i].block = b;
+            job.unit[i].first = first;
+            job.unit[i].last = first + EPHBATCH_CHUNK < start[b + 1] ?
+                               first + EPHBATCH_CHUNK : start[b + 1];
+            i++;
+        }
+    }
+    free(start);
+    if (nthreads > nunits)
+        nthreads = nunits > 0 ? nunits : 1;
+    if (posix_memalign((void **)&job.run, 64, nthreads * sizeof(struct ephbatch_Run)) != 0) {
+        fprintf(stderr,"\nERROR: Can't allocate %d thread runs.\n\n", nthreads);
+        free(job.unit);
+        free(job.order);
+        return(-1);
+    }
+    per = nunits / nthreads;
+    for (t=0, first=0; t<nthreads; t++) {
+        i = first + per + (t < nunits % nthreads ? 1 : 0);
+        atomic_init(&job.run[t].range, EPHBATCH_RANGE(first, i));
+        first = i;
+    }
+
+    job.header = header;
+    job.fd = fileno(infp);
+    job.ntarg = ntarg;
+    job.ncntr = ncntr;
+    job.posscale = km ? 1.0 : 1.0 / header->au;
+    job.velscale = job.posscale / (seconds ? 86400.0 : 1.0);
+    job.et2 = et2;
+    job.r = r;
+    job.nthreads = nthreads;
+    atomic_init(&job.failed, 0);
+    for (t=0; t<nthreads; t++) {
+        self[t].job = &job;
+        self[t].id = t;
+    }
+    for (t=1; t<nthreads; t++)
+        if (pthread_create(&thread[t], NULL, ephbatch_worker, &self[t]) != 0)
+            break;
+    ephbatch_worker(&self[0]);  /* This thread works too, and steals the rest */
+    for (i=1; i<t; i++)
+        pthread_join(thread[i], NULL);
+
+    free(job.run);
+    free(job.unit);
+    free(job.order);
+
+    return(n - nout - atomic_load(&job.failed));
+}
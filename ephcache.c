@@ -0,0 +1,237 @@
+/*
+   ephcache.c - one cache of data blocks shared by every thread reading an
+                ephemeris, so that a hot block is held once, not once per
+                thread.
+
+         The cache has as many slots as fit in its memory budget, block k
+         going in slot k modulo the number of slots.  A slot points to an
+         entry (a block number and its coefficients); entries are never
+         changed once filled, only replaced.
+
+         Hits take no lock.  A reader announces the entry it is about to
+         use in its own hazard pointer, then checks that the slot still
+         points to it; an entry that has been replaced is only freed once
+         no hazard pointer holds it, so it stays valid until the reader
+         calls ephcom_cache_release().
+
+         Misses are single-flight: the first thread to miss a block puts
+         an empty entry for it in the slot with one compare-and-swap and
+         reads the block; any other thread wanting that block meanwhile
+         finds the entry and waits for it to be filled instead of reading
+         the block again.
+
+         Needs POSIX threads and pread(), and a C11 compiler for atomics.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "ephcom.h"
+
+
+int ephcom_pread_block(int fd, struct ephcom_Header *header,
+                       int blocknum, double *datablock);
+
+
+/*
+   One cached block.
+*/
+struct ephcache_Entry {
+    int blocknum;
+    atomic_int ready;              /* 0 while being read, 1 filled, -1 failed */
+    struct ephcache_Entry *next;   /* Next on the retired list */
+    double data[];                 /* header->ncoeff coefficients */
+};
+
+/*
+   A reader's hazard pointer, alone on its cache line: the alignment
+   makes every slot start a line and fill it.
+*/
+struct ephcache_Hazard {
+    _Alignas(64) _Atomic(struct ephcache_Entry *) entry;
+};
+
+struct ephcom_Cache {
+    int fd;
+    struct ephcom_Header *header;
+    int nslots;
+    _Atomic(struct ephcache_Entry *) *slot;
+    struct ephcache_Hazard hazard[EPHCOM_MAXREADERS];
+    pthread_mutex_t retiring;      /* Guards retired and nretired */
+    struct ephcache_Entry *retired; /* Replaced entries not yet freed */
+    int nretired;
+};
+
+
+/*
+   ephcache_retire() - Free entry once no reader can be using it: now, or
+   at a later retirement.  Entries are collected in batches, so that the
+   hazard pointers are scanned once per EPHCOM_MAXREADERS retirements.
+*/
+static void ephcache_retire(struct ephcom_Cache *cache, struct ephcache_Entry *entry) {
+
+    int i;
+    struct ephcache_Entry **link, *e;
+
+    pthread_mutex_lock(&cache->retiring);
+    entry->next = cache->retired;
+    cache->retired = entry;
+    if (++cache->nretired >= EPHCOM_MAXREADERS) {
+        for (link=&cache->retired; (e = *link) != NULL; ) {
+            for (i=0; i<EPHCOM_MAXREADERS; i++)
+                if (atomic_load(&cache->hazard[i].entry) == e)
+                    break;
+            if (i < EPHCOM_MAXREADERS)
+                link = &e->next;
+            else {
+                *link = e->next;
+                free(e);
+                cache->nretired--;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->retiring);
+}
+
+
+
+
+/*
+   ephcom_cache_open() - A cache of the data blocks of the ephemeris open
+   on infp, described by header, holding as many blocks as fit in
+   budget bytes (at least one).  header must stay valid while the cache
+   is in use.  Returns NULL if there is no memory for it.
+
+   The cache is allocated on a 64-byte boundary, as calloc() need not
+   align it enough for the hazard pointers to keep to their own lines.
+*/
+struct ephcom_Cache *ephcom_cache_open(FILE *infp, struct ephcom_Header *header,
+                                       long long budget) {
+
+    struct ephcom_Cache *cache;
+    long long entrybytes;
+    int i, nblocks;
+
+    if (posix_memalign((void **)&cache, 64, sizeof(struct ephcom_Cache)) != 0)
+        return(NULL);
+    memset(cache, 0, sizeof(struct ephcom_Cache));
+    cache->fd = fileno(infp);
+    cache->header = header;
+    entrybytes = sizeof(struct ephcache_Entry) + header->ncoeff * sizeof(double);
+    nblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+    cache->nslots = budget / entrybytes > nblocks ? nblocks : (int)(budget / entrybytes);
+    if (cache->nslots < 1)
+        cache->nslots = 1;
+    if ((cache->slot = calloc(cache->nslots, sizeof(*cache->slot))) == NULL) {
+        free(cache);
+        return(NULL);
+    }
+    for (i=0; i<cache->nslots; i++)
+        atomic_init(&cache->slot[i], NULL);
+    for (i=0; i<EPHCOM_MAXREADERS; i++)
+        atomic_init(&cache->hazard[i].entry, NULL);
+    pthread_mutex_init(&cache->retiring, NULL);
+
+    return(cache);
+}
+
+
+
+
+/*
+   ephcom_cache_close() - Free the cache and every block in it.  No thread
+   may be using it.
+*/
+void ephcom_cache_close(struct ephcom_Cache *cache) {
+
+    int i;
+    struct ephcache_Entry *e;
+
+    for (i=0; i<cache->nslots; i++)
+        free(atomic_load(&cache->slot[i]));
+    while ((e = cache->retired) != NULL) {
+        cache->retired = e->next;
+        free(e);
+    }
+    free(cache->slot);
+    pthread_mutex_destroy(&cache->retiring);
+    free(cache);
+}
+
+
+
+
+/*
+   ephcom_cache_acquire() - Data block blocknum, from the cache if it is
+   there, otherwise read into it, for the thread using hazard pointer
+   reader (0 to EPHCOM_MAXREADERS-1, one per thread).  The block stays
+   valid until that thread calls ephcom_cache_release() or acquires
+   another block.  Returns NULL if the block can't be read.
+*/
+double *ephcom_cache_acquire(struct ephcom_Cache *cache, int reader, int blocknum) {
+
+    _Atomic(struct ephcache_Entry *) *slot;
+    struct ephcache_Entry *e, *mine;
+    int ready;
+
+    slot = &cache->slot[blocknum % cache->nslots];
+    mine = NULL;
+    for (;;) {
+        e = atomic_load(slot);
+        if (e != NULL) {
+            atomic_store(&cache->hazard[reader].entry, e);
+            if (atomic_load(slot) != e)
+                continue;  /* Replaced before we announced it: look again */
+        }
+        if (e != NULL && e->blocknum == blocknum) {
+            free(mine);
+            while ((ready = atomic_load_explicit(&e->ready, memory_order_acquire)) == 0)
+                sched_yield();  /* Another thread is reading it */
+            if (ready < 0) {
+                atomic_store(&cache->hazard[reader].entry, NULL);
+                return(NULL);
+            }
+            return(e->data);
+        }
+    /*
+       A miss: try to be the one thread that reads this block.
+    */
+        if (mine == NULL) {
+            mine = (struct ephcache_Entry *)malloc(sizeof(struct ephcache_Entry) +
+                                                   cache->header->ncoeff * sizeof(double));
+            mine->blocknum = blocknum;
+            atomic_init(&mine->ready, 0);
+        }
+        atomic_store(&cache->hazard[reader].entry, mine);
+        if (atomic_compare_exchange_strong(slot, &e, mine))
+            break;
+    }
+
+    if (e != NULL)
+        ephcache_retire(cache, e);
+    if (ephcom_pread_block(cache->fd, cache->header, blocknum, mine->data) <= 0) {
+        atomic_store_explicit(&mine->ready, -1, memory_order_release);
+        e = mine;  /* Take the failed entry out again, if nothing else has */
+        if (atomic_compare_exchange_strong(slot, &e, NULL))
+            ephcache_retire(cache, mine);
+        atomic_store(&cache->hazard[reader].entry, NULL);
+        return(NULL);
+    }
+    atomic_store_explicit(&mine->ready, 1, memory_order_release);
+
+    return(mine->data);
+}
+
+
+
+
+/*
+   ephcom_cache_release() - Done with the block reader last acquired.
+*/
+void ephcom_cache_release(struct ephcom_Cache *cache, int reader) {
+
+    atomic_store_explicit(&cache->hazard[reader].entry, NULL, memory_order_release);
+}
@@ -0,0 +1,246 @@
+/*
+   ephclient.c - use an ephemeris served by ephserve instead of opening
+                 the file.
+
+         ephcom_client_open() connects to the server and gets the header,
+         already parsed.  ephcom_client_get_coords() then fills an
+         ephcom_Coords just as ephcom_get_coords() does, so ephcom_pleph()
+         and the rest work on it unchanged; the batch forms send many
+         times in each request, to make the round trip worth it.
+
+         The server and its clients run on the same machine, so nothing
+         is converted on the way; see struct ephcom_ServeRequest.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ephcom.h"
+
+
+/*
+   ephclient_readall(), ephclient_writeall() - read or write exactly
+   nbytes.  Return 0, or -1 if the server has gone.
+*/
+static int ephclient_readall(int sock, void *buf, size_t nbytes) {
+
+    ssize_t k;
+    char *p = (char *)buf;
+
+    while (nbytes > 0) {
+        if ((k = read(sock, p, nbytes)) <= 0) {
+            if (k < 0 && errno == EINTR)
+                continue;
+            return(-1);
+        }
+        p += k;
+        nbytes -= k;
+    }
+    return(0);
+}
+
+static int ephclient_writeall(int sock, void *buf, size_t nbytes) {
+
+    ssize_t k;
+    char *p = (char *)buf;
+
+    while (nbytes > 0) {
+        if ((k = write(sock, p, nbytes)) <= 0) {
+            if (k < 0 && errno == EINTR)
+                continue;
+            return(-1);
+        }
+        p += k;
+        nbytes -= k;
+    }
+    return(0);
+}
+
+
+/*
+   ephclient_ask() - Send one request with its n times, and read back the
+   reply and its results, width doubles for each time, into out.  Returns
+   the reply status, or -1 if the server has gone.
+*/
+static int ephclient_ask(int sock, struct ephcom_ServeRequest *request,
+                         double (*et2)[2], double *out, int width) {
+
+    struct ephcom_ServeReply reply;
+
+    request->magic = EPHCOM_SERVE_MAGIC;
+    if (ephclient_writeall(sock, request, sizeof(*request)) < 0 ||
+        ephclient_writeall(sock, et2, request->n * 2 * sizeof(double)) < 0 ||
+        ephclient_readall(sock, &reply, sizeof(reply)) < 0 ||
+        reply.n < 0 || reply.n > request->n ||
+        ephclient_readall(sock, out, reply.n * width * sizeof(double)) < 0) {
+        fprintf(stderr,"\nERROR: Lost the ephemeris server.\n\n");
+        return(-1);
+    }
+    return(reply.status);
+}
+
+
+
+
+/*
+   ephcom_client_open() - Connect to the ephserve listening on socket
+   path, and fill header from it.  Returns the connection, for the other
+   ephcom_client_ functions, or -1 (with a message on stderr) if there
+   is no server there.
+*/
+int ephcom_client_open(char *path, struct ephcom_Header *header) {
+
+    struct sockaddr_un addr;
+    struct ephcom_ServeRequest request;
+    struct ephcom_ServeReply reply;
+    int sock;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr,"\nERROR: No ephemeris server on %s.\n\n", path);
+        if (sock >= 0)
+            close(sock);
+        return(-1);
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.magic = EPHCOM_SERVE_MAGIC;
+    request.op = EPHCOM_SERVE_HEADER;
+    if (ephclient_writeall(sock, &request, sizeof(request)) < 0 ||
+        ephclient_readall(sock, &reply, sizeof(reply)) < 0 || reply.n != 1 ||
+        ephclient_readall(sock, header, sizeof(struct ephcom_Header)) < 0) {
+        fprintf(stderr,"\nERROR: Ephemeris server on %s did not answer.\n\n", path);
+        close(sock);
+        return(-1);
+    }
+    header->zoffset = NULL;
+    header->toffset = NULL;
+    header->prefetch = 0;
+    header->lastblock = -1;
+    header->stride = 0;
+    header->bounds = NULL;
+    header->boundsjd = EPHCOM_MINJD;
+    header->derived = NULL;
+    header->derivedjd = EPHCOM_MINJD;
+
+    return(sock);
+}
+
+
+
+
+/*
+   ephcom_client_close() - Disconnect from the server.
+*/
+void ephcom_client_close(int sock) {
+
+    close(sock);
+}
+
+
+
+
+/*
+   ephcom_client_get_coords() - ephcom_get_coords() through the server:
+   fill coords->pv[][] for coords->et2, in the units coords asks for.
+   Returns 0, or -1 if the time is outside the ephemeris or the server
+   has gone.
+*/
+int ephcom_client_get_coords(int sock, struct ephcom_Coords *coords) {
+
+    int ephcom_client_get_coords_batch(int sock, int n, struct ephcom_Coords *coords);
+
+    if (ephcom_client_get_coords_batch(sock, 1, coords) != 1) {
+        fprintf(stderr,"Time is outside ephemeris range.\n");
+        return(-1);
+    }
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_client_get_coords_batch() - ephcom_client_get_coords() for n
+   ephcom_Coords at once, all in the units of coords[0].  Times outside
+   the ephemeris get pv[][] = 0.  Returns the number of times evaluated,
+   or -1 if the server has gone.
+*/
+int ephcom_client_get_coords_batch(int sock, int n, struct ephcom_Coords *coords) {
+
+    struct ephcom_ServeRequest request;
+    double (*et2)[2];
+    double *pv;
+    int i, k, m, status, total;
+
+    et2 = (double (*)[2])malloc(EPHCOM_SERVE_MAXN * 2 * sizeof(double));
+    pv = (double *)malloc(EPHCOM_SERVE_MAXN * sizeof(coords->pv));
+    memset(&request, 0, sizeof(request));
+    request.op = EPHCOM_SERVE_COORDS;
+    request.km = n > 0 ? coords[0].km : 1;
+    request.seconds = n > 0 ? coords[0].seconds : 0;
+    total = 0;
+    for (i=0; i<n; i+=m) {
+        m = n - i < EPHCOM_SERVE_MAXN ? n - i : EPHCOM_SERVE_MAXN;
+        for (k=0; k<m; k++) {
+            et2[k][0] = coords[i + k].et2[0];
+            et2[k][1] = coords[i + k].et2[1];
+        }
+        request.n = m;
+        if ((status = ephclient_ask(sock, &request, et2, pv, EPHCOM_NUMOBJECTS * 6)) < 0) {
+            total = -1;
+            break;
+        }
+        for (k=0; k<m; k++)
+            memcpy(coords[i + k].pv, &pv[k * EPHCOM_NUMOBJECTS * 6], sizeof(coords->pv));
+        total += status;
+    }
+    free(et2);
+    free(pv);
+
+    return(total);
+}
+
+
+
+
+/*
+   ephcom_client_pleph_batch() - ephcom_pleph_batch() through the server:
+   body ntarg relative to body ncntr (1 to 15, as for ephcom_pleph()) at
+   each of the n times et2[k][0] + et2[k][1], into r[k][], in km (km = 1)
+   or AU, per day or per second (seconds = 1).  Times outside the
+   ephemeris get r[k][] = 0.  Returns the number of times evaluated, or
+   -1 if a body number is out of range or the server has gone.
+*/
+int ephcom_client_pleph_batch(int sock, int ntarg, int ncntr, int km, int seconds,
+                              int n, double et2[][2], double r[][6]) {
+
+    struct ephcom_ServeRequest request;
+    int i, m, status, total;
+
+    if (ntarg < 1 || ntarg > 15 || ncntr < 1 || ncntr > 15)
+        return(-1);
+    memset(&request, 0, sizeof(request));
+    request.op = EPHCOM_SERVE_PLEPH;
+    request.ntarg = ntarg;
+    request.ncntr = ncntr;
+    request.km = km;
+    request.seconds = seconds;
+    total = 0;
+    for (i=0; i<n; i+=m) {
+        m = n - i < EPHCOM_SERVE_MAXN ? n - i : EPHCOM_SERVE_MAXN;
+        request.n = m;
+        if ((status = ephclient_ask(sock, &request, &et2[i], &r[i][0], 6)) < 0)
+            return(-1);
+        total += status;
+    }
+
+    return(total);
+}
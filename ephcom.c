@@ -2,7 +2,66 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>     //posix_fadvise(), for ephcom_prefetch_block()
+#include <unistd.h>    //pread(), for ephcom_pread_block()
+#endif
 #include "ephcom.h"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+/*
+   Byte order of this machine, fixed at compile time where the compiler
+   says what it is, and the byte reversal ephcom_swap64() and
+   ephcom_swap32() use, as one instruction where there is a builtin.
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define EPHCOM_HOSTORDER EPHCOM_LITTLEENDIAN
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define EPHCOM_HOSTORDER EPHCOM_BIGENDIAN
+#else
+int ephcom_hostorder(void);
+#define EPHCOM_HOSTORDER ephcom_hostorder()
+#endif
+/*
+   Compressed blocks up to this many bytes are read into a buffer on the
+   stack, not one malloc()ed for each block.
+*/
+#define EPHCOM_ZSTACK 16384
+#if defined(__GNUC__) || defined(__clang__)
+#define EPHCOM_BSWAP64(u) __builtin_bswap64(u)
+#define EPHCOM_BSWAP32(u) __builtin_bswap32(u)
+#else
+#define EPHCOM_BSWAP64(u) ((unsigned long long)EPHCOM_BSWAP32((unsigned)(u)) << 32 | \
+                           EPHCOM_BSWAP32((unsigned)((u) >> 32)))
+#define EPHCOM_BSWAP32(u) ((u) << 24 | ((u) & 0xff00) << 8 | ((u) >> 8 & 0xff00) | (u) >> 24)
+#endif
+/*
+   ephcom_nextcoeff() - The next available coefficient number in a data
+   block: one past the end of whichever series with coefficients ends
+   last (Mercury may be missing, as in files written by ephfit).  Empty
+   series should point here, as described in the header readers below.
+*/
+int ephcom_nextcoeff(struct ephcom_Header *header) {
+
+    int i, j;
+
+    j = 3;  /* After the block's start and end Julian Days */
+    for (i=0; i<12; i++)
+        if (header->ipt[i][1] > 0 && header->ipt[i][0] > 0 &&
+            header->ipt[i][0] + header->ipt[i][1] * header->ipt[i][2] * (i==11 ? 2 : 3) > j)
+            j = header->ipt[i][0] + header->ipt[i][1] * header->ipt[i][2] * (i==11 ? 2 : 3);
+    if (header->lpt[1] > 0 && header->lpt[0] > 0 &&
+        header->lpt[0] + header->lpt[1] * header->lpt[2] * 3 > j)
+        j = header->lpt[0] + header->lpt[1] * header->lpt[2] * 3;
+
+    return(j);
+}
+
+
+
+
 /*
    Read a JPL Ephemeris ASCII header from the file pointed to by infp
    and store values in header structure.  Write any errors to stderr.
@@ -116,18 +175,8 @@ int ephcom_readascii_header(FILE *infp, struct ephcom_Header *header) {
    should contain the value of the next available coefficient number rather
    than 0 as well, as per the same communication from Myles Standish.
 */
-/* First set j to maximum index into ipt[] that has coefficients */
-    j = 0;
+    j = ephcom_nextcoeff(header);
     for (i=0; i<12; i++)
-        if (header->ipt[i][1] > 0 && header->ipt[i][0] > j)
-            j = i;
-/* Now set j to next available index count. */
-    if (header->lpt[1] > 0 && header->lpt[0] > j)
-        j = header->lpt[1] + header->lpt[1] * header->lpt[2] * 3;
-    else
-        j = header->ipt[j][0] +
-            header->ipt[j][1] * header->ipt[j][2] * (j==11 ? 2 : 3);  //if j == 11, *2; otherwise, *3.
-    for (i=1; i<12; i++)
         if (header->ipt[i][0] == 0) header->ipt[i][0] = j;
     if (header->lpt[0] == 0) header->lpt[0] = j;
 /*
@@ -147,6 +196,7 @@ int ephcom_readascii_header(FILE *infp, struct ephcom_Header *header) {
     header->numde = 0;
     header->clight = 0.0;
     header->numle = 0;
+    header->byteorder = EPHCOM_BIGENDIAN;
     for (i = 0; i < header->ncon; i++) {
         if (strncmp(header->cnam[i], "AU    ", 6) == 0)
             header->au = header->cval[i];
@@ -160,6 +210,16 @@ int ephcom_readascii_header(FILE *infp, struct ephcom_Header *header) {
             header->numle = header->cval[i];
     }
     if (header->numle == 0) header->numle = header->numde;
+
+    header->zoffset = NULL;
+    header->toffset = NULL;
+    header->prefetch = 0;
+    header->lastblock = -1;
+    header->stride = 0;
+    header->bounds = NULL;
+    header->boundsjd = EPHCOM_MINJD;
+    header->derived = NULL;
+    header->derivedjd = EPHCOM_MINJD;
 /*
    GROUP 1070: Constant values.
 */
@@ -237,8 +297,13 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
     char *fgets(char *, int, FILE *);
     int fseek(FILE *, long, int);
     int fgetc(FILE *);
-    double ephcom_indouble(FILE *);
-    int ephcom_inint(FILE *);
+    unsigned char fixed[204];  /* SS through LPT, as they are in the file */
+    double ephcom_getdouble(unsigned char *, int);
+    int ephcom_getint(unsigned char *, int);
+    int ephcom_byteorder(unsigned char *);
+    void ephcom_swap64(void *, int);
+    int ephcom_readz_index(FILE *, struct ephcom_Header *);
+    int ephcom_readt_index(FILE *, struct ephcom_Header *);
 
     rewind(infp);
 /*
@@ -263,17 +328,27 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
             header->cnam[i][j] = fgetc(infp);
         header->cnam[i][j] = '\0';
     }
+/*
+   The rest of the first record holds numbers, in the byte order of the
+   machine that wrote the file.  Read them all, then decide which order
+   that was from which one gives a sensible header.
+*/
+    if (fread(fixed, 1, sizeof(fixed), infp) != sizeof(fixed)) {
+        fprintf(stderr,"\nERROR: JPL ephemeris file header is truncated.\n\n");
+        exit(1);
+    }
+    header->byteorder = ephcom_byteorder(fixed);
 /*
    Read ephemeris start epoch, stop epoch, and step size (in Julian Days).
 */
     for (i=0; i<3; i++)
-        header->ss[i] = ephcom_indouble(infp);
+        header->ss[i] = ephcom_getdouble(&fixed[8*i], header->byteorder);
 /*
    Read NCON, AU, EMRAT.
 */
-    header->ncon  = ephcom_inint(infp);
-    header->au    = ephcom_indouble(infp);
-    header->emrat = ephcom_indouble(infp);
+    header->ncon  = ephcom_getint(&fixed[24], header->byteorder);
+    header->au    = ephcom_getdouble(&fixed[28], header->byteorder);
+    header->emrat = ephcom_getdouble(&fixed[36], header->byteorder);
     header->nval  = header->ncon;
 /*
    Read indexes for coefficients in data block.  Written in transposed
@@ -281,11 +356,11 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
 */
     for (i=0; i<12; i++) {
         for (j=0; j<3; j++)
-            header->ipt[i][j] = ephcom_inint(infp);
+            header->ipt[i][j] = ephcom_getint(&fixed[44 + 4*(3*i + j)], header->byteorder);
     }
-    header->numde = ephcom_inint(infp);  /* Get ephemeris number */
+    header->numde = ephcom_getint(&fixed[188], header->byteorder);  /* Get ephemeris number */
     for (i=0; i<3; i++) 
-        header->lpt[i] = ephcom_inint(infp);
+        header->lpt[i] = ephcom_getint(&fixed[192 + 4*i], header->byteorder);
 /*
    If there are no coefficients for an ipt[i][] object (i.e., ipt[i][1]==0),
    then ipt[i][0] should contain the value of the next available coefficient
@@ -296,17 +371,8 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
    should contain the value of the next available coefficient number rather
    than 0 as well, as per the same communication from Myles Standish.
 */
-/* First set j to maximum index into ipt[] that has coefficients */
-    j = 0;
-    for (i=1; i<12; i++)
-        if (header->ipt[i][1] > 0 && header->ipt[i][0] > j)
-    j = i;
-/* Now set j to next available index count. */
-    if (header->lpt[1] > 0 && header->lpt[0] > j)
-        j = header->lpt[1] + header->lpt[1] * header->lpt[2] * 3;
-    else
-        j = header->ipt[j][0] + header->ipt[j][1] * header->ipt[j][2] * (j==11 ? 2 : 3);
-    for (i=1; i<12; i++)
+    j = ephcom_nextcoeff(header);
+    for (i=0; i<12; i++)
         if (header->ipt[i][0] == 0) 
             header->ipt[i][0] = j;
     if (header->lpt[0] == 0) 
@@ -324,30 +390,9 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
         header->maxcheby = header->lpt[1];
 
 /*
-   Calculate number of coefficients, starting with
-   highest index into a data block (stored in j).
-*/
-    j = 0;
-    for (i=1; i<12; i++)
-        if (header->ipt[i][1] > 0 && header->ipt[i][0] > header->ipt[j][0]) 
-            j = i;
-
-/*
-   Now see if the starting point we found is lower than where
-   lpt[] starts.  If not, use lpt[] for largest value.
+   The number of coefficients is up to the last one used, found above.
 */
-    if (header->lpt[1] > 0 && header->lpt[0] > header->ipt[j][0]) {
-        header->ncoeff = header->lpt[0] - 1 +     /* starting point */
-                         (header->lpt[1] *        /* coefficients per coordinate */
-                         header->lpt[2]) *       /* subblocks per block */
-                         3;                      /* coordinates */
-    }
-    else {
-        header->ncoeff = header->ipt[j][0] - 1 +  /* starting point */
-                         (header->ipt[j][1] *     /* coefficients per coordinate */
-                         header->ipt[j][2]) *    /* subblocks per block */
-                         (j == 11 ? 2 : 3);       /* coordinates */
-    }
+    header->ncoeff = j - 1;
     header->ksize  = 2 * header->ncoeff;
 /*
    Skip to second block in file.
@@ -356,8 +401,14 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
 /*
    Read ephemeris constants.
 */
+    if ((int)fread(header->cval, 8, header->ncon, infp) != header->ncon) {
+        fprintf(stderr,"\nERROR: JPL ephemeris constants are truncated.\n\n");
+        exit(1);
+    }
+    if (header->byteorder != EPHCOM_HOSTORDER)
+        ephcom_swap64(header->cval, header->ncon);
+    header->clight = 0.0;
     for (i=0; i<header->ncon; i++) {
-        header->cval[i] = ephcom_indouble(infp);
         if (strncmp(header->cnam[i], "LENUM ", 6) == 0)
             header->numle = header->cval[i];
         else if (strncmp(header->cnam[i], "CLIGHT", 6) == 0)
@@ -365,6 +416,23 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
     }
     if (header->numle == 0) 
         header->numle = header->numde;
+/*
+   A compressed container (see eph2ephz.c) keeps the two header records
+   above as they are and puts its block directory after them; so does a
+   body-major container (see eph2epht.c) with its own tag.
+*/
+    header->zoffset = NULL;
+    header->toffset = NULL;
+    if (ephcom_readz_index(infp, header) != 0)
+        ephcom_readt_index(infp, header);
+
+    header->prefetch = 0;
+    header->lastblock = -1;
+    header->stride = 0;
+    header->bounds = NULL;
+    header->boundsjd = EPHCOM_MINJD;
+    header->derived = NULL;
+    header->derivedjd = EPHCOM_MINJD;
 
     return(0);
 }
@@ -380,453 +448,1715 @@ int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header) {
    block number ranges from 0 on up (starting at first data block,
    after the 2 header blocks).  Returns the number of coefficients
    read, or 0 at EOF.
+
+   The block is read whole, and then put in host order if it is not in
+   it already.
 */
 int ephcom_readbinary_block(FILE *infp, struct ephcom_Header *header,
                             int blocknum, double *datablock) {
 
-    int i;
     long filebyte;
-    double ephcom_indouble(FILE *);
+    void ephcom_swap64(void *, int);
     int fseek(FILE *, long, int);
+    int ephcom_readz_block(FILE *, struct ephcom_Header *, int, double *);
+    int ephcom_readt_block(FILE *, struct ephcom_Header *, int, double *);
+
+    if (header->zoffset != NULL) /* Compressed container */
+        return(ephcom_readz_block(infp, header, blocknum, datablock));
+    if (header->toffset != NULL) /* Body-major container */
+        return(ephcom_readt_block(infp, header, blocknum, datablock));
 
     filebyte = (blocknum + 2) * header->ncoeff * 8; /* 8 bytes per coefficient */
     fseek(infp, filebyte, SEEK_SET);
-    for (i=0; !feof(infp) && i<header->ncoeff; i++)
-        datablock[i] = ephcom_indouble(infp);
-    if (i < header->ncoeff && feof(infp)) 
-        i = -1; /* 0 --> EOF */
-    
-    i += 1;
-    return(i); /* Number of coefficients successfuly read (all or nohing). */
+    if (fread(datablock, 8, header->ncoeff, infp) != (size_t)header->ncoeff)
+        return(0); /* 0 --> EOF */
+    if (header->byteorder != EPHCOM_HOSTORDER)
+        ephcom_swap64(datablock, header->ncoeff);
+
+    return(header->ncoeff); /* Number of coefficients successfuly read (all or nohing). */
 }
 
 
 
 
 /*
-   Write header information in ASCII format.
-*/
-int ephcom_writeascii_header(FILE *outfp, struct ephcom_Header *header) {
+   Compressed ephemeris container, as written by eph2ephz:
 
-    char group[13];
-    double val1, val2, val3; /* To read text line with 3 double precision words */
-    int i, j, k, n;
-    int iword; /* word number we're reading in a line */
-    int blockout; /* number of bytes we've written to current block/rec in file */
-    static char spaces[84]="                                                                                \r\n";
-    int idate[6];
-    char *month[12] = {"JAN","FEB","MAR","APR","MAY","JUN",
-                   "JUL","AUG","SEP","OCT","NOV","DEC"};
+      records 0, 1  the two binary header records, unchanged
+      8 bytes       EPHCOM_ZMAGIC
+      4 bytes       number of data blocks, nblocks (big-endian)
+      4 bytes       zero
+      8*(nblocks+1) big-endian file offsets of compressed blocks 0..nblocks;
+                    block k occupies [offset[k], offset[k+1])
+      ...           compressed blocks, each packed on its own by
+                    ephcom_zpack_block()
 
-    char writebuf[EPHCOM_MAXLINE + 1];
-    char outhcars[EPHCOM_MAXLINE + 1];
+   Every block can be located from the directory alone, so random access
+   costs one seek and one read, exactly as for a plain binary file.
 
-//used functions
-    size_t fwrite(const void *ptr, size_t size, size_t  nmemb, FILE *stream);
-    int ephcom_jd2cal(double tjd, int idate[6], int calendar_type);
-    int ephcom_doublestrc2f(char *buf);
+   ephcom_readz_index() - If the file is a compressed container, read its
+   block directory into header->zoffset and return 0.  Otherwise leave
+   header->zoffset alone and return -1.
+*/
+int ephcom_readz_index(FILE *infp, struct ephcom_Header *header) {
+
+    int i, j;
+    int nblocks;
+    char magic[8];
+    unsigned char ch[8];
+    long long offset;
+    int ephcom_inint(FILE *);
 
+    fseek(infp, 2L * header->ncoeff * 8, SEEK_SET);
+    if (fread(magic, 1, 8, infp) != 8 || memcmp(magic, EPHCOM_ZMAGIC, 8) != 0)
+        return(-1);
+    nblocks = ephcom_inint(infp);
+    (void)ephcom_inint(infp);
 /*
-   First header line: KSIZE= # NCOEFF= #
+   Every reader indexes zoffset[] by block numbers from ss[], so the
+   directory must have an entry for each of those blocks, all after the
+   directory itself and in increasing order.
 */
-    sprintf(writebuf, "KSIZE=%5d    NCOEFF=%5d", header->ksize, header->ncoeff);
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    if (header->ksize != 2*header->ncoeff) {
-        fprintf(stderr, "Badly formed header; KSIZE <> 2*NCOEFF\r\n\r\n");
+    if (nblocks != (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5)) {
+        fprintf(stderr, "\nERROR: compressed ephemeris directory has %d blocks, not %d.\n\n",
+                nblocks, (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5));
         exit(1);
     }
-/*
-   GROUP 1010: Title of ephemeris (DE/LE number, start JD, end JD)
-*/
-    fprintf(outfp, spaces); /* blank line */
-    sprintf(writebuf, "GROUP   1010");
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    fprintf(outfp, spaces); /* blank line */
-/*
-   Header title lines with dates, for example:
-
-      JPL Planetary Ephemeris DE405/LE405
-      Start Epoch: JED=  2305424.5 1599 DEC 09 00:00:00
-      Final Epoch: JED=  2525008.5 2201 FEB 20 00:00:00
-*/
-    sprintf(header->ttl[0],"JPL Planetary Ephemeris DE%03d/LE%03d",
-            header->numde, header->numle);
-    k = strlen(header->ttl[0]);
-    strcpy(&header->ttl[0][k], &spaces[k]);
-    ephcom_jd2cal(header->ss[0], idate, 0);
-    sprintf(header->ttl[1],"Start Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
-            header->ss[0], idate[0], month[idate[1]-1], idate[2],
-            idate[3], idate[4], idate[5]);
-    k = strlen(header->ttl[1]);
-    strcpy(&header->ttl[1][k], &spaces[k]);
-    ephcom_jd2cal(header->ss[1], idate, 0);
-    sprintf(header->ttl[2],"Final Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
-            header->ss[1], idate[0], month[idate[1]-1], idate[2],
-            idate[3], idate[4], idate[5]);
-    k = strlen(header->ttl[2]);
-    strcpy(&header->ttl[2][k], &spaces[k]);
-/*
-   Don't print trailing blanks at the end of these 3 lines.
-*/
-    for (i=0; i<3; i++) {
-        strncpy(writebuf, header->ttl[i], 80);
-        writebuf[80] = '\r';
-        writebuf[81] = '\n';
-        writebuf[82] = '\0';
-        fprintf(outfp, writebuf);
+    header->zoffset = (long long *)malloc((nblocks + 1) * sizeof(long long));
+    for (i=0; i<=nblocks; i++) {
+        if (fread(ch, 1, 8, infp) != 8) {
+            fprintf(stderr, "\nERROR: compressed ephemeris directory is truncated.\n\n");
+            exit(1);
+        }
+        for (offset=0, j=0; j<8; j++)
+            offset = (offset << 8) | ch[j];
+        if (offset < 2LL * header->ncoeff * 8 + 16 + 8LL * (nblocks + 1) ||
+            (i > 0 && offset <= header->zoffset[i - 1])) {
+            fprintf(stderr, "\nERROR: compressed ephemeris directory is damaged at block %d.\n\n",
+                    i + 1);
+            exit(1);
+        }
+        header->zoffset[i] = offset;
     }
-/*
-   GROUP 1030: Start and End JD, timestep (in JD) per block.
-*/
-    fprintf(outfp, spaces); /* blank line */
-    sprintf(writebuf, "GROUP   1030");
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    fprintf(outfp, spaces); /* blank line */
 
-    sprintf(writebuf, "%12.2f%12.2f%12.0f.",
-            header->ss[0], header->ss[1], header->ss[2]);
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]); /* pad with spaces */
-    fprintf(outfp, writebuf);
-/*
-   GROUP 1040: Constant names.
-*/
-    fprintf(outfp, spaces); /* blank line */
-    sprintf(writebuf, "GROUP   1040");
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    fprintf(outfp, spaces); /* blank line */
+    return(0);
+}
 
-    sprintf(writebuf, "%6d", header->ncon);
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
 
-/*
-   Now write the constant names, 10 per line, each 6 characters long
-   preceded by 2 blanks.  Pad names with blanks to make 6 characters.
-*/
-    for (i=0; i<header->ncon; i++) {
-       fprintf(outfp, "  %-6s", header->cnam[i]);
-       if (i % 10 == 9) fprintf(outfp, "\r\n");
-    }
-    if (i % 10 != 0) {  /* Pad last line with spaces (i is 1 more than above) */
-        for ( ; i % 10 != 0; i++) 
-            fprintf(outfp, "        ");
-        fprintf(outfp, "\r\n");
-    }
-/*
-   GROUP 1041: Constant values.
-*/
-    fprintf(outfp, spaces); /* blank line */
-    sprintf(writebuf, "GROUP   1041");
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    fprintf(outfp, spaces); /* blank line */
 
-    sprintf(writebuf, "%6d", header->nval);
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
 
-    if (header->nval != header->ncon) {
-        fprintf(stderr,"Error: number of constants and values not equal.\n\n");
-        exit(1);
-    }
 /*
-   Now read constant values, 3 per line, 26 characters each.
-*/
-    for (i = 0; i < header->ncon; i += 3) {
-        val1 = header->cval[i];
-        val2 = (i+1 < header->ncon) ? header->cval[i+1] : 0.0;
-        val3 = (i+2 < header->ncon) ? header->cval[i+2] : 0.0;
-        sprintf(writebuf, "%25.17E %25.17E %25.17E   \r\n", val1, val2, val3);
-   /* Note that the character holding the sign for each # is left as is. */
-        ephcom_doublestrc2f(&writebuf[1]);
-        ephcom_doublestrc2f(&writebuf[27]);
-        ephcom_doublestrc2f(&writebuf[53]);
-        fprintf(outfp, "%s", writebuf);
+   ephcom_zstride() - How far before coefficient i (from 0) of a block is
+   the one whose exponent predicts i's in a compressed block: ncf within
+   a series, past its first coordinate, so the prediction is the same
+   Chebyshev degree in the coordinate or subinterval before (every
+   coordinate's coefficients fall off alike with degree); otherwise 1.
+   Sets *next to the first coefficient after i where that can change, so
+   a caller walking the block only asks again there.
+*/
+int ephcom_zstride(struct ephcom_Header *header, int i, int *next) {
+
+    int s, k, stride;
+    int bound[3];    /* Start, end of the first coordinate, end of a series */
+    int ptr, ncf, nsub, ncoords;
+
+    stride = 1;
+    *next = header->ncoeff;
+    for (s=0; s<13; s++) {
+        ptr  = (s == 12 ? header->lpt[0] : header->ipt[s][0]) - 1;
+        ncf  = s == 12 ? header->lpt[1] : header->ipt[s][1];
+        nsub = s == 12 ? header->lpt[2] : header->ipt[s][2];
+        ncoords = (s == 11 ? 2 : 3);
+        if (ncf <= 0 || nsub <= 0)
+            continue;
+        bound[0] = ptr;
+        bound[1] = ptr + ncf;
+        bound[2] = ptr + ncf * nsub * ncoords;
+        if (i >= bound[1] && i < bound[2])
+            stride = ncf;
+        for (k=0; k<3; k++)
+            if (bound[k] > i && bound[k] < *next)
+                *next = bound[k];
     }
-/*
-   GROUP 1050: Constant values.
-*/
-    fprintf(outfp, spaces); /* blank line */
-    sprintf(writebuf, "GROUP   1050");
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    fprintf(outfp, spaces); /* blank line */
-/*
-   If there are no coefficients for an ipt[i][] object (i.e., ipt[i][1]==0),
-   then ipt[i][0] should contain the value of the next available coefficient
-   number rather than 0, as per communication of Myles Standish to Paul Hardy
-   on preferred format of ephemeris headers.
+    return(stride);
+}
+
 
-   If there are no libration coefficients (i.e., lpt[1]==0), then lpt[0]
-   should contain the value of the next available coefficient number rather
-   than 0 as well, as per the same communication from Myles Standish.
-*/
-/* First set j to maximum index into ipt[] that has coefficients */
-    j = 0;
-    for (i=1; i<12; i++)
-        if (header->ipt[i][1] > 0 && header->ipt[i][0] > j)
-            j = i;
-/* Now set j to next available index count. */
-    if (header->lpt[1] > 0 && header->lpt[0] > j)
-        j = header->lpt[1] + header->lpt[1] * header->lpt[2] * 3;
-    else
-        j = header->ipt[j][0] + header->ipt[j][1] * header->ipt[j][2] * (j==11 ? 2 : 3);
 
-    for (i=1; i<12; i++)
-        if (header->ipt[i][0] == 0) 
-            header->ipt[i][0] = j;
 
-    if (header->lpt[0] == 0) 
-        header->lpt[0] = j;
 /*
-   Write ipt array in transposed order (arrays are transposed in FORTRAN
-   from their order in C).
+   ephcom_rc_shift() - Move the top byte of the range coder's low end out
+   to its buffer.  A run of 0xff bytes is held back until it is known
+   whether a carry ripples into it.  Bytes past rc->size are counted in
+   rc->pos but not stored.
 */
-    for (i = 0; i < 3; i++) {
-        for (j = 0; j < 12; j++)
-            fprintf(outfp, "%6d", header->ipt[j][i]);
-        fprintf(outfp, "%6d  \r\n", header->lpt[i]);
+void ephcom_rc_shift(struct ephcom_RangeCoder *rc) {
+
+    unsigned char carry;
+
+    if ((unsigned)rc->low < 0xff000000U || (rc->low >> 32) != 0) {
+        carry = (unsigned char)(rc->low >> 32);
+        for ( ; rc->cachesize > 0; rc->cachesize--) {
+            if (rc->pos < rc->size)
+                rc->buf[rc->pos] = rc->cache + carry;
+            rc->pos++;
+            rc->cache = 0xff;
+        }
+        rc->cache = (unsigned char)(rc->low >> 24);
     }
-/*
-   GROUP 1070: Constant values.
-*/
-    fprintf(outfp, spaces); /* blank line */
-    sprintf(writebuf, "GROUP   1070");
-    k = strlen(writebuf);
-    strcpy(&writebuf[k], &spaces[k]);
-    fprintf(outfp, writebuf);
-    fprintf(outfp, spaces); /* blank line */
-/*
-   Now we're pointing to the first block of coefficient data, after header.
-*/
-return(0);
+    rc->cachesize++;
+    rc->low = (rc->low & 0xffffffULL) << 8;
 }
 
 
 
 
 /*
-   Write coefficient block information in ASCII format.
+   ephcom_rc_encode() - Code one bit with the adaptive binary range coder,
+   as LZMA does: *prob is the chance of a 0 bit in 1/2048ths, and moves
+   1/32 of the way towards the bit just coded.
 */
-int ephcom_writeascii_block(FILE *outfp, struct ephcom_Header *header,
-                            int blocknum, double *datablock) {
+void ephcom_rc_encode(struct ephcom_RangeCoder *rc, unsigned short *prob, int bit) {
+
+    unsigned bound;
+
+    bound = (rc->range >> 11) * *prob;
+    if (bit == 0) {
+        rc->range = bound;
+        *prob += (2048 - *prob) >> 5;
+    }
+    else {
+        rc->low += bound;
+        rc->range -= bound;
+        *prob -= *prob >> 5;
+    }
+    while (rc->range < (1U << 24)) {
+        rc->range <<= 8;
+        ephcom_rc_shift(rc);
+    }
+}
+
 
-    double val1, val2, val3; /* To write text line with 3 double precision words */
-    int i;
-    char writebuf[EPHCOM_MAXLINE + 1];
 
-    size_t fwrite(const void *ptr, size_t size, size_t  nmemb, FILE *stream);
-    int fputc(int, FILE *);
-    double ephcom_indouble(FILE *);
-    int ephcom_doublestrc2f(char *); /* Convert C formatted double to FORTRAN format */
 
 /*
-   Write first line in block, which is block number and ncoeff.
-   Note that lines in the data block files end in "\r\n", while
-   lines in the header files just end in "\n".
-*/
-    fprintf(outfp, "%6d%6d", blocknum + 1, header->ncoeff);
-    for (i=0; i<68; i++) 
-        fputc(' ', outfp);
-    fprintf(outfp, "\r\n");
-/*
-   Now write the data, 3 coefficients per line, 26 characters each.
-   Convert format to match what appears in JPL Ephemeris ASCII files.
+   ephcom_rc_decode() - Decode one bit coded by ephcom_rc_encode() with
+   the same *prob, updating it the same way.  Reads past rc->size as
+   0 bytes; the caller checks the data as a whole.
 */
-    for (i = 0; i < header->ncoeff; i += 3) {
-        val1 = datablock[i];
-        val2 = (i+1) < header->ncoeff ? datablock[i+1] : 0.0;
-        val3 = (i+2) < header->ncoeff ? datablock[i+2] : 0.0;
-   /*
-      Write values, 3 coefficients per line, pad lines with 0.0E+00
-   */
-        sprintf(writebuf, "%25.17E %25.17E %25.17E   \r\n", val1, val2, val3);
-   /*
-      Now re-format numbers the way the JPL header file writes them:
-      all with a leading "0.", so the exponent is one greater.
-      Note that here we start at strlen(writebuf)-6, but in the section
-      that handles header data coefficients we start at strlen(writebuf)-5.
-      This is because the data blocks end ASCII lines with "\r\n" whereas
-      the header ends ASCII lines with just "\n".
-   */
-        ephcom_doublestrc2f(&writebuf[1]);  /* Reformat first number */
-        ephcom_doublestrc2f(&writebuf[27]);  /* Reformat second number */
-        ephcom_doublestrc2f(&writebuf[53]);  /* Reformat third number */
-// printf("[%d]%s", strlen(writebuf), writebuf);
-        fprintf(outfp, "%s", writebuf);
-    }
+int ephcom_rc_decode(struct ephcom_RangeCoder *rc, unsigned short *prob) {
 
-    return(0);
+    unsigned bound;
+    int bit;
+
+    bound = (rc->range >> 11) * *prob;
+    if (rc->code < bound) {
+        rc->range = bound;
+        *prob += (2048 - *prob) >> 5;
+        bit = 0;
+    }
+    else {
+        rc->code -= bound;
+        rc->range -= bound;
+        *prob -= *prob >> 5;
+        bit = 1;
+    }
+    if (rc->range < (1U << 24)) {
+        rc->range <<= 8;
+        rc->code = (rc->code << 8) | (rc->pos < rc->size ? rc->buf[rc->pos] : 0);
+        rc->pos++;
+    }
+    return(bit);
 }
 
 
 
 
 /*
-   Write a JPL Ephemeris header in binary format.
-*/
-int ephcom_writebinary_header(FILE *outfp, struct ephcom_Header *header) {
+   ephcom_zpack_block() - Compress one block of header->ncoeff coefficients
+   into zblock, which must hold at least 1 + 8*ncoeff bytes.  Returns the
+   number of bytes used.
+
+   The mantissas of Chebyshev coefficients are as good as random in their
+   leading bits, but the exponents fall off steadily with degree, alike
+   in every coordinate of a series, and many values converted from JPL's
+   ASCII files end in whole bytes of zeros.  So for each value the block
+   holds, range coded with adaptive probabilities (EPHCOM_ZTZ):
+
+      - its sign bit;
+      - its exponent less that of the value ephcom_zstride() picks, as a
+        5-bit code (1..31 for -15..+15; 0 escapes to the full 11-bit
+        exponent, stored with the mantissa bits), with separate
+        probabilities for in-series and other predictions;
+      - the number of zero bytes that end its mantissa (0 to 6, or 7 for
+        a zero mantissa);
+
+   and, as a plain bit stream after the coded part, the mantissa bits
+   left.  The block is:
+
+      1 byte    EPHCOM_ZTZ
+      4 bytes   length of the range coded part (big-endian)
+      ...       range coded part
+      ...       mantissa bits (and escaped exponents), padded to a byte
+
+   If that would not save space the block is stored as plain big-endian
+   doubles (EPHCOM_ZRAW).  Either way the block unpacks to exactly the
+   same bits.
+*/
+int ephcom_zpack_block(struct ephcom_Header *header, double *datablock,
+                       unsigned char *zblock) {
+
+    int i, j, k;
+    int stride, next; /* From ephcom_zstride() */
+    int nbytes;      /* Bytes used in zblock */
+    int nraw;        /* Bytes in raw */
+    int nacc;        /* Bits waiting in acc */
+    int exponent, predexp, code, ntz;
+    unsigned long long bits, predbits, mantissa, acc;
+    unsigned char *raw;
+    unsigned short sign, expcode[2][32], tz[8]; /* Probabilities */
+    struct ephcom_RangeCoder rc;
+
+    sign = 1024;
+    for (j=0; j<32; j++)
+        expcode[0][j] = expcode[1][j] = 1024;
+    for (j=0; j<8; j++)
+        tz[j] = 1024;
+    rc.low = 0;
+    rc.range = 0xffffffffU;
+    rc.cache = 0;
+    rc.cachesize = 1;
+    rc.pos = 0;
+    rc.size = 8 * header->ncoeff;
+    rc.buf = (unsigned char *)malloc(rc.size);
+    raw = (unsigned char *)malloc(8 * header->ncoeff + 8);
+    nraw = 0;
+    acc = 0;
+    nacc = 0;
+    stride = 1;
+    next = 0;
+    for (i=0; i<header->ncoeff; i++) {
+        memcpy(&bits, &datablock[i], 8);
+        exponent = (int)((bits >> 52) & 0x7ff);
+        mantissa = bits & 0xfffffffffffffULL;
+        if (i >= next)
+            stride = ephcom_zstride(header, i, &next);
+        predexp = 0;
+        if (i > 0) {
+            memcpy(&predbits, &datablock[i - stride], 8);
+            predexp = (int)((predbits >> 52) & 0x7ff);
+        }
+        ephcom_rc_encode(&rc, &sign, (int)(bits >> 63));
+        code = exponent - predexp >= -15 && exponent - predexp <= 15 ?
+               exponent - predexp + 16 : 0;
+        for (j=1, k=4; k>=0; k--) {
+            ephcom_rc_encode(&rc, &expcode[stride != 1][j], (code >> k) & 1);
+            j = (j << 1) | ((code >> k) & 1);
+        }
+        if (code == 0) {
+            acc = (acc << 11) | (unsigned)exponent;
+            for (nacc += 11; nacc >= 8; nacc -= 8)
+                raw[nraw++] = (acc >> (nacc - 8)) & 0xff;
+        }
+        for (ntz=0; ntz<6 && ((mantissa >> (8*ntz)) & 0xff) == 0; ntz++)
+            ;
+        if (mantissa == 0)
+            ntz = 7;
+        for (j=1, k=2; k>=0; k--) {
+            ephcom_rc_encode(&rc, &tz[j], (ntz >> k) & 1);
+            j = (j << 1) | ((ntz >> k) & 1);
+        }
+        if (ntz < 7) {
+            acc = (acc << (52 - 8*ntz)) | (mantissa >> (8*ntz));
+            for (nacc += 52 - 8*ntz; nacc >= 8; nacc -= 8)
+                raw[nraw++] = (acc >> (nacc - 8)) & 0xff;
+        }
+    }
+    if (nacc > 0)
+        raw[nraw++] = (acc << (8 - nacc)) & 0xff;
+    for (k=0; k<5; k++)
+        ephcom_rc_shift(&rc);
+
+    nbytes = 5 + rc.pos + nraw;
+    if (rc.pos <= rc.size && nbytes < 1 + 8 * header->ncoeff) {
+        zblock[0] = EPHCOM_ZTZ;
+        for (k=0; k<4; k++)
+            zblock[1 + k] = (rc.pos >> (24 - 8*k)) & 0xff;
+        memcpy(&zblock[5], rc.buf, rc.pos);
+        memcpy(&zblock[5 + rc.pos], raw, nraw);
+    }
+    else {                                           /* No gain */
+        zblock[0] = EPHCOM_ZRAW;
+        for (nbytes=1, i=0; i<header->ncoeff; i++) {
+            memcpy(&bits, &datablock[i], 8);
+            for (k=7; k>=0; k--)
+                zblock[nbytes++] = (bits >> (8*k)) & 0xff;
+        }
+    }
+    free(rc.buf);
+    free(raw);
+
+    return(nbytes);
+}
 
-    char group[13];  /* To hold "GROUP" header line */
-    int blockout; /* number of bytes we've written to current block/rec in file */
-    int blockbytes; /* number of bytes in a block, equals 8 * ncoeff */
-    double val1, val2, val3; /* To read text line with 3 double precision words */
-    int i, j;
-    int idate[6];
-    char *month[12] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN",
-                       "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
 
-    int ephcom_outdouble(FILE *outfp, double x);
-    int ephcom_outint(FILE *outfp, unsigned u);
-    void ephcom_nxtgrp(char *group, char *expected, FILE *infile);
-    int ephcom_jd2cal(double tjd, int idate[6], int calendar_type);
-    size_t fwrite(const void *ptr, size_t size, size_t  nmemb, FILE *stream);
 
 
-    rewind(outfp);    //Point to beginning of output file.
-    blockbytes = sizeof(double) * header->ncoeff;    //First header line: KSIZE= # NCOEFF= #
 /*
-   Start writing output ephemeris, beginning with header.
+   ephcom_zunpack_ztz() - Undo ephcom_zpack_block() on the nbytes bytes of
+   an EPHCOM_ZTZ block in zblock.  Returns the number of coefficients
+   unpacked, or 0 if the packed block is malformed.
 */
+int ephcom_zunpack_ztz(struct ephcom_Header *header, unsigned char *zblock,
+                       int nbytes, double *datablock) {
+
+    int i, j, k, n;
+    int stride, next; /* From ephcom_zstride() */
+    int inbyte;      /* Next byte to read of the mantissa bits */
+    unsigned nrc;    /* Bytes in the range coded part */
+    int nacc;        /* Bits waiting in acc */
+    int exponent, predexp, code, ntz;
+    unsigned long long bits, predbits, mantissa, acc;
+    unsigned short sign, expcode[2][32], tz[8]; /* Probabilities */
+    struct ephcom_RangeCoder rc;
+
+    if (nbytes < 5)
+        return(0);
+    for (nrc=0, k=1; k<5; k++)
+        nrc = (nrc << 8) | zblock[k];
+    if (nrc < 5 || nrc > (unsigned)(nbytes - 5))
+        return(0);
+    rc.size = (int)nrc;
+    sign = 1024;
+    for (j=0; j<32; j++)
+        expcode[0][j] = expcode[1][j] = 1024;
+    for (j=0; j<8; j++)
+        tz[j] = 1024;
+    rc.buf = &zblock[5];
+    rc.range = 0xffffffffU;
+    for (rc.code=0, rc.pos=0; rc.pos<5; rc.pos++)
+        rc.code = (rc.code << 8) | rc.buf[rc.pos];
+
+    inbyte = 5 + rc.size;
+    acc = 0;
+    nacc = 0;
+    stride = 1;
+    next = 0;
+    for (i=0; i<header->ncoeff; i++) {
+        if (i >= next)
+            stride = ephcom_zstride(header, i, &next);
+        predexp = 0;
+        if (i > 0) {
+            memcpy(&predbits, &datablock[i - stride], 8);
+            predexp = (int)((predbits >> 52) & 0x7ff);
+        }
+        bits = (unsigned long long)ephcom_rc_decode(&rc, &sign);
+        for (j=1, k=0; k<5; k++)
+            j = (j << 1) | ephcom_rc_decode(&rc, &expcode[stride != 1][j]);
+        code = j - 32;
+        if (code == 0) {
+            for ( ; nacc < 11 && inbyte < nbytes; nacc += 8)
+                acc = (acc << 8) | zblock[inbyte++];
+            if (nacc < 11)
+                return(0);
+            exponent = (int)((acc >> (nacc - 11)) & 0x7ff);
+            nacc -= 11;
+        }
+        else
+            exponent = predexp + code - 16;
+        for (j=1, k=0; k<3; k++)
+            j = (j << 1) | ephcom_rc_decode(&rc, &tz[j]);
+        ntz = j - 8;
+        mantissa = 0;
+        if (ntz < 7) {
+            n = 52 - 8*ntz;
+            for ( ; nacc < n && inbyte < nbytes; nacc += 8)
+                acc = (acc << 8) | zblock[inbyte++];
+            if (nacc < n)
+                return(0);
+            mantissa = ((acc >> (nacc - n)) & ((1ULL << n) - 1)) << (8*ntz);
+            nacc -= n;
+        }
+        if (exponent < 0 || exponent > 0x7ff)
+            return(0);
+        bits = (bits << 63) | ((unsigned long long)exponent << 52) | mantissa;
+        memcpy(&datablock[i], &bits, 8);
+    }
+
+    return(inbyte == nbytes && rc.pos <= rc.size ? header->ncoeff : 0);
+}
+
+
+
+
 /*
-   Header title lines with dates, for example:
+   ephcom_zunpack_block() - Undo ephcom_zpack_block() on the nbytes bytes
+   in zblock.  Returns the number of coefficients unpacked, or 0 if the
+   packed block is malformed.  Blocks packed by earlier versions with
+   exponent delta coding alone (EPHCOM_ZEXP) are unpacked here too.
+*/
+int ephcom_zunpack_block(struct ephcom_Header *header, unsigned char *zblock,
+                         int nbytes, double *datablock) {
 
-      JPL Planetary Ephemeris DE405/LE405
-      Start Epoch: JED=  2305424.5 1599 DEC 09 00:00:00
-      Final Epoch: JED=  2525008.5 2201 FEB 20 00:00:00
+    int i, k;
+    int inbyte;      /* Next byte to read in zblock */
+    int nacc;        /* Bits waiting in acc */
+    int code, exponent;
+    unsigned long long bits, acc, mantissa;
+
+    if (nbytes < 1)
+        return(0);
+    if (zblock[0] == EPHCOM_ZRAW) {
+        if (nbytes != 1 + 8 * header->ncoeff)
+            return(0);
+        for (inbyte=1, i=0; i<header->ncoeff; i++) {
+            for (bits=0, k=0; k<8; k++)
+                bits = (bits << 8) | zblock[inbyte++];
+            memcpy(&datablock[i], &bits, 8);
+        }
+        return(header->ncoeff);
+    }
+    if (zblock[0] == EPHCOM_ZTZ)
+        return(ephcom_zunpack_ztz(header, zblock, nbytes, datablock));
+    if (zblock[0] != EPHCOM_ZEXP)
+        return(0);
+
+    inbyte = 1;
+    acc = 0;
+    nacc = 0;
+    exponent = 0;
+    for (i=0; i<header->ncoeff; i++) {
+        for ( ; nacc < 6 && inbyte < nbytes; nacc += 8)
+            acc = (acc << 8) | zblock[inbyte++];
+        if (nacc < 6)
+            return(0);
+        bits = (acc >> (nacc - 1)) & 1;
+        code = (int)((acc >> (nacc - 6)) & 0x1f);
+        nacc -= 6;
+        if (code == 0) {
+            for ( ; nacc < 11 && inbyte < nbytes; nacc += 8)
+                acc = (acc << 8) | zblock[inbyte++];
+            if (nacc < 11)
+                return(0);
+            exponent = (int)((acc >> (nacc - 11)) & 0x7ff);
+            nacc -= 11;
+        }
+        else
+            exponent += code - 16;
+        for ( ; nacc < 52 && inbyte < nbytes; nacc += 8)
+            acc = (acc << 8) | zblock[inbyte++];
+        if (nacc < 52 || exponent < 0 || exponent > 0x7ff)
+            return(0);
+        mantissa = (acc >> (nacc - 52)) & 0xfffffffffffffULL;
+        nacc -= 52;
+        bits = (bits << 63) | ((unsigned long long)exponent << 52) | mantissa;
+        memcpy(&datablock[i], &bits, 8);
+    }
+
+    return(inbyte == nbytes ? header->ncoeff : 0);
+}
+
+
+
+
+/*
+   ephcom_readz_block() - Read and unpack one data block of a compressed
+   container.  Called through ephcom_readbinary_block(), which it stands
+   in for; returns the number of coefficients read, or 0 at EOF.
 */
-    sprintf(header->ttl[0],"JPL Planetary Ephemeris DE%03d/LE%03d",
-            header->numde, header->numle);
-    for (i=strlen(header->ttl[0]); i<84; i++) 
-        header->ttl[1][i] = ' ';
-    ephcom_jd2cal(header->ss[0], idate, 0);
-    sprintf(header->ttl[1],"Start Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
-            header->ss[0], idate[0], month[idate[1]-1], idate[2], idate[3], idate[4], idate[5]);
-    for (i=strlen(header->ttl[1]); i<84; i++)
-        header->ttl[1][i] = ' ';
-    ephcom_jd2cal(header->ss[1], idate, 0);
-    sprintf(header->ttl[2],"Final Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
-            header->ss[1], idate[0], month[idate[1]-1], idate[2], idate[3], idate[4], idate[5]);
-    for (i=strlen(header->ttl[2]); i<84; i++)
-            header->ttl[2][i] = ' ';
-    header->ttl[0][84] = header->ttl[1][84] = header->ttl[2][84] = '\0';
+int ephcom_readz_block(FILE *infp, struct ephcom_Header *header,
+                       int blocknum, double *datablock) {
+
+    int nblocks;
+    int nbytes;
+    int nread;
+    unsigned char *zblock;
+    unsigned char zstack[EPHCOM_ZSTACK];
+
+    nblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+    if (blocknum < 0 || blocknum >= nblocks)
+        return(0);
+
+    nbytes = (int)(header->zoffset[blocknum + 1] - header->zoffset[blocknum]);
+    if (nbytes < 1 || nbytes > 1 + 8 * header->ncoeff)
+        return(0);
+    zblock = nbytes <= EPHCOM_ZSTACK ? zstack : (unsigned char *)malloc(nbytes);
+    fseek(infp, (long)header->zoffset[blocknum], SEEK_SET);
+    nread = 0;
+    if (fread(zblock, 1, nbytes, infp) == (size_t)nbytes)
+        nread = ephcom_zunpack_block(header, zblock, nbytes, datablock);
+    if (zblock != zstack)
+        free(zblock);
+
+    return(nread);
+}
+
+
+
 
 /*
-   ephcom_Header title lines.
+   Body-major ephemeris container, as written by eph2epht:
 
-   Write the three title lines to the output file, padded with blanks,
-   84 characters long (84 is the first even multiple of 6 that is > 80,
-   so the JPL software uses that value because it reads in Fortran 'A6'
-   character strings.
+      records 0, 1  the two binary header records, unchanged
+      8 bytes       EPHCOM_TMAGIC
+      4 bytes       number of data blocks, nblocks (big-endian)
+      4 bytes       zero
+      16*nblocks    start and end JD of each block (the first two
+                    coefficients of every data block)
+      ...           one column for each series in the file, in ipt[]
+                    order with libration last: that series' coefficients
+                    from block 0, then from block 1, and so on
+
+   All values are doubles in the byte order of the header records.  Each
+   column is nblocks times as long as the series is in one block, so its
+   offset follows from the header alone, and the coefficients one body
+   needs over any run of blocks lie together in the file.
+
+   ephcom_series_extent() - Where series (0 to 12 as for
+   ephcom_interp_series(), or -1 for the block's start and end JD) lies in
+   a data block: sets *first to its first coefficient (counting from 0)
+   and returns the number of coefficients, or 0 if the file has none.
 */
-    fprintf(outfp, "%-84s%-84s%-84s", header->ttl[0], header->ttl[1], header->ttl[2]);
-    blockout = 3*84;  /* Just wrote 3 84-byte strings to start output file */
+int ephcom_series_extent(struct ephcom_Header *header, int series, int *first) {
+
+    int *pt;
+
+    if (series < 0) {
+        *first = 0;
+        return(2);
+    }
+    pt = (series == 12 ? header->lpt : header->ipt[series]);
+    *first = pt[0] - 1;
+    if (pt[1] <= 0 || pt[2] <= 0)
+        return(0);
+    return((series == 11 ? 2 : 3) * pt[1] * pt[2]);
+}
+
+
+
+
 /*
-   Now output 400 cnam entries to the output file.
+   ephcom_readt_index() - If the file is a body-major container, work out
+   where its columns begin into header->toffset and return 0.  Otherwise
+   leave header->toffset alone and return -1.
 */
-    for (i = 0; i < header->ncon; i++) {
-        fprintf(outfp, "%-6s", header->cnam[i]);
-        blockout += 6;
+int ephcom_readt_index(FILE *infp, struct ephcom_Header *header) {
+
+    int i;
+    int nblocks;
+    int first, n;
+    char magic[8];
+    long long offset;
+    int ephcom_inint(FILE *);
+
+    fseek(infp, 2L * header->ncoeff * 8, SEEK_SET);
+    if (fread(magic, 1, 8, infp) != 8 || memcmp(magic, EPHCOM_TMAGIC, 8) != 0)
+        return(-1);
+    nblocks = ephcom_inint(infp);
+    (void)ephcom_inint(infp);
+/*
+   Columns are found from nblocks alone, so it must be the block count
+   from ss[], and the last column must end within the file.
+*/
+    if (nblocks != (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5)) {
+        fprintf(stderr, "\nERROR: body-major ephemeris has %d blocks, not %d.\n\n",
+                nblocks, (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5));
+        exit(1);
     }
-    for ( ; i < 400; i++) {
-        fprintf(outfp, "      ");  /* Round out to 400 entries, all blank at end */
-        blockout += 6;
+    header->toffset = (long long *)malloc(14 * sizeof(long long));
+    offset = 2LL * header->ncoeff * 8 + 16;
+    for (i=0; i<14; i++) {
+        n = ephcom_series_extent(header, i - 1, &first);
+        header->toffset[i] = n > 0 ? offset : 0;
+        offset += (long long)nblocks * n * 8;
+    }
+    fseek(infp, 0L, SEEK_END);
+    if (offset > ftell(infp)) {
+        fprintf(stderr, "\nERROR: body-major ephemeris is truncated.\n\n");
+        exit(1);
     }
+
+    return(0);
+}
+
+
+
+
 /*
-   Binary values: Make sure bytes are in big-endian (network) order for file.
+   ephcom_readt_series() - Read the coefficients of one series (as for
+   ephcom_series_extent()) from nblocks data blocks in a row, starting at
+   blocknum, into coeffs: those of block blocknum first, then the next,
+   each as long as the series is in one block.  From a body-major
+   container this is one read of only the bytes wanted; other files are
+   read a block at a time.  Returns the number of coefficients per block,
+   or 0 if the series is not in the file or the blocks can't be read.
 */
-    for (i=0; i<3; i++) {
-        ephcom_outdouble(outfp, header->ss[i]);  /* Write net-order bytes from double precision */
-        blockout += 8;
+int ephcom_readt_series(FILE *infp, struct ephcom_Header *header, int series,
+                        int blocknum, int nblocks, double *coeffs) {
+
+    int i;
+    int first, n;
+    int maxblocks;
+    double *datablock;
+    void ephcom_swap64(void *, int);
+    int ephcom_readbinary_block(FILE *, struct ephcom_Header *, int, double *);
+
+    if (series < -1 || series > 12 || (n = ephcom_series_extent(header, series, &first)) == 0)
+        return(0);
+    maxblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+    if (blocknum < 0 || nblocks < 1 || blocknum + nblocks > maxblocks)
+        return(0);
+
+    if (header->toffset != NULL) { /* Body-major container */
+        fseek(infp, (long)(header->toffset[series + 1] + (long long)blocknum * n * 8), SEEK_SET);
+        if (fread(coeffs, 8, (size_t)nblocks * n, infp) != (size_t)nblocks * n)
+            return(0);
+        if (header->byteorder != EPHCOM_HOSTORDER)
+            ephcom_swap64(coeffs, nblocks * n);
+        return(n);
     }
-    ephcom_outint(outfp, header->ncon);
-    blockout += 4;
-    ephcom_outdouble(outfp, header->au);
-    blockout += 8;
-    ephcom_outdouble(outfp, header->emrat);
-    blockout += 8;
+
+    datablock = (double *)malloc(header->ncoeff * sizeof(double));
+    for (i=0; i<nblocks; i++) {
+        if (ephcom_readbinary_block(infp, header, blocknum + i, datablock) <= 0) {
+            n = 0;
+            break;
+        }
+        memcpy(&coeffs[(long long)i * n], &datablock[first], n * sizeof(double));
+    }
+    free(datablock);
+
+    return(n);
+}
+
+
+
+
 /*
-   If there are no coefficients for an ipt[i][] object (i.e., ipt[i][1]==0),
-   then ipt[i][0] should contain the value of the next available coefficient
-   number rather than 0, as per communication of Myles Standish to Paul Hardy
-   on preferred format of ephemeris headers.
+   ephcom_readt_block() - Gather one data block of a body-major container
+   from its columns.  Called through ephcom_readbinary_block(), which it
+   stands in for; returns the number of coefficients read, or 0 at EOF.
+*/
+int ephcom_readt_block(FILE *infp, struct ephcom_Header *header,
+                       int blocknum, double *datablock) {
 
-   If there are no libration coefficients (i.e., lpt[1]==0), then lpt[0]
-   should contain the value of the next available coefficient number rather
-   than 0 as well, as per the same communication from Myles Standish.
+    int i;
+    int first, n;
+
+    memset(datablock, 0, header->ncoeff * sizeof(double));
+    for (i=-1; i<=12; i++) {
+        if ((n = ephcom_series_extent(header, i, &first)) == 0)
+            continue;
+        if (ephcom_readt_series(infp, header, i, blocknum, 1, &datablock[first]) != n)
+            return(0);
+    }
+
+    return(header->ncoeff);
+}
+
+
+
+
+/*
+   ephcom_pread_block() - Read data block blocknum of an ephemeris open on
+   file descriptor fd, as ephcom_readbinary_block() does, but with
+   pread(), which keeps no file position: threads can read blocks from
+   one open file at the same time without locking it.  Returns the number
+   of coefficients read, or 0.
 */
-/* First set j to maximum index into ipt[] that has coefficients */
-    j = 0;
-    for (i=1; i<12; i++)
-        if (header->ipt[i][1] > 0 && header->ipt[i][0] > j)
-            j = i;
-/* Now set j to next available index count. */
-    if (header->lpt[1] > 0 && header->lpt[0] > j)
-        j = header->lpt[1] + header->lpt[1] * header->lpt[2] * 3;
-    else
-        j = header->ipt[j][0] + header->ipt[j][1] * header->ipt[j][2] * (j==11 ? 2 : 3);
-    for (i=1; i<12; i++)
-        if (header->ipt[i][0] == 0) 
-            header->ipt[i][0] = j;
-    if (header->lpt[0] == 0) 
-        header->lpt[0] = j;
+#if defined(__unix__) || defined(__APPLE__)
+int ephcom_pread_block(int fd, struct ephcom_Header *header,
+                       int blocknum, double *datablock) {
 
-    for (j = 0; j < 12; j++) {
-        for (i = 0; i < 3; i++) {
-            ephcom_outint(outfp, header->ipt[j][i]);
-            blockout += 4;
-        }
+    int i;
+    int nbytes;
+    int nread;
+    int first, n;
+    unsigned char *zblock;
+    unsigned char zstack[EPHCOM_ZSTACK];
+    int ephcom_zunpack_block(struct ephcom_Header *header, unsigned char *zblock,
+                             int nbytes, double *datablock);
+    int ephcom_series_extent(struct ephcom_Header *header, int series, int *first);
+    void ephcom_swap64(void *, int);
+
+    if (header->zoffset != NULL) { /* Compressed container */
+        if (blocknum < 0 ||
+            blocknum >= (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5))
+            return(0);
+        nbytes = (int)(header->zoffset[blocknum + 1] - header->zoffset[blocknum]);
+        if (nbytes < 1 || nbytes > 1 + 8 * header->ncoeff)
+            return(0);
+        zblock = nbytes <= EPHCOM_ZSTACK ? zstack : (unsigned char *)malloc(nbytes);
+        nread = 0;
+        if (pread(fd, zblock, nbytes, (off_t)header->zoffset[blocknum]) == nbytes)
+            nread = ephcom_zunpack_block(header, zblock, nbytes, datablock);
+        if (zblock != zstack)
+            free(zblock);
+        return(nread);
     }
-    ephcom_outint(outfp, header->numde);
-    blockout += 4;
-    for (i = 0; i < 3; i++) {
-        ephcom_outint(outfp, header->lpt[i]);
-        blockout += 4;
+    if (header->toffset != NULL) { /* Body-major container */
+        if (blocknum < 0 ||
+            blocknum >= (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5))
+            return(0);
+        memset(datablock, 0, header->ncoeff * sizeof(double));
+        for (i=-1; i<=12; i++) {
+            if ((n = ephcom_series_extent(header, i, &first)) == 0)
+                continue;
+            if (pread(fd, &datablock[first], n * 8,
+                      (off_t)(header->toffset[i + 1] + (long long)blocknum * n * 8)) != n * 8)
+                return(0);
+        }
+        if (header->byteorder != EPHCOM_HOSTORDER)
+            ephcom_swap64(datablock, header->ncoeff);
+        return(header->ncoeff);
     }
 /*
-   Now pad the end of the first record with null bytes.  Note: the
-   JPL Fortran software just skips to next record at this point.
+   Read the block straight into datablock, then put it in host order
+   where it lies.
 */
-    for (i = blockout; i < blockbytes; i++) {
-        fputc('\0', outfp);
-    }
+    nbytes = header->ncoeff * 8;
+    if (pread(fd, datablock, nbytes, (off_t)(blocknum + 2) * nbytes) != nbytes)
+        return(0);
+    if (header->byteorder != EPHCOM_HOSTORDER)
+        ephcom_swap64(datablock, header->ncoeff);
+
+    return(header->ncoeff);
+}
+#endif
+
+
+
+
 /*
-   End of first block.  Now set blockout to 0 and start with next block.
+   ephcom_prefetch_block() - Note that blocknum is about to be read and,
+   once two block changes in a row show the same step (1 when moving
+   forward in time, -1 backward, or any fixed stride), ask the operating
+   system to start reading the next header->prefetch blocks along that
+   step.  The reads run in the background, so by the time the caller
+   crosses into the next block its bytes are already in memory and
+   ephcom_readbinary_block() does not wait on the disk.
+
+   Does nothing if header->prefetch is 0, or where the system has no
+   read-ahead hint.  Returns the number of blocks requested.
 */
-    blockout = 0;
-    for (i=0; i<header->ncon; i++) {
-        ephcom_outdouble(outfp, header->cval[i]);
-        blockout += 8;
+int ephcom_prefetch_block(FILE *infp, struct ephcom_Header *header, int blocknum) {
+
+    int i;
+    int step;      /* Blocks between this read and the last one */
+    int nahead;    /* Blocks requested ahead of this one */
+    int nblocks;   /* Data blocks in the file */
+    int next;      /* Next block to request */
+    long blockbytes;
+
+    nahead = 0;
+    if (header->prefetch <= 0 || blocknum == header->lastblock ||
+        header->toffset != NULL) /* Blocks of a body-major container are not contiguous */
+        return(0);
+
+    step = header->lastblock < 0 ? 0 : blocknum - header->lastblock;
+    header->lastblock = blocknum;
+    if (step == 0 || step != header->stride) { /* Pattern not (yet) steady */
+        header->stride = step;
+        return(0);
+    }
+
+    nblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+    blockbytes = (long)header->ncoeff * 8;
+#ifdef POSIX_FADV_WILLNEED
+    if (step == 1) { /* One contiguous run ahead of this block */
+        next = blocknum + 1;
+        nahead = header->prefetch;
+        if (next + nahead > nblocks)
+            nahead = nblocks - next;
+        if (nahead <= 0)
+            nahead = 0;
+        else if (header->zoffset != NULL) /* Compressed container */
+            posix_fadvise(fileno(infp), (off_t)header->zoffset[next],
+                          (off_t)(header->zoffset[next + nahead] - header->zoffset[next]),
+                          POSIX_FADV_WILLNEED);
+        else
+            posix_fadvise(fileno(infp), (off_t)(next + 2) * blockbytes,
+                          (off_t)nahead * blockbytes, POSIX_FADV_WILLNEED);
+    }
+    else {
+        for (i = 1; i <= header->prefetch; i++) {
+            next = blocknum + i * step;
+            if (next < 0 || next >= nblocks)
+                break;
+            if (header->zoffset != NULL)
+                posix_fadvise(fileno(infp), (off_t)header->zoffset[next],
+                              (off_t)(header->zoffset[next + 1] - header->zoffset[next]),
+                              POSIX_FADV_WILLNEED);
+            else
+                posix_fadvise(fileno(infp), (off_t)(next + 2) * blockbytes,
+                              (off_t)blockbytes, POSIX_FADV_WILLNEED);
+            nahead++;
+        }
     }
+#endif
+
+    return(nahead);
+}
+
+
+
+
 /*
-   Pad with double-precision zeroes for rest of array.
+   Write header information in ASCII format.
 */
-    for ( ; i < 400; i++) {
-        ephcom_outdouble(outfp, (double)0.0);
-        blockout += 8;
+int ephcom_writeascii_header(FILE *outfp, struct ephcom_Header *header) {
+
+    char group[13];
+    double val1, val2, val3; /* To read text line with 3 double precision words */
+    int i, j, k, n;
+    int iword; /* word number we're reading in a line */
+    int blockout; /* number of bytes we've written to current block/rec in file */
+    static char spaces[84]="                                                                                \r\n";
+    int idate[6];
+    char *month[12] = {"JAN","FEB","MAR","APR","MAY","JUN",
+                   "JUL","AUG","SEP","OCT","NOV","DEC"};
+
+    char writebuf[EPHCOM_MAXLINE + 1];
+    char outhcars[EPHCOM_MAXLINE + 1];
+
+//used functions
+    size_t fwrite(const void *ptr, size_t size, size_t  nmemb, FILE *stream);
+    int ephcom_jd2cal(double tjd, int idate[6], int calendar_type);
+    int ephcom_doublestrc2f(char *buf);
+
+/*
+   First header line: KSIZE= # NCOEFF= #
+*/
+    sprintf(writebuf, "KSIZE=%5d    NCOEFF=%5d", header->ksize, header->ncoeff);
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    if (header->ksize != 2*header->ncoeff) {
+        fprintf(stderr, "Badly formed header; KSIZE <> 2*NCOEFF\r\n\r\n");
+        exit(1);
     }
 /*
-   Pad with nulls for rest of block.
+   GROUP 1010: Title of ephemeris (DE/LE number, start JD, end JD)
 */
-    for (i = blockout; i < blockbytes; i++) {
-        fputc('\0', outfp);
+    fprintf(outfp, spaces); /* blank line */
+    sprintf(writebuf, "GROUP   1010");
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    fprintf(outfp, spaces); /* blank line */
+/*
+   Header title lines with dates, for example:
+
+      JPL Planetary Ephemeris DE405/LE405
+      Start Epoch: JED=  2305424.5 1599 DEC 09 00:00:00
+      Final Epoch: JED=  2525008.5 2201 FEB 20 00:00:00
+*/
+    sprintf(header->ttl[0],"JPL Planetary Ephemeris DE%03d/LE%03d",
+            header->numde, header->numle);
+    k = strlen(header->ttl[0]);
+    strcpy(&header->ttl[0][k], &spaces[k]);
+    ephcom_jd2cal(header->ss[0], idate, 0);
+    sprintf(header->ttl[1],"Start Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
+            header->ss[0], idate[0], month[idate[1]-1], idate[2],
+            idate[3], idate[4], idate[5]);
+    k = strlen(header->ttl[1]);
+    strcpy(&header->ttl[1][k], &spaces[k]);
+    ephcom_jd2cal(header->ss[1], idate, 0);
+    sprintf(header->ttl[2],"Final Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
+            header->ss[1], idate[0], month[idate[1]-1], idate[2],
+            idate[3], idate[4], idate[5]);
+    k = strlen(header->ttl[2]);
+    strcpy(&header->ttl[2][k], &spaces[k]);
+/*
+   Don't print trailing blanks at the end of these 3 lines.
+*/
+    for (i=0; i<3; i++) {
+        strncpy(writebuf, header->ttl[i], 80);
+        writebuf[80] = '\r';
+        writebuf[81] = '\n';
+        writebuf[82] = '\0';
+        fprintf(outfp, writebuf);
+    }
+/*
+   GROUP 1030: Start and End JD, timestep (in JD) per block.
+*/
+    fprintf(outfp, spaces); /* blank line */
+    sprintf(writebuf, "GROUP   1030");
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    fprintf(outfp, spaces); /* blank line */
+
+    sprintf(writebuf, "%12.2f%12.2f%12.0f.",
+            header->ss[0], header->ss[1], header->ss[2]);
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]); /* pad with spaces */
+    fprintf(outfp, writebuf);
+/*
+   GROUP 1040: Constant names.
+*/
+    fprintf(outfp, spaces); /* blank line */
+    sprintf(writebuf, "GROUP   1040");
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    fprintf(outfp, spaces); /* blank line */
+
+    sprintf(writebuf, "%6d", header->ncon);
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+
+/*
+   Now write the constant names, 10 per line, each 6 characters long
+   preceded by 2 blanks.  Pad names with blanks to make 6 characters.
+*/
+    for (i=0; i<header->ncon; i++) {
+       fprintf(outfp, "  %-6s", header->cnam[i]);
+       if (i % 10 == 9) fprintf(outfp, "\r\n");
+    }
+    if (i % 10 != 0) {  /* Pad last line with spaces (i is 1 more than above) */
+        for ( ; i % 10 != 0; i++) 
+            fprintf(outfp, "        ");
+        fprintf(outfp, "\r\n");
+    }
+/*
+   GROUP 1041: Constant values.
+*/
+    fprintf(outfp, spaces); /* blank line */
+    sprintf(writebuf, "GROUP   1041");
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    fprintf(outfp, spaces); /* blank line */
+
+    sprintf(writebuf, "%6d", header->nval);
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+
+    if (header->nval != header->ncon) {
+        fprintf(stderr,"Error: number of constants and values not equal.\n\n");
+        exit(1);
+    }
+/*
+   Now read constant values, 3 per line, 26 characters each.
+*/
+    for (i = 0; i < header->ncon; i += 3) {
+        val1 = header->cval[i];
+        val2 = (i+1 < header->ncon) ? header->cval[i+1] : 0.0;
+        val3 = (i+2 < header->ncon) ? header->cval[i+2] : 0.0;
+        sprintf(writebuf, "%25.17E %25.17E %25.17E   \r\n", val1, val2, val3);
+   /* Note that the character holding the sign for each # is left as is. */
+        ephcom_doublestrc2f(&writebuf[1]);
+        ephcom_doublestrc2f(&writebuf[27]);
+        ephcom_doublestrc2f(&writebuf[53]);
+        fprintf(outfp, "%s", writebuf);
+    }
+/*
+   GROUP 1050: Constant values.
+*/
+    fprintf(outfp, spaces); /* blank line */
+    sprintf(writebuf, "GROUP   1050");
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    fprintf(outfp, spaces); /* blank line */
+/*
+   If there are no coefficients for an ipt[i][] object (i.e., ipt[i][1]==0),
+   then ipt[i][0] should contain the value of the next available coefficient
+   number rather than 0, as per communication of Myles Standish to Paul Hardy
+   on preferred format of ephemeris headers.
+
+   If there are no libration coefficients (i.e., lpt[1]==0), then lpt[0]
+   should contain the value of the next available coefficient number rather
+   than 0 as well, as per the same communication from Myles Standish.
+*/
+    j = ephcom_nextcoeff(header);
+    for (i=0; i<12; i++)
+        if (header->ipt[i][0] == 0) 
+            header->ipt[i][0] = j;
+
+    if (header->lpt[0] == 0) 
+        header->lpt[0] = j;
+/*
+   Write ipt array in transposed order (arrays are transposed in FORTRAN
+   from their order in C).
+*/
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 12; j++)
+            fprintf(outfp, "%6d", header->ipt[j][i]);
+        fprintf(outfp, "%6d  \r\n", header->lpt[i]);
+    }
+/*
+   GROUP 1070: Constant values.
+*/
+    fprintf(outfp, spaces); /* blank line */
+    sprintf(writebuf, "GROUP   1070");
+    k = strlen(writebuf);
+    strcpy(&writebuf[k], &spaces[k]);
+    fprintf(outfp, writebuf);
+    fprintf(outfp, spaces); /* blank line */
+/*
+   Now we're pointing to the first block of coefficient data, after header.
+*/
+return(0);
+}
+
+
+
+
+/*
+   Write coefficient block information in ASCII format, the way it
+   appears in JPL Ephemeris ASCII files (see ephcom_format_block()).
+*/
+int ephcom_writeascii_block(FILE *outfp, struct ephcom_Header *header,
+                            int blocknum, double *datablock) {
+
+    char *writebuf;
+    int nbytes;
+
+    int ephcom_format_block(struct ephcom_Header *header, int blocknum, double *datablock,
+                            char *buf);
+
+    writebuf = (char *)malloc(EPHCOM_ASCIIBLOCK(header->ncoeff));
+    nbytes = ephcom_format_block(header, blocknum, datablock, writebuf);
+    if (fwrite(writebuf, 1, nbytes, outfp) != (size_t)nbytes) {
+        fprintf(stderr,"\nERROR: Can't write block %d.\n\n", blocknum + 1);
+        free(writebuf);
+        return(-1);
+    }
+    free(writebuf);
+
+    return(0);
+}
+
+
+
+
+/*
+   Write a JPL Ephemeris header in binary format.
+*/
+int ephcom_writebinary_header(FILE *outfp, struct ephcom_Header *header) {
+
+    char group[13];  /* To hold "GROUP" header line */
+    int blockout; /* number of bytes we've written to current block/rec in file */
+    int blockbytes; /* number of bytes in a block, equals 8 * ncoeff */
+    double val1, val2, val3; /* To read text line with 3 double precision words */
+    int i, j;
+    int idate[6];
+    char *month[12] = {"JAN", "FEB", "MAR", "APR", "MAY", "JUN",
+                       "JUL", "AUG", "SEP", "OCT", "NOV", "DEC"};
+
+    int ephcom_outdouble(FILE *outfp, double x);
+    int ephcom_outint(FILE *outfp, unsigned u);
+    int ephcom_outdoubles(FILE *outfp, double *x, int n);
+    void ephcom_nxtgrp(char *group, char *expected, FILE *infile);
+    int ephcom_jd2cal(double tjd, int idate[6], int calendar_type);
+    size_t fwrite(const void *ptr, size_t size, size_t  nmemb, FILE *stream);
+
+
+    rewind(outfp);    //Point to beginning of output file.
+    blockbytes = sizeof(double) * header->ncoeff;    //First header line: KSIZE= # NCOEFF= #
+/*
+   Start writing output ephemeris, beginning with header.
+*/
+/*
+   Header title lines with dates, for example:
+
+      JPL Planetary Ephemeris DE405/LE405
+      Start Epoch: JED=  2305424.5 1599 DEC 09 00:00:00
+      Final Epoch: JED=  2525008.5 2201 FEB 20 00:00:00
+*/
+    sprintf(header->ttl[0],"JPL Planetary Ephemeris DE%03d/LE%03d",
+            header->numde, header->numle);
+    for (i=strlen(header->ttl[0]); i<84; i++) 
+        header->ttl[1][i] = ' ';
+    ephcom_jd2cal(header->ss[0], idate, 0);
+    sprintf(header->ttl[1],"Start Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
+            header->ss[0], idate[0], month[idate[1]-1], idate[2], idate[3], idate[4], idate[5]);
+    for (i=strlen(header->ttl[1]); i<84; i++)
+        header->ttl[1][i] = ' ';
+    ephcom_jd2cal(header->ss[1], idate, 0);
+    sprintf(header->ttl[2],"Final Epoch: JED=%11.1f%5d %3s %02d %02d:%02d:%02d",
+            header->ss[1], idate[0], month[idate[1]-1], idate[2], idate[3], idate[4], idate[5]);
+    for (i=strlen(header->ttl[2]); i<84; i++)
+            header->ttl[2][i] = ' ';
+    header->ttl[0][84] = header->ttl[1][84] = header->ttl[2][84] = '\0';
+
+/*
+   ephcom_Header title lines.
+
+   Write the three title lines to the output file, padded with blanks,
+   84 characters long (84 is the first even multiple of 6 that is > 80,
+   so the JPL software uses that value because it reads in Fortran 'A6'
+   character strings.
+*/
+    fprintf(outfp, "%-84s%-84s%-84s", header->ttl[0], header->ttl[1], header->ttl[2]);
+    blockout = 3*84;  /* Just wrote 3 84-byte strings to start output file */
+/*
+   Now output 400 cnam entries to the output file.
+*/
+    for (i = 0; i < header->ncon; i++) {
+        fprintf(outfp, "%-6s", header->cnam[i]);
+        blockout += 6;
+    }
+    for ( ; i < 400; i++) {
+        fprintf(outfp, "      ");  /* Round out to 400 entries, all blank at end */
+        blockout += 6;
+    }
+/*
+   Binary values: Make sure bytes are in big-endian (network) order for file.
+*/
+    for (i=0; i<3; i++) {
+        ephcom_outdouble(outfp, header->ss[i]);  /* Write net-order bytes from double precision */
+        blockout += 8;
+    }
+    ephcom_outint(outfp, header->ncon);
+    blockout += 4;
+    ephcom_outdouble(outfp, header->au);
+    blockout += 8;
+    ephcom_outdouble(outfp, header->emrat);
+    blockout += 8;
+/*
+   If there are no coefficients for an ipt[i][] object (i.e., ipt[i][1]==0),
+   then ipt[i][0] should contain the value of the next available coefficient
+   number rather than 0, as per communication of Myles Standish to Paul Hardy
+   on preferred format of ephemeris headers.
+
+   If there are no libration coefficients (i.e., lpt[1]==0), then lpt[0]
+   should contain the value of the next available coefficient number rather
+   than 0 as well, as per the same communication from Myles Standish.
+*/
+    j = ephcom_nextcoeff(header);
+    for (i=0; i<12; i++)
+        if (header->ipt[i][0] == 0) 
+            header->ipt[i][0] = j;
+    if (header->lpt[0] == 0) 
+        header->lpt[0] = j;
+
+    for (j = 0; j < 12; j++) {
+        for (i = 0; i < 3; i++) {
+            ephcom_outint(outfp, header->ipt[j][i]);
+            blockout += 4;
+        }
+    }
+    ephcom_outint(outfp, header->numde);
+    blockout += 4;
+    for (i = 0; i < 3; i++) {
+        ephcom_outint(outfp, header->lpt[i]);
+        blockout += 4;
+    }
+/*
+   Now pad the end of the first record with null bytes.  Note: the
+   JPL Fortran software just skips to next record at this point.
+*/
+    for (i = blockout; i < blockbytes; i++) {
+        fputc('\0', outfp);
+    }
+/*
+   End of first block.  Now set blockout to 0 and start with next block.
+*/
+    blockout = 0;
+    ephcom_outdoubles(outfp, header->cval, header->ncon);
+    blockout += 8 * header->ncon;
+    i = header->ncon;
+/*
+   Pad with double-precision zeroes for rest of array, but never past the
+   end of the record: with fewer than 400 coefficients per block (files
+   reduced by ephtrunc, say) that would run into the first data block.
+*/
+    for ( ; i < 400 && blockout + 8 <= blockbytes; i++) {
+        ephcom_outdouble(outfp, (double)0.0);
+        blockout += 8;
+    }
+/*
+   Pad with nulls for rest of block.
+*/
+    for (i = blockout; i < blockbytes; i++) {
+        fputc('\0', outfp);
+    }
+/*
+   Finished normally.
+*/
+    return(0);
+}
+
+
+
+
+/*
+   Write a block of data coefficients in JPL binary file format.
+*/
+int ephcom_writebinary_block(FILE *outfp, struct ephcom_Header *header, 
+                             int blocknum, double *datablock) {
+
+    int i;
+    int ephcom_outdoubles(FILE *, double *, int);
+    int filebyte;
+    int filepos;
+
+/*
+   Find out where we need to point in the binary file.
+*/
+    filebyte = (blocknum + 2) * header->ncoeff * 8; /* 8 bytes per coefficient */
+/*
+   If the file isn't that large, pad it with null bytes
+*/
+    fseek(outfp, 0L, SEEK_END);
+    filepos = ftell(outfp);
+    if (filepos < filebyte) {
+        for (i=0; i < (filebyte - filepos); i++) {
+            fputc('\0', outfp);
+        }
+    }
+/*
+   Now go to position where we want to start writing.
+*/
+    fseek(outfp, filebyte, SEEK_SET);
+    ephcom_outdoubles(outfp, datablock, header->ncoeff);
+
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_repack_block() - Copy a data block laid out as described by
+   inheader into the layout described by outheader.  Both headers must
+   have the same number of subintervals for every body they both carry.
+   For each body, subinterval and coordinate the leading coefficients are
+   copied; extra coefficients in the input are dropped, and extra ones in
+   the output are set to 0.  A body with no coefficients in outheader is
+   left out.  The block start and end Julian Days are copied as well.
+*/
+int ephcom_repack_block(struct ephcom_Header *inheader, double *inblock,
+                        struct ephcom_Header *outheader, double *outblock) {
+
+    int i, j, k, n;
+    int ncoords;         /* 2 coordinates for nutation, else 3 */
+    int inptr, outptr;   /* Start of a body's coefficients, from 1 */
+    int incf, outcf;     /* Coefficients per coordinate */
+    int nsub;            /* Subintervals per block */
+    double *in, *out;
+
+    outblock[0] = inblock[0];
+    outblock[1] = inblock[1];
+    for (i=0; i<13; i++) {
+        if (i == 12) {
+            inptr = inheader->lpt[0];   incf = inheader->lpt[1];
+            outptr = outheader->lpt[0]; outcf = outheader->lpt[1];
+            nsub = outheader->lpt[2];
+        }
+        else {
+            inptr = inheader->ipt[i][0];   incf = inheader->ipt[i][1];
+            outptr = outheader->ipt[i][0]; outcf = outheader->ipt[i][1];
+            nsub = outheader->ipt[i][2];
+        }
+        if (outcf <= 0)
+            continue;
+        ncoords = (i == 11 ? 2 : 3);
+        for (j=0; j<nsub; j++) {
+            for (k=0; k<ncoords; k++) {
+                in  = &inblock[inptr - 1 + (j * ncoords + k) * incf];
+                out = &outblock[outptr - 1 + (j * ncoords + k) * outcf];
+                for (n=0; n<outcf; n++)
+                    out[n] = n < incf ? in[n] : 0.0;
+            }
+        }
+    }
+
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_parse_block() - Parse a binary block of data.  Warning: verbose!
+                          Writes parsed output to file pointer outfp.
+                          For whole files, eph2cols writes the same
+                          rows as columns for analysis tools.
+*/
+int ephcom_parse_block(FILE *outfp, struct ephcom_Header *header, double *datablock) {
+
+    int i0, i1, i2, i3;
+    int blockword;
+/*
+   Names of the objects in Chebyshev coefficient arrays.
+*/
+    static char *ephcom_coeffname[13] = {
+        "Mercury", "Venus", "EMBary", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune",
+        "Pluto", "Moon", "Sun", "Nutation", "Libration"};
+
+    blockword=0;
+    fprintf(outfp, "@%04d StartJD\t%12.2f\n", blockword++, datablock[0]);
+    fprintf(outfp, "@%04d EndJD\t%12.2f\n", blockword++, datablock[1]);
+
+    for (i0=0; i0<12; i0++) {  /* For first 12 bodies */
+        fprintf(outfp, "Body\t%d (%s)\n", i0+1, ephcom_coeffname[i0]);
+        for (i1=0; i1<header->ipt[i0][2]; i1++) { /* For all subintervals */
+            fprintf(outfp, "  Subinterval %d of %d\n", i1+1, header->ipt[i0][2]);
+            for (i2=0; i2 < (i0==11 ? 2 : 3); i2++) {  /* For all coordinates */
+                fprintf(outfp, "    %cCoefficients\n", 'X' + i2);
+                for (i3=0; i3<header->ipt[i0][1]; i3++) {  /* For all coefficients */
+                    blockword = header->ipt[i0][0] +
+                                i1*header->ipt[i0][1] * (i0==11 ? 2 : 3) +
+                                i2*header->ipt[i0][1] + i3 - 1;
+                    fprintf(outfp, "      @%04d [%2d of %2d] %25.17E\n",
+                            blockword, i3+1, header->ipt[i0][1], datablock[blockword]);
+                }
+            }
+        }
+    }
+// For libration    
+    fprintf(outfp, "Body\t13 (%s)\n", ephcom_coeffname[12]);
+        for (i1=0; i1<header->lpt[2]; i1++) { /* For all subintervals */
+            fprintf(outfp, "  Subinterval %d of %d\n", i1+1, header->lpt[2]);
+            for (i2=0; i2 < 3; i2++) {  /* For all coordinates */
+                switch (i2){
+                    case 0: 
+                        fprintf(outfp, "    %sCoefficients\n", "phi");
+                        break;
+                    case 1:
+                        fprintf(outfp, "    %sCoefficients\n", "theta");
+                        break;
+                    case 2:
+                        fprintf(outfp, "    %sCoefficients\n", "psi");
+                        break;
+                }
+                for (i3=0; i3<header->lpt[1]; i3++) {  /* For all coefficients */
+                    blockword = header->lpt[0] +
+                                i1*header->lpt[1] *3 +
+                                i2*header->lpt[1] + i3 - 1;
+                    fprintf(outfp, "      @%04d [%2d of %2d] %25.17E\n",
+                            blockword, i3+1, header->lpt[1], datablock[blockword]);
+                }
+            }
+        }
+
+    return(0);
+}
+
+
+
+
+/*
+   Get the next group header in the file.
+   Group header lines are 12 characters long, of the form "GROUP   nnnn".
+
+   Parameters:
+      group - the GROUP header we read
+      expected - the header we expected
+      infile - the file pointer to read
+*/
+void ephcom_nxtgrp(char *group, char *expected, FILE *infile) {
+
+    char readbuf[EPHCOM_MAXLINE + 1];
+    char *fgets(char *, int, FILE *);
+
+    fgets(readbuf, EPHCOM_MAXLINE, infile); /* Blank Line     */
+    fgets(readbuf, EPHCOM_MAXLINE, infile); /* "GROUP   dddd\n" */
+    strncpy(group, readbuf, 12);
+    group[12] = '\0';
+    if (strncmp(group, expected, 12) != 0) {
+        fprintf(stderr, "Badly formed header; \"%s\" not found.\n\n", expected);
+        exit(1);
+    }
+    fgets(readbuf, EPHCOM_MAXLINE, infile); /* Blank Line    */
+}
+
+
+
+
+/*
+   ephcom_swap64() - Reverse the bytes of each of n 8-byte values in buf,
+   in place: between big-endian (network) order and host order on an
+   Intel 80x86, or between little-endian and host order on Motorola or
+   SPARC.  Callers test EPHCOM_HOSTORDER first and skip the call when
+   the orders already match.
+
+   The loop is written so that an optimizing compiler turns it into
+   vector byte shuffles (gcc -O3 gives pshufb with -mssse3, vpshufb with
+   -mavx2), and otherwise into one bswap per value; no intrinsics are
+   needed here.
+*/
+void ephcom_swap64(void *buf, int n) {
+
+    int i;
+    unsigned long long u;
+    unsigned char *p = (unsigned char *)buf;
+
+    for (i=0; i<n; i++) {
+        memcpy(&u, p + 8*i, 8);
+        u = EPHCOM_BSWAP64(u);
+        memcpy(p + 8*i, &u, 8);
+    }
+}
+
+
+
+
+/*
+   ephcom_swap32() - ephcom_swap64() for n 4-byte values.
+*/
+void ephcom_swap32(void *buf, int n) {
+
+    int i;
+    unsigned u;
+    unsigned char *p = (unsigned char *)buf;
+
+    for (i=0; i<n; i++) {
+        memcpy(&u, p + 4*i, 4);
+        u = EPHCOM_BSWAP32(u);
+        memcpy(p + 4*i, &u, 4);
+    }
+}
+
+
+
+
+/*
+   ephcom_outdoubles() - Write n double precision values to the given
+   file in network order (Big Endian), a buffer at a time.
+*/
+int ephcom_outdoubles(FILE *outfp, double *x, int n) {
+
+    int i, m;
+    double buf[512];
+
+    for (i=0; i<n; i+=m) {
+        m = n - i < 512 ? n - i : 512;
+        memcpy(buf, &x[i], m * 8);
+        if (EPHCOM_HOSTORDER != EPHCOM_BIGENDIAN)
+            ephcom_swap64(buf, m);
+        fwrite(buf, 8, m, outfp);
+    }
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_indoubles() - Read n double precision values in network order
+   (Big Endian) from the given file into x[] with one fread(), then put
+   them in host order.  Returns the number of values read.
+*/
+int ephcom_indoubles(FILE *infp, double *x, int n) {
+
+    int nread;
+
+    nread = (int)fread(x, 8, n, infp);
+    if (EPHCOM_HOSTORDER != EPHCOM_BIGENDIAN)
+        ephcom_swap64(x, nread);
+    return(nread);
+}
+
+
+
+
+/*
+   Print a double precision value to the given file with bytes swapped
+   if necessary to match network order (Big Endian).  On Intel 80x86
+   the bytes will get swapped, on Motorola or SPARC they won't.
+*/
+int ephcom_outdouble(FILE *outfp, double x) {
+
+   return(ephcom_outdoubles(outfp, &x, 1));
+}
+
+
+
+
+/*
+   Print an integer (4-byte) value to the given file with bytes swapped
+   if necessary to match network order (Big Endian).  On Intel 80x86
+   the bytes will get swapped, on Motorola or SPARC they won't.
+*/
+int ephcom_outint(FILE *outfp, unsigned u) {
+
+   if (EPHCOM_HOSTORDER != EPHCOM_BIGENDIAN)
+      ephcom_swap32(&u, 1);
+   fwrite(&u, 4, 1, outfp);
+   return(0);
+}
+
+
+
+
+/*
+   Read in a double precision value from the given file with bytes swapped
+   if necessary to match host order (Little- or DEC- Endian).  On Intel 80x86
+   the bytes will get swapped, on Motorola or SPARC they won't.
+*/
+double ephcom_indouble(FILE *infp) {
+
+   double x = 0.0;
+
+   (void)ephcom_indoubles(infp, &x, 1);
+   return(x);
+}
+
+
+
+
+/*
+   Read in an integer (4--byte) value to the given file with bytes swapped
+   if necessary to match host order (Little- or DEC- Endian).  On Intel 80x86
+   the bytes will get swapped, on Motorola or SPARC they won't.
+*/
+int ephcom_inint(FILE *infp) {
+
+   unsigned u = 0;
+
+   fread(&u, 4, 1, infp);
+   if (EPHCOM_HOSTORDER != EPHCOM_BIGENDIAN)
+      ephcom_swap32(&u, 1);
+   return((int)u);
+   }
+
+
+
+
+/*
+   ephcom_hostorder() - Byte order of this machine, EPHCOM_BIGENDIAN or
+   EPHCOM_LITTLEENDIAN, for compilers that do not say so (see
+   EPHCOM_HOSTORDER above); found once, with gnulliver().
+*/
+int ephcom_hostorder(void) {
+
+    static int hostorder = -1;
+    unsigned char gnulliver();
+
+    if (hostorder < 0)
+        hostorder = gnulliver() == 0x0f /* GNULLIVER_LITTLE */ ? EPHCOM_LITTLEENDIAN : EPHCOM_BIGENDIAN;
+    return(hostorder);
+}
+
+
+
+
+/*
+   ephcom_getdouble() - Double precision value from 8 bytes of a file in
+   the given byte order.
+*/
+double ephcom_getdouble(unsigned char *ch, int byteorder) {
+
+    double x;
+
+    memcpy(&x, ch, 8);
+    if (byteorder != EPHCOM_HOSTORDER)
+        ephcom_swap64(&x, 1);
+    return(x);
+}
+
+
+
+
+/*
+   ephcom_getint() - Integer (4-byte) value from 4 bytes of a file in the
+   given byte order.
+*/
+int ephcom_getint(unsigned char *ch, int byteorder) {
+
+    unsigned u;
+
+    memcpy(&u, ch, 4);
+    if (byteorder != EPHCOM_HOSTORDER)
+        ephcom_swap32(&u, 1);
+    return((int)u);
+}
+
+
+
+
+/*
+   ephcom_byteorder() - Byte order of a binary ephemeris, from the 204
+   bytes of its first record that hold SS, NCON, AU, EMRAT, IPT, NUMDE and
+   LPT.  The title and constant names are text and read the same either
+   way, so look for the order in which the numbers make a sensible
+   header: a positive step size, at most 400 constants, an ephemeris
+   number from 1 to 9999, and coefficient pointers that stay within a
+   data block of at most 100000 coefficients.  Big-endian wins a tie, and
+   is assumed if neither order fits.
+*/
+int ephcom_byteorder(unsigned char *fixed) {
+
+    int order, i, ncon, numde, ptr, ncf, nsub;
+
+    for (order=EPHCOM_BIGENDIAN; order<=EPHCOM_LITTLEENDIAN; order++) {
+        if (!(ephcom_getdouble(&fixed[16], order) > 0.0))
+            continue;
+        ncon  = ephcom_getint(&fixed[24], order);
+        numde = ephcom_getint(&fixed[188], order);
+        if (ncon < 0 || ncon > 400 || numde < 1 || numde > 9999)
+            continue;
+        for (i=0; i<13; i++) {
+            ptr  = ephcom_getint(&fixed[i < 12 ? 44 + 12*i : 192], order);
+            ncf  = ephcom_getint(&fixed[i < 12 ? 48 + 12*i : 196], order);
+            nsub = ephcom_getint(&fixed[i < 12 ? 52 + 12*i : 200], order);
+            if (ptr < 0 || ptr > 100000 || ncf < 0 || ncf > 100000 ||
+                nsub < 0 || nsub > 100000)
+                break;
+        }
+        if (i == 13)
+            return(order);
+    }
+    return(EPHCOM_BIGENDIAN);
+}
+
+
+
+
+/*
+   ephcom_doublstrc2f() - function to convert a string with a double precision
+                          value written in C to a double precision value that
+                          FORTRAN creates.  Conversion happens in place.
+*/
+
+int ephcom_doublestrc2f(char *buf) {
+
+    int i, j, istart, istop, exp, edigits;
+    double x;
+
+    for (istart=0; isspace(buf[istart]); istart++);
+    x = atof(&buf[istart]);
+    for (istop=istart; toupper(buf[istop]) != 'E'; istop++);
+    exp = atoi(&buf[istop+1]);
+    exp++;
+    if (exp < 0) {
+        buf[istop+2] = '-';
+        exp = -exp;
+    }
+    else {
+        buf[istop+2] = '+';
+    }
+    if (x == 0.0) 
+        exp=0;
+    if (exp < 100) 
+        edigits = 2;
+    else if (exp < 1000) 
+        edigits = 3;
+    else edigits = 4;
+
+    while (edigits > 0) {
+        buf[istop + edigits + 2] = exp % 10 + '0';
+        exp /= 10;
+        edigits--;
+    }
+
+    buf[istop+1] = 'D';
+
+    while (istop > istart && buf[istop-1] != '.') {
+        buf[istop] = buf[istop-1];
+        istop--;
     }
-/*
-   Finished normally.
-*/
+
+    buf[istop] = buf[istop-2];  /* buf[istop-1] == '.' */
+    buf[istop-2] = '0';         /* leading zero */
+
     return(0);
 }
 
@@ -834,104 +2164,297 @@ int ephcom_writebinary_header(FILE *outfp, struct ephcom_Header *header) {
 
 
 /*
-   Write a block of data coefficients in JPL binary file format.
+   ephcom_mul64() - The high 64 bits of the 128-bit product a*b, rounded,
+   for ephcom_grisu2().
 */
-int ephcom_writebinary_block(FILE *outfp, struct ephcom_Header *header, 
-                             int blocknum, double *datablock) {
+unsigned long long ephcom_mul64(unsigned long long a, unsigned long long b) {
+
+    unsigned long long ahi, alo, bhi, blo, mid;
+
+    ahi = a >> 32;  alo = a & 0xffffffffULL;
+    bhi = b >> 32;  blo = b & 0xffffffffULL;
+    mid = (alo * blo >> 32) + (ahi * blo & 0xffffffffULL) + (alo * bhi & 0xffffffffULL) +
+          (1ULL << 31);
+    return(ahi * bhi + (ahi * blo >> 32) + (alo * bhi >> 32) + (mid >> 32));
+}
+
+
 
-    int i;
-    int ephcom_outdouble(FILE *, double);
-    int filebyte;
-    int filepos;
 
 /*
-   Find out where we need to point in the binary file.
-*/
-    filebyte = (blocknum + 2) * header->ncoeff * 8; /* 8 bytes per coefficient */
+   ephcom_grisu2() - Decimal digits of x, which must be positive and
+   finite: the fewest that read back as exactly x in all but a few cases,
+   where one more is used.  This is the Grisu2 algorithm of F. Loitsch,
+   "Printing Floating-Point Numbers Quickly and Accurately with Integers"
+   (PLDI 2010), which needs only 64-bit integer arithmetic and a table of
+   powers of ten.  Puts the digits (at most 17, not terminated) in
+   digits[] and sets *k so that x = 0.d1d2d3... * 10^(*k).  Returns the
+   number of digits.
+*/
+int ephcom_grisu2(double x, char *digits, int *k) {
+/*
+   10^(-348 + 8*i) as a 64-bit significand, rounded, and binary exponent.
+*/
+    static const unsigned long long pow10f[87] = {
+        0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+        0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+        0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+        0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+        0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+        0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+        0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+        0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+        0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+        0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+        0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+        0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+        0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+        0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+        0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+        0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+        0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+        0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+        0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+        0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+        0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+        0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+        0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+        0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+        0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+        0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+        0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+        0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+        0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+    };
+    static const short pow10e[87] = {
+        -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+        -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+        -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+        -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+        -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+        109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+        375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+        641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+        907, 933, 960, 986, 1013, 1039, 1066
+    };
+    static const unsigned long long pow10[20] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+        100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+        10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+        10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+        10000000000000000000ULL};
+    unsigned long long u;
+    unsigned long long f, wf;   /* x, and x normalized */
+    unsigned long long mf, pf;  /* Halfway to the doubles either side of x */
+    unsigned long long delta;   /* Width of the interval that reads back as x */
+    unsigned long long one, p1, p2, rest, tenkappa, wpw;
+    int e, me, pe, ce;
+    int i, kappa, n, d, K;
+    double dk;
+
+    memcpy(&u, &x, 8);
+    e = (int)(u >> 52 & 0x7ff);
+    f = u & 0xfffffffffffffULL;
+    if (e != 0) {
+        f |= 1ULL << 52;
+        e -= 1075;
+    }
+    else
+        e = -1074;
 /*
-   If the file isn't that large, pad it with null bytes
+   x and its upper boundary normalized, and the lower boundary (closer
+   when x is a power of 2) at the same exponent.
 */
-    fseek(outfp, 0L, SEEK_END);
-    filepos = ftell(outfp);
-    if (filepos < filebyte) {
-        for (i=0; i < (filebyte - filepos); i++) {
-            fputc('\0', outfp);
+    for (pf=(f << 1) + 1, pe=e - 1; !(pf & (1ULL << 63)); pf <<= 1, pe--)
+        ;
+    if (f == (1ULL << 52)) {
+        mf = (f << 2) - 1;
+        me = e - 2;
+    }
+    else {
+        mf = (f << 1) - 1;
+        me = e - 1;
+    }
+    mf <<= me - pe;
+    wf = f << (e - pe);  /* x normalized has the upper boundary's exponent */
+/*
+   Scale all three by the cached power of ten that puts the upper
+   boundary's binary exponent in [-60, -32], then shrink the interval by
+   the 1-unit error of the products, so every digit string in it is safe.
+*/
+    dk = (-61 - pe) * 0.30102999566398114 + 347;
+    K = (int)dk;
+    if (dk - K > 0.0)
+        K++;
+    i = (K >> 3) + 1;
+    K = 348 - 8 * i;     /* x ~ (scaled value) * 10^K */
+    ce = pow10e[i];
+    wf = ephcom_mul64(wf, pow10f[i]);
+    pf = ephcom_mul64(pf, pow10f[i]) - 1;
+    mf = ephcom_mul64(mf, pow10f[i]) + 1;
+    pe = pe + ce + 64;   /* All three now have this exponent */
+    delta = pf - mf;
+    wpw = pf - wf;
+/*
+   Generate digits of the upper boundary, integer part first, until what
+   is left is within the interval; then step the last digit down towards
+   x while that stays in the interval and gets closer.
+*/
+    one = 1ULL << -pe;
+    p1 = pf >> -pe;
+    p2 = pf & (one - 1);
+    for (kappa=0; kappa < 10 && p1 >= pow10[kappa]; kappa++)
+        ;
+    n = 0;
+    tenkappa = 0;       /* Set once the digits are enough */
+    while (kappa > 0 && tenkappa == 0) {
+        d = (int)(p1 / pow10[kappa - 1]);
+        p1 %= pow10[kappa - 1];
+        if (d || n)
+            digits[n++] = '0' + d;
+        kappa--;
+        rest = (p1 << -pe) + p2;
+        if (rest <= delta)
+            tenkappa = pow10[kappa] << -pe;
+    }
+    while (tenkappa == 0) {
+        p2 *= 10;
+        delta *= 10;
+        d = (int)(p2 >> -pe);
+        if (d || n)
+            digits[n++] = '0' + d;
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta) {
+            rest = p2;
+            tenkappa = one;
+            wpw *= -kappa < 20 ? pow10[-kappa] : 0;
         }
     }
+    while (rest < wpw && delta - rest >= tenkappa &&
+           (rest + tenkappa < wpw || wpw - rest > rest + tenkappa - wpw)) {
+        digits[n - 1]--;
+        rest += tenkappa;
+    }
+
+    *k = n + K + kappa;
+    return(n);
+}
+
+
+
+
 /*
-   Now go to position where we want to start writing.
+   ephcom_fmtdouble() - Write x into buf the way JPL ASCII ephemerides
+   write their numbers, as 25 characters (not terminated): a blank or
+   minus sign, then 0.dddddddddddddddddd, 18 digits, then D and a signed
+   2-digit exponent, e.g. " 0.245153650000000000D+07".  The digits are
+   those ephcom_grisu2() finds, padded with zeros, so the number reads
+   back as exactly x.  A 3-digit exponent leaves room for 17 digits.
+   Returns 25.
 */
-    fseek(outfp, filebyte, SEEK_SET);
-    for (i = 0; i < header->ncoeff; i++) {
-        ephcom_outdouble(outfp, datablock[i]);
+int ephcom_fmtdouble(double x, char *buf) {
+
+    char digits[20];
+    char tmp[40];
+    int i, n, k, ndigits;
+    unsigned long long u;
+
+    if (!(x - x == 0.0)) {  /* Infinite or NaN: nothing to shorten */
+        sprintf(tmp, "%25.17E", x);
+        memcpy(buf, tmp, 25);
+        return(25);
     }
+    memcpy(&u, &x, 8);
+    buf[0] = (u >> 63) ? '-' : ' ';
+    n = k = 0;
+    if (x != 0.0)
+        n = ephcom_grisu2(x < 0.0 ? -x : x, digits, &k);
+    ndigits = (k > 99 || k < -99) ? 17 : 18;
+    buf[1] = '0';
+    buf[2] = '.';
+    for (i=0; i<ndigits; i++)
+        buf[3 + i] = i < n ? digits[i] : '0';
+    buf += 3 + ndigits;
+    *buf++ = 'D';
+    *buf++ = k < 0 ? '-' : '+';
+    if (k < 0)
+        k = -k;
+    if (ndigits == 17) {
+        *buf++ = '0' + k / 100;
+        k %= 100;
+    }
+    *buf++ = '0' + k / 10;
+    *buf   = '0' + k % 10;
 
-    return(0);
+    return(25);
 }
 
 
 
 
 /*
-   ephcom_parse_block() - Parse a binary block of data.  Warning: verbose!
-                          Writes parsed output to file pointer outfp.
+   ephcom_format_block() - Write data block blocknum (from 0) into buf as
+   it goes in a JPL ASCII data file: a line with the block number and
+   ncoeff, then the coefficients 3 to a line, each line 80 characters
+   and "\r\n".  buf must hold EPHCOM_ASCIIBLOCK(header->ncoeff) bytes.
+   Returns the number of bytes written (not terminated).
 */
-int ephcom_parse_block(FILE *outfp, struct ephcom_Header *header, double *datablock) {
+int ephcom_format_block(struct ephcom_Header *header, int blocknum, double *datablock,
+                        char *buf) {
+
+    int i, j;
+    char *p;
+
+    p = buf + sprintf(buf, "%6d%6d", blocknum + 1, header->ncoeff);
+    memset(p, ' ', 68);
+    p += 68;
+    *p++ = '\r';
+    *p++ = '\n';
+    for (i=0; i<header->ncoeff; i+=3) {
+        for (j=0; j<3; j++) {  /* Pad the last line with 0.0D+00 */
+            p += ephcom_fmtdouble(i + j < header->ncoeff ? datablock[i + j] : 0.0, p);
+            *p++ = ' ';
+        }
+        memcpy(p, "  \r\n", 4);
+        p += 4;
+    }
+
+    return((int)(p - buf));
+}
+
+
+
 
-    int i0, i1, i2, i3;
-    int blockword;
 /*
-   Names of the objects in Chebyshev coefficient arrays.
+   Planetary Ephemeris.  Takes coordinates already calculated in
+   coords structure an converts to vectors and vector dot in testr[].
+   Bodies start at 1 for Mercury, to match the JPL PLEPH() numbering.
+   Values for ntarg and ncntr correspond to locations ntarg-1 and
+   ncntr-1 in coords->pv[].
 */
-    static char *ephcom_coeffname[13] = {
-        "Mercury", "Venus", "EMBary", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune",
-        "Pluto", "Moon", "Sun", "Nutation", "Libration"};
+int ephcom_pleph(struct ephcom_Coords *coords, int ntarg, int ncntr, double *r) {
 
-    blockword=0;
-    fprintf(outfp, "@%04d StartJD\t%12.2f\n", blockword++, datablock[0]);
-    fprintf(outfp, "@%04d EndJD\t%12.2f\n", blockword++, datablock[1]);
+    int i,j;
 
-    for (i0=0; i0<12; i0++) {  /* For first 12 bodies */
-        fprintf(outfp, "Body\t%d (%s)\n", i0+1, ephcom_coeffname[i0]);
-        for (i1=0; i1<header->ipt[i0][2]; i1++) { /* For all subintervals */
-            fprintf(outfp, "  Subinterval %d of %d\n", i1+1, header->ipt[i0][2]);
-            for (i2=0; i2 < (i0==11 ? 2 : 3); i2++) {  /* For all coordinates */
-                fprintf(outfp, "    %cCoefficients\n", 'X' + i2);
-                for (i3=0; i3<header->ipt[i0][1]; i3++) {  /* For all coefficients */
-                    blockword = header->ipt[i0][0] +
-                                i1*header->ipt[i0][1] * (i0==11 ? 2 : 3) +
-                                i2*header->ipt[i0][1] + i3 - 1;
-                    fprintf(outfp, "      @%04d [%2d of %2d] %25.17E\n",
-                            blockword, i3+1, header->ipt[i0][1], datablock[blockword]);
-                }
-            }
+    if (ntarg != 14 && ncntr != 14) { /* If not nutation, handle normally */
+        if (ntarg == 15 || ncntr == 15) { /* Libration */
+            for (i=0; i<6; i++)
+                r[i] = coords->pv[14][i];
         }
-    }
-// For libration    
-    fprintf(outfp, "Body\t13 (%s)\n", ephcom_coeffname[12]);
-        for (i1=0; i1<header->lpt[2]; i1++) { /* For all subintervals */
-            fprintf(outfp, "  Subinterval %d of %d\n", i1+1, header->lpt[2]);
-            for (i2=0; i2 < 3; i2++) {  /* For all coordinates */
-                switch (i2){
-                    case 0: 
-                        fprintf(outfp, "    %sCoefficients\n", "phi");
-                        break;
-                    case 1:
-                        fprintf(outfp, "    %sCoefficients\n", "theta");
-                        break;
-                    case 2:
-                        fprintf(outfp, "    %sCoefficients\n", "psi");
-                        break;
-                }
-                for (i3=0; i3<header->lpt[1]; i3++) {  /* For all coefficients */
-                    blockword = header->lpt[0] +
-                                i1*header->lpt[1] *3 +
-                                i2*header->lpt[1] + i3 - 1;
-                    fprintf(outfp, "      @%04d [%2d of %2d] %25.17E\n",
-                            blockword, i3+1, header->lpt[1], datablock[blockword]);
-                }
-            }
+        else {
+            for (i=0; i<6; i++)
+                r[i] = coords->pv[ntarg-1][i] - coords->pv[ncntr-1][i];
         }
+    }
+    else { /* Nutation */
+        r[0] = coords->pv[13][0];
+        r[1] = coords->pv[13][1];
+        r[2] = coords->pv[13][2];
+        r[3] = coords->pv[13][3];
+        r[4] = 0.0;
+        r[5] = 0.0;
+   }
 
     return(0);
 }
@@ -940,168 +2463,400 @@ int ephcom_parse_block(FILE *outfp, struct ephcom_Header *header, double *databl
 
 
 /*
-   Get the next group header in the file.
-   Group header lines are 12 characters long, of the form "GROUP   nnnn".
-
-   Parameters:
-      group - the GROUP header we read
-      expected - the header we expected
-      infile - the file pointer to read
+   ephcom_pleph_all() - All bodies at once relative to one center.  Takes
+   coordinates already calculated in coords and fills r[0..12][] with the
+   position and velocity of bodies 1 (Mercury) through 13 (EMBary)
+   relative to body ncntr, so r[EPHCOM_SUN-1] is the Sun, and so on.  This
+   gives the same values as 13 calls to ephcom_pleph(), in one pass over
+   the contiguous r[][6] array.  Returns the number of rows filled, or -1
+   if ncntr is not one of bodies 1 to 13.
 */
-void ephcom_nxtgrp(char *group, char *expected, FILE *infile) {
+int ephcom_pleph_all(struct ephcom_Coords *coords, int ncntr, double r[][6]) {
 
-    char readbuf[EPHCOM_MAXLINE + 1];
-    char *fgets(char *, int, FILE *);
+    int i, j;
+    double center[6];
 
-    fgets(readbuf, EPHCOM_MAXLINE, infile); /* Blank Line     */
-    fgets(readbuf, EPHCOM_MAXLINE, infile); /* "GROUP   dddd\n" */
-    strncpy(group, readbuf, 12);
-    group[12] = '\0';
-    if (strncmp(group, expected, 12) != 0) {
-        fprintf(stderr, "Badly formed header; \"%s\" not found.\n\n", expected);
-        exit(1);
-    }
-    fgets(readbuf, EPHCOM_MAXLINE, infile); /* Blank Line    */
+    if (ncntr < 1 || ncntr > 13)
+        return(-1);
+/*
+   Copy the center out first so the loop below is a plain
+   element-by-element subtraction that the compiler can vectorize.
+*/
+    for (j=0; j<6; j++)
+        center[j] = coords->pv[ncntr-1][j];
+    for (i=0; i<13; i++)
+        for (j=0; j<6; j++)
+            r[i][j] = coords->pv[i][j] - center[j];
+
+    return(13);
 }
 
 
 
 
 /*
-   Print a double precision value to the given file with bytes swapped
-   if necessary to match network order (Big Endian).  On Intel 80x86
-   the bytes will get swapped, on Motorola or SPARC they won't.
+   ephcom_get_coords() - Interpolate positions and velocities at given time.
 */
-int ephcom_outdouble(FILE *outfp, double x) {
-   double retval;
-   unsigned char ch[8];
-   unsigned char *gnulliver64c(unsigned char *);
-   void *memcpy(void *, const void *, size_t);
-
-   memcpy((void *)ch, (const void *)&x, 8);
-// printf("Got OD: %25.17e => %02x %02x %02x %02x %02x %02x %02x %02x, ",
-//        x, ch[0], ch[1], ch[2], ch[3], ch[4], ch[5], ch[6], ch[7]);
-   (void)gnulliver64c(ch);
-// printf("Sending OD: %02x %02x %02x %02x %02x %02x %02x %02x\n",
-//        ch[0], ch[1], ch[2], ch[3], ch[4], ch[5], ch[6], ch[7]);
-   fwrite(ch, 1, 8, outfp);
-   return(0);
+int ephcom_get_coords(FILE *infp, struct ephcom_Header *header,
+                      struct ephcom_Coords *coords, double *datablock) {
+
+    double et2[2];    /* Ephemeris time, as coarse (whole) and fine time  in JD */
+    double totaltime; /* Sum of whole and fractional JD */
+    double filetime;  /* JDs since start of ephemeris file */
+    int blocknum;
+    int retval; /* Return value */
+
+//Declaration of used functions
+    int ephcom_interp_coords(struct ephcom_Header *header, struct ephcom_Coords *coords,
+                             double *datablock);
+
+    retval = 0; /* Assume normal return */
+/*
+   Split time JD into whole JDs (et2[0]) and fractional JD (et2[1]).
+*/
+    totaltime = coords->et2[0] + coords->et2[1];
+    if (totaltime < header->ss[0] || totaltime > header->ss[1]) {
+        fprintf(stderr,"Time is outside ephemeris range.\n");
+        retval = -1;
+    }
+    else {
+        et2[0] = (int)totaltime;
+        et2[1] = (coords->et2[0] - et2[0]) + coords->et2[1];
+        filetime = totaltime - header->ss[0]; /* Days from start of file */
+        blocknum = (int)(filetime / header->ss[2]); /* Data block in file, 0.. */
+   /*
+      Read the data block that contains coefficients for desired date.
+      With prefetch on, a block still in datablock from the last call
+      is used as is, and the blocks after it are requested in advance.
+   */
+        if (header->prefetch <= 0 ||
+            datablock[0] != header->ss[0] + blocknum * header->ss[2] ||
+            datablock[1] != datablock[0] + header->ss[2])
+            ephcom_readbinary_block(infp, header, blocknum, datablock);
+        ephcom_prefetch_block(infp, header, blocknum);
+        retval = ephcom_interp_coords(header, coords, datablock);
+    }
+
+    return(retval);
 }
 
 
 
 
 /*
-   Print an integer (4-byte) value to the given file with bytes swapped
-   if necessary to match network order (Big Endian).  On Intel 80x86
-   the bytes will get swapped, on Motorola or SPARC they won't.
+   ephcom_interp_coords() - The rest of ephcom_get_coords(), once the data
+   block is in memory: interpolate positions and velocities of every body
+   at coords->et2[0] + coords->et2[1] from datablock, which must be the
+   block covering that time.  For callers that keep blocks themselves
+   (see ephserve.c).  Returns 0, or -1 if datablock does not cover the time.
 */
-int ephcom_outint(FILE *outfp, unsigned u) {
-   unsigned u2;
-   unsigned gnulliver32(unsigned);
+int ephcom_interp_coords(struct ephcom_Header *header, struct ephcom_Coords *coords,
+                         double *datablock) {
 
-   u2 = gnulliver32(u);
-   fwrite(&u2, 4, 1, outfp);
-   return(0);
+    int ephcom_interp_coords_r(struct ephcom_Header *header, struct ephcom_Coords *coords,
+                               double *datablock, struct ephcom_ChebyScratch *scratch);
+
+    return(ephcom_interp_coords_r(header, coords, datablock, NULL));
 }
 
 
 
 
 /*
-   Read in a double precision value from the given file with bytes swapped
-   if necessary to match host order (Little- or DEC- Endian).  On Intel 80x86
-   the bytes will get swapped, on Motorola or SPARC they won't.
+   ephcom_interp_coords_r() - ephcom_interp_coords() interpolating with the
+   caller's Chebyshev scratch area (see ephcom_cheby_r()), or with
+   ephcom_cheby()'s own if scratch is NULL.
 */
-double ephcom_indouble(FILE *infp) {
-   double x;
-   static double retval;
-   size_t fread(void *ptr,  size_t size, size_t nmemb, FILE *stream);
-   unsigned char ch[8];
-   unsigned char *gnulliver64c(unsigned char *);
-   void *memcpy(void *, const void *, size_t);
-   
+int ephcom_interp_coords_r(struct ephcom_Header *header, struct ephcom_Coords *coords,
+                           double *datablock, struct ephcom_ChebyScratch *scratch) {
+
+    double totaltime; /* Sum of whole and fractional JD */
+    double blocktime; /* JDs since start of data block */
+    double subtime;   /* JDs since start of subinterval in block */
+    int i, j;
+    int subinterval; /* Number of subinterval for this body */
+    int dataoffset; /* Offset in datablock for current body and subinterval */
+    double subspan; /* Span of one subinterval in days */
+    double chebytime; /* Normalized Chebyshev time, in interval [-1,1]. */
+    int ncoords; /* Number of coordinates for position and velocity */
+    int retval; /* Return value */
+    double posscale;  /* 1 for km, 1/AU for AU */
+    double timeunit;  /* Length of velocity time unit in days */
+    double scale;     /* posscale, or 1 for angles */
+    int ncf;          /* Chebyshev coefficients per coordinate */
+
+//Declaration of used functions
+    int ephcom_cheby(int maxcoeffs, double x, double span, double scale, double *y, 
+                     int ncoords, int ncoeffs, double *pv);
+    int ephcom_cheby_r(int maxcoeffs, double x, double span, double scale, double *y,
+                       int ncoords, int ncoeffs, double *pv,
+                       struct ephcom_ChebyScratch *scratch);
+
+    retval = 0; /* Assume normal return */
+/*
+   Units are applied inside ephcom_cheby(), as one multiply by a factor
+   worked out here once per call: positions are scaled by posscale, and
+   a subinterval span given in the velocity time unit makes the 2/span
+   derivative factor yield km (or AU) per day or per second directly.
+   Nutation and libration angles stay in radians.
+*/
+    posscale = coords->km ? 1.0 : 1.0 / header->au;
+    timeunit = coords->seconds ? 86400.0 : 1.0;
+    totaltime = coords->et2[0] + coords->et2[1];
+/*
+   Step through the bodies and interpolate positions and velocities.
+*/
+    blocktime = totaltime - datablock[0]; /* Days from block start */
+    for (i=0; i<13; i++) {
+        if ((i == 12 ? header->lpt[1] : header->ipt[i][1]) <= 0 ||
+            (i == 12 ? header->lpt[2] : header->ipt[i][2]) <= 0) {
+            for (j=0; j<6; j++)  /* Not in this file, e.g. from ephfit */
+                coords->pv[i][j] = 0.0;
+            continue;
+        }
+        if (i == 12)
+            subspan = header->ss[2] / header->lpt[2];
+        else
+            subspan = header->ss[2] / header->ipt[i][2]; /* Days/subinterval */
+        subinterval = (int)((totaltime - datablock[0]) / subspan);
+
+        ncoords = (i == 11 ? 2 : 3); /* 2 coords for nutation, else 3 */
+
+        if (i == 12)
+            dataoffset = header->lpt[0] - 1 +
+                         ncoords * header->lpt[1] * subinterval;
+        else
+            dataoffset = header->ipt[i][0] - 1 +
+                         ncoords * header->ipt[i][1] * subinterval;
+
+        subtime = blocktime - subinterval * subspan;
+   /*
+      Divide days in this subblock by total days in subblock
+      to get interval [0,1].  The right part of the expression
+      will evaluate to a whole number: subinterval lengths are
+      all integer multiples of days in a block (all powers of 2).
+   */
+        chebytime = subtime / subspan;
+        chebytime = 2.0*chebytime - 1.0;
+        if (chebytime < -1.0 || chebytime > 1.0) {
+            fprintf(stderr, "Chebyshev time is beyond [-1,1] interval.\n");
+            fprintf(stderr, "blockstart=%f, blocktime=%f, subtime=%f, chebytime=%f\n",
+                    datablock[0], blocktime, subtime, chebytime);
+            retval = -1;
+        }
+        else {
+            ncf = (i == 12 ? header->lpt[1] : header->ipt[i][1]);
+            scale = (i >= 11 ? 1.0 : posscale);
+            if (scratch == NULL)
+                ephcom_cheby(header->maxcheby, chebytime, subspan * timeunit, scale,
+                         &datablock[dataoffset], ncoords, ncf, coords->pv[i]);
+            else
+                ephcom_cheby_r(header->maxcheby, chebytime, subspan * timeunit, scale,
+                         &datablock[dataoffset], ncoords, ncf, coords->pv[i], scratch);
+        }
+      /*
+         Everything is as expected.  Interpolate coefficients.
+      */
+            
+    }
+/*
+   With interpolations complete, calculate Earth from EMBary and
+   Sun from SSBary.  Preserve other coordinates.
+*/
+    for (j=0; j<6; j++) {
+        coords->pv[15][j] = coords->pv[ 9][j]; /* Save original lunar coords */
+        coords->pv[14][j] = coords->pv[12][j]; /* Librations if on file */
+        coords->pv[13][j] = coords->pv[11][j]; /* Nutations if on file */
+        coords->pv[11][j] = 0.0;
    /*
-      Handle as character string until bytes are in correct order,
-      then copy to double once they are.
+      Calculate Earth and Moon from EMBary and geocentric Moon.
    */
-   fread(ch, 1, 8, infp);
-// printf("Got ID: %02x %02x %02x %02x %02x %02x %02x %02x, ",
-//        ch[0], ch[1], ch[2], ch[3], ch[4], ch[5], ch[6], ch[7]);
-   (void)gnulliver64c(ch);
-   memcpy((void *)&retval, (const void *)ch, (size_t)8);
-// printf("Sending ID: %02x %02x %02x %02x %02x %02x %02x %02x [%25.18E]\n",
-//        ch[0], ch[1], ch[2], ch[3], ch[4], ch[5], ch[6], ch[7], retval);
-   return(retval);
+        coords->pv[12][j] = coords->pv[2][j]; /* Move EMBary from Earth spot */
+        coords->pv[2][j] -= coords->pv[9][j] / (1.0 + header->emrat); /* Earth */
+        coords->pv[9][j] += coords->pv[2][j]; /* Moon (change geo->SS-centric) */
+    }
+
+    return(retval);
+}
+
+
+
+
+/*
+   ephcom_load_block() - Make sure datablock holds the data block that
+   covers Julian Day jd, reading it only if the block already there is a
+   different one.  datablock must be used with this one ephemeris file
+   only.  Returns the block number, or -1 if jd is outside the file.
+*/
+int ephcom_load_block(FILE *infp, struct ephcom_Header *header,
+                      double jd, double *datablock) {
+
+    int blocknum;
+    int nblocks;
+
+    if (jd < header->ss[0] || jd > header->ss[1])
+        return(-1);
+    nblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+    blocknum = (int)((jd - header->ss[0]) / header->ss[2]);
+    if (blocknum >= nblocks) /* jd is the very end of the file */
+        blocknum = nblocks - 1;
+    if (datablock[0] != header->ss[0] + blocknum * header->ss[2] ||
+        datablock[1] != datablock[0] + header->ss[2]) {
+        if (ephcom_readbinary_block(infp, header, blocknum, datablock) <= 0)
+            return(-1);
+    }
+    ephcom_prefetch_block(infp, header, blocknum);
+
+    return(blocknum);
+}
+
+
+
+
+/*
+   ephcom_interp_series() - Interpolate one series of a data block already
+   in datablock: series 0 to 11 as in ipt[][] (Mercury ... Nutation), or
+   12 for librations.  jd must lie within the block.  Puts position and
+   velocity in pv[] in km and km/day (radians and radians/day for
+   nutation and libration; nutation fills pv[0..3] only).
+*/
+int ephcom_interp_series(struct ephcom_Header *header, double *datablock,
+                         int series, double jd, double *pv) {
+
+    int ephcom_interp_series_r(struct ephcom_Header *header, double *datablock,
+                               int series, double jd, double *pv,
+                               struct ephcom_ChebyScratch *scratch);
+
+    return(ephcom_interp_series_r(header, datablock, series, jd, pv, NULL));
 }
 
 
 
 
 /*
-   Read in an integer (4--byte) value to the given file with bytes swapped
-   if necessary to match host order (Little- or DEC- Endian).  On Intel 80x86
-   the bytes will get swapped, on Motorola or SPARC they won't.
+   ephcom_interp_series_r() - ephcom_interp_series() interpolating with
+   the caller's Chebyshev scratch area (see ephcom_cheby_r()), or with
+   ephcom_cheby()'s own if scratch is NULL.
 */
-int ephcom_inint(FILE *infp) {
-   unsigned u;
-   static int retval;
-   unsigned gnulliver32(unsigned);
+int ephcom_interp_series_r(struct ephcom_Header *header, double *datablock,
+                           int series, double jd, double *pv,
+                           struct ephcom_ChebyScratch *scratch) {
 
-   fread(&u, 4, 1, infp);
-   retval = (int)gnulliver32(u);
-   return(retval);
-   }
+    int first;
+    int ephcom_series_extent(struct ephcom_Header *header, int series, int *first);
+    int ephcom_interp_segment_r(struct ephcom_Header *header, int series,
+                                double *coeffs, double blockjd, double jd, double *pv,
+                                struct ephcom_ChebyScratch *scratch);
+
+    (void)ephcom_series_extent(header, series, &first);
+    return(ephcom_interp_segment_r(header, series, &datablock[first],
+                                   datablock[0], jd, pv, scratch));
+}
 
 
 
 
 /*
-   ephcom_doublstrc2f() - function to convert a string with a double precision
-                          value written in C to a double precision value that
-                          FORTRAN creates.  Conversion happens in place.
+   ephcom_interp_segment_r() - ephcom_interp_series_r() on one series'
+   coefficients alone, coeffs, as ephcom_readt_series() reads them, for
+   the block starting at Julian Day blockjd.  Returns 0, or -1 if the
+   series is not in the file.
 */
+int ephcom_interp_segment_r(struct ephcom_Header *header, int series,
+                            double *coeffs, double blockjd, double jd, double *pv,
+                            struct ephcom_ChebyScratch *scratch) {
 
-int ephcom_doublestrc2f(char *buf) {
-
-    int i, j, istart, istop, exp, edigits;
-    double x;
-
-    for (istart=0; isspace(buf[istart]); istart++);
-    x = atof(&buf[istart]);
-    for (istop=istart; toupper(buf[istop]) != 'E'; istop++);
-    exp = atoi(&buf[istop+1]);
-    exp++;
-    if (exp < 0) {
-        buf[istop+2] = '-';
-        exp = -exp;
+    int ncoords;      /* 2 coordinates for nutation, else 3 */
+    int ncf;          /* Chebyshev coefficients per coordinate */
+    int nsub;         /* Subintervals per block */
+    int subinterval;
+    int dataoffset;
+    double subspan;   /* Span of one subinterval in days */
+    double chebytime; /* Normalized Chebyshev time, in interval [-1,1]. */
+    int ephcom_cheby(int maxcoeffs, double x, double span, double scale, double *y,
+                     int ncoords, int ncoeffs, double *pv);
+    int ephcom_cheby_r(int maxcoeffs, double x, double span, double scale, double *y,
+                       int ncoords, int ncoeffs, double *pv,
+                       struct ephcom_ChebyScratch *scratch);
+
+    ncoords = (series == 11 ? 2 : 3);
+    if (series == 12) {
+        ncf = header->lpt[1];
+        nsub = header->lpt[2];
     }
     else {
-        buf[istop+2] = '+';
+        ncf = header->ipt[series][1];
+        nsub = header->ipt[series][2];
     }
-    if (x == 0.0) 
-        exp=0;
-    if (exp < 100) 
-        edigits = 2;
-    else if (exp < 1000) 
-        edigits = 3;
-    else edigits = 4;
-
-    while (edigits > 0) {
-        buf[istop + edigits + 2] = exp % 10 + '0';
-        exp /= 10;
-        edigits--;
+    if (ncf <= 0 || nsub <= 0) { /* Not in this file */
+        memset(pv, 0, 2 * ncoords * sizeof(double));
+        return(-1);
     }
+    subspan = header->ss[2] / nsub;
+    subinterval = (int)((jd - blockjd) / subspan);
+    if (subinterval >= nsub) /* jd is the very end of the block */
+        subinterval = nsub - 1;
+    dataoffset = ncoords * ncf * subinterval;
+    chebytime = 2.0 * (jd - blockjd - subinterval * subspan) / subspan - 1.0;
+    if (scratch == NULL)
+        ephcom_cheby(header->maxcheby, chebytime, subspan, 1.0,
+                     &coeffs[dataoffset], ncoords, ncf, pv);
+    else
+        ephcom_cheby_r(header->maxcheby, chebytime, subspan, 1.0,
+                       &coeffs[dataoffset], ncoords, ncf, pv, scratch);
 
-    buf[istop+1] = 'D';
+    return(0);
+}
 
-    while (istop > istart && buf[istop-1] != '.') {
-        buf[istop] = buf[istop-1];
-        istop--;
-    }
 
-    buf[istop] = buf[istop-2];  /* buf[istop-1] == '.' */
-    buf[istop-2] = '0';         /* leading zero */
+
+
+/*
+   ephcom_get_body() - Barycentric position and velocity of one body at
+   Julian Day jd, in km and km/day, evaluating only the series that body
+   needs.  Bodies are numbered as for ephcom_pleph(), 1 to 13; Earth and
+   Moon come from the block's derived series (see ephcom_get_derived()),
+   or if the file's grids don't allow those, are formed from EMBary and
+   the geocentric Moon as in ephcom_get_coords().  The data block is read only if datablock does
+   not already hold it (see ephcom_load_block()).  Returns 0, or -1 if jd
+   is outside the ephemeris or body is not 1 to 13.
+*/
+int ephcom_get_body(FILE *infp, struct ephcom_Header *header, double *datablock,
+                    int body, double jd, double *pv) {
+
+    int j;
+    double emb[6], moon[6];
+    int ephcom_get_derived(FILE *infp, struct ephcom_Header *header, double *datablock,
+                           int body, double jd, double *pv);
+
+    if (body < 1 || body > 13 || ephcom_load_block(infp, header, jd, datablock) < 0)
+        return(-1);
+
+    switch (body) {
+        case EPHCOM_SSBARY:
+            for (j=0; j<6; j++)
+                pv[j] = 0.0;
+            break;
+        case EPHCOM_EARTH:
+        case EPHCOM_MOON:
+            if (ephcom_get_derived(infp, header, datablock, body == EPHCOM_EARTH ?
+                                   EPHCOM_DERIVED_EARTH : EPHCOM_DERIVED_MOON, jd, pv) == 0)
+                break;
+            ephcom_interp_series(header, datablock, 2, jd, emb);
+            ephcom_interp_series(header, datablock, 9, jd, moon);
+            for (j=0; j<6; j++) {
+                pv[j] = emb[j] - moon[j] / (1.0 + header->emrat); /* Earth */
+                if (body == EPHCOM_MOON)
+                    pv[j] += moon[j];
+            }
+            break;
+        case EPHCOM_EMBARY:
+            ephcom_interp_series(header, datablock, 2, jd, pv);
+            break;
+        default:  /* Planets and Sun: series number is body number - 1 */
+            ephcom_interp_series(header, datablock, body - 1, jd, pv);
+            break;
+    }
 
     return(0);
 }
@@ -1110,210 +2865,489 @@ int ephcom_doublestrc2f(char *buf) {
 
 
 /*
-   Planetary Ephemeris.  Takes coordinates already calculated in
-   coords structure an converts to vectors and vector dot in testr[].
-   Bodies start at 1 for Mercury, to match the JPL PLEPH() numbering.
-   Values for ntarg and ncntr correspond to locations ntarg-1 and
-   ncntr-1 in coords->pv[].
-*/
-int ephcom_pleph(struct ephcom_Coords *coords, int ntarg, int ncntr, double *r) {
+   ephcom_lighttime() - Light-time corrected position of body ntarg as
+   seen from body ncntr, for nobs observation times et2[k][0]+et2[k][1]
+   (Julian Days).  Bodies are numbered as for ephcom_pleph().
 
-    int i,j;
+   For each time t the center is evaluated once, at t.  The light time
+   tau is then iterated: the target is evaluated at t - tau and tau is
+   set to the distance over the speed of light (CLIGHT from the file
+   header), until tau changes by less than 1.0E-12 days.  Only the
+   target's own series are interpolated in each iteration, and successive
+   iterations (and observations) in the same data block reuse it without
+   reading the file again; keep observations in time order to get the
+   most out of this.
 
-    if (ntarg != 14 && ncntr != 14) { /* If not nutation, handle normally */
-        if (ntarg == 15 || ncntr == 15) { /* Libration */
-            for (i=0; i<6; i++)
-                r[i] = coords->pv[14][i];
+   On return r[k][] holds the target position at t - tau minus the center
+   position at t, and the same difference of velocities, and tau[k] holds
+   the light time in days that r[k] was evaluated with.  r[k] is in km and
+   km/day, or in AU and AU/day if au is nonzero (AU from the file header).
+   Returns the number of observations done: nobs, unless one is outside
+   the ephemeris or its light time fails to converge in 10 iterations,
+   in which case processing stops there.  Returns -1 if the header has no
+   CLIGHT, or no AU when au is set.
+*/
+int ephcom_lighttime(FILE *infp, struct ephcom_Header *header, double *datablock,
+                     int ntarg, int ncntr, int nobs, double et2[][2],
+                     double r[][6], double *tau, int au) {
+
+    int i, j, k;
+    double t;          /* Observation time, JD */
+    double lt, nextlt; /* Light time, days */
+    double cday;       /* Speed of light, km/day */
+    double center[6], target[6];
+
+    if (header->clight <= 0.0) {
+        fprintf(stderr, "Ephemeris header has no CLIGHT constant.\n");
+        return(-1);
+    }
+    if (au && header->au <= 0.0) {
+        fprintf(stderr, "Ephemeris header has no AU constant.\n");
+        return(-1);
+    }
+    cday = header->clight * 86400.0;
+
+    for (k=0; k<nobs; k++) {
+        t = et2[k][0] + et2[k][1];
+        if (ephcom_get_body(infp, header, datablock, ncntr, t, center) < 0)
+            break;
+        lt = 0.0;
+        for (i=0; i<10; i++) { /* Converges in 3 or 4 steps for planets */
+            if (ephcom_get_body(infp, header, datablock, ntarg,
+                                et2[k][0] + (et2[k][1] - lt), target) < 0)
+                return(k);
+            for (j=0; j<6; j++)
+                r[k][j] = target[j] - center[j];
+            nextlt = sqrt(r[k][0]*r[k][0] + r[k][1]*r[k][1] + r[k][2]*r[k][2]) / cday;
+            if (fabs(nextlt - lt) < 1.0E-12)
+                break;
+            lt = nextlt;
         }
-        else {
-            for (i=0; i<6; i++)
-                r[i] = coords->pv[ntarg-1][i] - coords->pv[ncntr-1][i];
+        if (i == 10) {
+            fprintf(stderr, "Light time did not converge at JD %.9f.\n", t);
+            break;
         }
+        tau[k] = lt;
+        if (au)
+            for (j=0; j<6; j++)
+                r[k][j] /= header->au;
     }
-    else { /* Nutation */
-        r[0] = coords->pv[13][0];
-        r[1] = coords->pv[13][1];
-        r[2] = coords->pv[13][2];
-        r[3] = coords->pv[13][3];
-        r[4] = 0.0;
-        r[5] = 0.0;
-   }
 
-    return(0);
+    return(k);
 }
 
 
 
 
 /*
-   ephcom_get_coords() - Interpolate positions and velocities at given time.
+   ephcom_block_bounds() - Axis-aligned bounding boxes of every position
+   series (Mercury ... Sun, series 0 to 10 as in ipt[][]) over each of its
+   subintervals in datablock.  Each coordinate lies within c[0] -/+ the
+   sum of |c[1..n-1]| of its coefficients over the whole subinterval.
+
+   Boxes go in bounds[] series by series, subinterval by subinterval, as
+   xlo, ylo, zlo, xhi, yhi, zhi in km; the box for subinterval k of series
+   i starts at bounds[6 * (ipt[0][2] + ... + ipt[i-1][2] + k)].  Returns
+   the number of boxes, or 0 if bounds is NULL, to size the array.
 */
-int ephcom_get_coords(FILE *infp, struct ephcom_Header *header,
-                      struct ephcom_Coords *coords, double *datablock) {
+int ephcom_block_bounds(struct ephcom_Header *header, double *datablock,
+                        double *bounds) {
 
-    double et2[2];    /* Ephemeris time, as coarse (whole) and fine time  in JD */
-    double totaltime; /* Sum of whole and fractional JD */
-    double filetime;  /* JDs since start of ephemeris file */
-    double blocktime; /* JDs since start of data block */
-    double subtime;   /* JDs since start of subinterval in block */
     int i, j, k;
-    int blocknum;
-    int nsub; /* Number of subintervals in data block for this body */
-    int subinterval; /* Number of subinterval for this body */
-    int dataoffset; /* Offset in datablock for current body and subinterval */
-    double subspan; /* Span of one subinterval in days */
-    double chebytime; /* Normalized Chebyshev time, in interval [-1,1]. */
-    int ncoords; /* Number of coordinates for position and velocity */
-    int ncf; /* Number of Chebyshev coefficients per coordinate */
-    int retval; /* Return value */
+    int nboxes;
+    int ncf;
+    double *coeff;
+    void ephcom_cheby_range(int n, double *c, double *lo, double *hi);
+
+    nboxes = 0;
+    for (i=0; i<11; i++) {
+        ncf = header->ipt[i][1];
+        for (k=0; k<header->ipt[i][2]; k++) {
+            if (bounds != NULL) {
+                for (j=0; j<3; j++) {
+                    if (ncf <= 0) { /* Not in this file */
+                        bounds[6*nboxes + j] = bounds[6*nboxes + 3 + j] = 0.0;
+                        continue;
+                    }
+                    coeff = &datablock[header->ipt[i][0] - 1 + (3 * k + j) * ncf];
+                    ephcom_cheby_range(ncf, coeff, &bounds[6*nboxes + j],
+                                       &bounds[6*nboxes + 3 + j]);
+                }
+            }
+            nboxes++;
+        }
+    }
+
+    return(nboxes);
+}
+
+
 
-//Declaration of used functions
-    int ephcom_cheby(int maxcoeffs, double x, double span, double *y, 
-                     int ncoords, int ncoeffs, double *pv);
 
-    retval = 0; /* Assume normal return */
 /*
-   Split time JD into whole JDs (et2[0]) and fractional JD (et2[1]).
+   ephcom_body_box() - Bounding box (xlo, ylo, zlo, xhi, yhi, zhi, km) of
+   the barycentric position of a body, numbered as for ephcom_pleph(), 1
+   to 13, over the subintervals that hold fraction u (0 <= u < 1) of the
+   block whose boxes ephcom_block_bounds() put in bounds[].  Earth and
+   Moon are combined from EMBary and the geocentric Moon by interval
+   arithmetic.
 */
-    totaltime = coords->et2[0] + coords->et2[1];
-    if (totaltime < header->ss[0] || totaltime > header->ss[1]) {
-        fprintf(stderr,"Time is outside ephemeris range.\n");
-        retval = -1;
+void ephcom_body_box(struct ephcom_Header *header, double *bounds,
+                     int body, double u, double *box) {
+
+    int i, j;
+    int series;
+    double *emb, *moon, *b;
+    double factor;   /* Geocentric Moon factor for Earth or Moon */
+
+    for (j=0; j<6; j++)
+        box[j] = 0.0;
+    if (body == EPHCOM_SSBARY)
+        return;
+    series = body == EPHCOM_EARTH || body == EPHCOM_MOON || body == EPHCOM_EMBARY ?
+             2 : body - 1;
+    b = bounds;
+    for (i=0; i<series; i++)
+        b += 6 * header->ipt[i][2];
+    emb = &b[6 * (int)(u * header->ipt[series][2])];
+    for (j=0; j<6; j++)
+        box[j] = emb[j];
+    if (body == EPHCOM_EARTH || body == EPHCOM_MOON) {
+        b = bounds;
+        for (i=0; i<9; i++)
+            b += 6 * header->ipt[i][2];
+        moon = &b[6 * (int)(u * header->ipt[9][2])];
+        factor = body == EPHCOM_EARTH ? -1.0 / (1.0 + header->emrat) :
+                                        header->emrat / (1.0 + header->emrat);
+        for (j=0; j<3; j++) {
+            box[j]     += factor * (factor > 0.0 ? moon[j] : moon[3 + j]);
+            box[3 + j] += factor * (factor > 0.0 ? moon[3 + j] : moon[j]);
+        }
     }
-    else {
-        et2[0] = (int)totaltime;
-        et2[1] = (coords->et2[0] - et2[0]) + coords->et2[1];
-        filetime = totaltime - header->ss[0]; /* Days from start of file */
-        blocknum = (int)(filetime / header->ss[2]); /* Data block in file, 0.. */
-   /*
-      Read the data block that contains coefficients for desired date
-   */
-        ephcom_readbinary_block(infp, header, blocknum, datablock);
-   /*
-      Now step through the bodies and interpolate positions and velocities.
-   */
-        blocktime = totaltime - datablock[0]; /* Days from block start */
-        for (i=0; i<13; i++) {
-            if (i == 12)
-                subspan = header->ss[2] / header->lpt[2];
-            else
-                subspan = header->ss[2] / header->ipt[i][2]; /* Days/subinterval */
-            subinterval = (int)((totaltime - datablock[0]) / subspan);
+}
 
-            ncoords = (i == 11 ? 2 : 3); /* 2 coords for nutation, else 3 */
 
-            if (i == 12)
-                dataoffset = header->lpt[0] - 1 +
-                             ncoords * header->lpt[1] * subinterval;
-            else
-                dataoffset = header->ipt[i][0] - 1 +
-                             ncoords * header->ipt[i][1] * subinterval;
 
-            subtime = blocktime - subinterval * subspan;
-      /*
-         Divide days in this subblock by total days in subblock
-         to get interval [0,1].  The right part of the expression
-         will evaluate to a whole number: subinterval lengths are
-         all integer multiples of days in a block (all powers of 2).
-      */
-            chebytime = subtime / subspan;
-            chebytime = 2.0*chebytime - 1.0;
-            if (chebytime < -1.0 || chebytime > 1.0) {
-                fprintf(stderr, "Chebyshev time is beyond [-1,1] interval.\n");
-                fprintf(stderr, "filetime=%f, blocktime=%f, subtime=%f, chebytime=%f\n",
-                        filetime, blocktime, subtime, chebytime);
-            }
-            else {
-                if (i == 12)
-                    ephcom_cheby(header->maxcheby, chebytime, subspan, &datablock[dataoffset],
-                             ncoords, header->lpt[1], coords->pv[i]);
-                else 
-                    ephcom_cheby(header->maxcheby, chebytime, subspan, &datablock[dataoffset],
-                             ncoords, header->ipt[i][1], coords->pv[i]);
-            }
-         /*
-            Everything is as expected.  Interpolate coefficients.
-         */
-                
+
+/*
+   ephcom_screen_approach() - Time spans between Julian Days jd0 and jd1
+   in which bodies nbody1 and nbody2 (numbered as for ephcom_pleph(), 1
+   to 13) might come within distance d (km) of each other, judged only
+   from the bounding boxes of their subintervals: no positions are
+   interpolated.  Each block's boxes are computed once, when the block is
+   first screened, and kept with the header (header->bounds) for as long
+   as the same block stays in datablock.  Spans are conservative: a close
+   approach can only happen inside one, but need not.
+
+   Up to maxspans spans, each [start JD, end JD] with adjacent ones merged,
+   are stored in span[][], in time order.  Returns the number stored, or -1
+   if a body is out of range or not in the file, or a block can't be read.
+*/
+int ephcom_screen_approach(FILE *infp, struct ephcom_Header *header, double *datablock,
+                           int nbody1, int nbody2, double d, double jd0, double jd1,
+                           double span[][2], int maxspans) {
+
+    int i, j, k;
+    int nspans;
+    int blocknum, lastblock;
+    int series[4];         /* Series the two bodies use */
+    double ua, ub, unext;  /* Piece bounds, as fractions of the block */
+    double t0, t1;         /* Piece bounds, JD */
+    double box1[6], box2[6];
+    double lo, hi, gap, dist2;
+    int ephcom_load_block(FILE *infp, struct ephcom_Header *header,
+                          double jd, double *datablock);
+
+    if (nbody1 < 1 || nbody1 > 13 || nbody2 < 1 || nbody2 > 13)
+        return(-1);
+    for (i=0; i<2; i++) {
+        k = i == 0 ? nbody1 : nbody2;
+        series[2*i] = series[2*i + 1] =
+            k == EPHCOM_EARTH || k == EPHCOM_MOON || k == EPHCOM_EMBARY ? 2 : k - 1;
+        if (k == EPHCOM_EARTH || k == EPHCOM_MOON)
+            series[2*i + 1] = 9;
+        if (k == EPHCOM_SSBARY)
+            series[2*i] = series[2*i + 1] = -1;
+    }
+    for (i=0; i<4; i++)
+        if (series[i] >= 0 && (header->ipt[series[i]][1] <= 0 || header->ipt[series[i]][2] <= 0))
+            return(-1);
+
+    if (jd0 < header->ss[0]) jd0 = header->ss[0];
+    if (jd1 > header->ss[1]) jd1 = header->ss[1];
+    if (jd0 >= jd1)
+        return(0);
+
+    if (header->bounds == NULL) {
+        header->bounds = (double *)malloc(6 * ephcom_block_bounds(header, datablock, NULL) *
+                                          sizeof(double));
+        header->boundsjd = EPHCOM_MINJD;
+    }
+
+    nspans = 0;
+    lastblock = (int)((jd1 - header->ss[0]) / header->ss[2]);
+    if (header->ss[0] + lastblock * header->ss[2] >= jd1)
+        lastblock--;
+    for (blocknum = (int)((jd0 - header->ss[0]) / header->ss[2]);
+         blocknum <= lastblock; blocknum++) {
+        if (ephcom_load_block(infp, header, header->ss[0] + (blocknum + 0.5) * header->ss[2],
+                              datablock) != blocknum)
+            return(-1);
+        if (header->boundsjd != datablock[0]) {
+            ephcom_block_bounds(header, datablock, header->bounds);
+            header->boundsjd = datablock[0];
         }
    /*
-      With interpolations complete, calculate Earth from EMBary and
-      Sun from SSBary.  Preserve other coordinates.
+      Walk the pieces of the block between subinterval boundaries of
+      either body, and test the gap between their boxes on each.
    */
-        for (j=0; j<6; j++) {
-            coords->pv[15][j] = coords->pv[ 9][j]; /* Save original lunar coords */
-            coords->pv[14][j] = coords->pv[12][j]; /* Librations if on file */
-            coords->pv[13][j] = coords->pv[11][j]; /* Nutations if on file */
-            coords->pv[11][j] = 0.0;
-      /*
-         Calculate Earth and Moon from EMBary and geocentric Moon.
-      */
-            coords->pv[12][j] = coords->pv[2][j]; /* Move EMBary from Earth spot */
-            coords->pv[2][j] -= coords->pv[9][j] / (1.0 + header->emrat); /* Earth */
-            coords->pv[9][j] += coords->pv[2][j]; /* Moon (change geo->SS-centric) */
-        }
-
-        if (!coords->km) { /* Calculate AU, not kilometers */
-            for (i=0; i<16; i++ ) {
-                if (i == 13) i = 15; /* Skip over nutations and librations */
-                for (j=0; j<6; j++)
-                    coords->pv[i][j] /= header->au;
+        for (ua=0.0; ua < 1.0 - 1.0E-12; ua=ub) {
+            ub = 1.0;
+            for (i=0; i<4; i++) {
+                if (series[i] < 0)
+                    continue;
+                k = header->ipt[series[i]][2];
+                unext = (floor(ua * k + 1.0E-9) + 1.0) / k;
+                if (unext < ub)
+                    ub = unext;
+            }
+            t0 = datablock[0] + ua * header->ss[2];
+            t1 = datablock[0] + ub * header->ss[2];
+            if (t1 <= jd0 || t0 >= jd1)
+                continue;
+            if (t0 < jd0) t0 = jd0;
+            if (t1 > jd1) t1 = jd1;
+
+            ephcom_body_box(header, header->bounds, nbody1, 0.5 * (ua + ub), box1);
+            ephcom_body_box(header, header->bounds, nbody2, 0.5 * (ua + ub), box2);
+            dist2 = 0.0;
+            for (j=0; j<3; j++) {
+                lo = box1[j] - box2[3 + j];   /* Range of body1 - body2 */
+                hi = box1[3 + j] - box2[j];
+                gap = lo > 0.0 ? lo : hi < 0.0 ? -hi : 0.0;
+                dist2 += gap * gap;
             }
+            if (dist2 > d * d)
+                continue;
+            if (nspans > 0 && span[nspans - 1][1] == t0)
+                span[nspans - 1][1] = t1;   /* Continues the last span */
+            else if (nspans < maxspans) {
+                span[nspans][0] = t0;
+                span[nspans][1] = t1;
+                nspans++;
+            }
+            else
+                return(nspans);
         }
+    }
 
-        if (coords->seconds){ /* for km/sec, 86400 sec/day */
-            for (i=0; i<16; i++){
-                if (i==13 || i==14){
-                    coords->pv[i][2] /= 86400.0;
-                    coords->pv[i][3] /= 86400.0;
-                }
-                else{
-                    for (j=3; j<6; j++)
-                        coords->pv[i][j] /= 86400.0;
+    return(nspans);
+}
+
+
+
+
+/*
+   ephcom_derive_block() - Coefficients of the derived series Earth
+   (barycentric), Moon (barycentric) and geocentric Sun for the block in
+   datablock, formed once as linear combinations of the EMBary, geocentric
+   Moon and Sun coefficients:
+
+      Earth  = EMBary - Moon/(1+EMRAT)
+      Moon   = EMBary + Moon*EMRAT/(1+EMRAT)
+      GeoSun = Sun - EMBary + Moon/(1+EMRAT)
+
+   The three are put on the finest subinterval grid of the three series
+   (the Moon's, in the DE files), each coarser series being restricted
+   exactly to the finer subintervals, with maxcheby coefficients per
+   coordinate.  derived[] holds, for EPHCOM_DERIVED_EARTH, _MOON and
+   _GEOSUN in turn, each subinterval's x, y and z coefficients.  Returns
+   the number of doubles filled (or needed, if derived is NULL), or -1 if
+   the grids do not nest (each subinterval count must divide the finest).
+*/
+int ephcom_derive_block(struct ephcom_Header *header, double *datablock,
+                        double *derived) {
+
+    int i, j, k, n, sub;
+    int nsub, ncf, series, subin;
+    int per;               /* Derived subintervals per subinterval of a series */
+    double x0, x1;
+    double *out, *src;
+    double *r;             /* A series restricted to a derived subinterval */
+    double factor[3][3];   /* Weight of EMBary, Moon, Sun in each derived body */
+    static int base[3] = {2, 9, 10};
+    void ephcom_cheby_restrict(int n, double *c, double x0, double x1,
+                               int m, double *r);
+
+    nsub = 0;
+    for (i=0; i<3; i++) {
+        if (header->ipt[base[i]][1] <= 0 || header->ipt[base[i]][2] <= 0)
+            return(-1);
+        if (header->ipt[base[i]][2] > nsub)
+            nsub = header->ipt[base[i]][2];
+    }
+    for (i=0; i<3; i++)
+        if (nsub % header->ipt[base[i]][2] != 0)
+            return(-1);
+    ncf = header->maxcheby;
+    if (derived == NULL)
+        return(3 * nsub * 3 * ncf);
+
+    factor[EPHCOM_DERIVED_EARTH][0]  = 1.0;
+    factor[EPHCOM_DERIVED_EARTH][1]  = -1.0 / (1.0 + header->emrat);
+    factor[EPHCOM_DERIVED_EARTH][2]  = 0.0;
+    factor[EPHCOM_DERIVED_MOON][0]   = 1.0;
+    factor[EPHCOM_DERIVED_MOON][1]   = header->emrat / (1.0 + header->emrat);
+    factor[EPHCOM_DERIVED_MOON][2]   = 0.0;
+    factor[EPHCOM_DERIVED_GEOSUN][0] = -1.0;
+    factor[EPHCOM_DERIVED_GEOSUN][1] = 1.0 / (1.0 + header->emrat);
+    factor[EPHCOM_DERIVED_GEOSUN][2] = 1.0;
+
+    r = (double *)malloc(ncf * sizeof(double));
+    for (i=0; i<3*nsub*3*ncf; i++)
+        derived[i] = 0.0;
+    for (sub=0; sub<nsub; sub++) {
+        for (j=0; j<3; j++) {
+            series = base[j];
+            per = nsub / header->ipt[series][2];
+            subin = sub / per;
+            x0 = 2.0 * (sub - subin * per) / per - 1.0;
+            x1 = 2.0 * (sub - subin * per + 1) / per - 1.0;
+            for (k=0; k<3; k++) {  /* x, y, z */
+                src = &datablock[header->ipt[series][0] - 1 +
+                                 (3 * subin + k) * header->ipt[series][1]];
+                for (i=0; i<3; i++) {  /* Derived bodies */
+                    if (factor[i][j] == 0.0)
+                        continue;
+                    out = &derived[((i * nsub + sub) * 3 + k) * ncf];
+                    if (x0 == -1.0 && x1 == 1.0) {  /* Same grid: add as is */
+                        for (n=0; n<header->ipt[series][1]; n++)
+                            out[n] += factor[i][j] * src[n];
+                    }
+                    else {
+                        ephcom_cheby_restrict(header->ipt[series][1], src, x0, x1, ncf, r);
+                        for (n=0; n<ncf; n++)
+                            out[n] += factor[i][j] * r[n];
+                    }
                 }
             }
         }
+    }
+    free(r);
+
+    return(3 * nsub * 3 * ncf);
+}
+
+
+
 
+/*
+   ephcom_get_derived() - Position and velocity of a derived body
+   (EPHCOM_DERIVED_EARTH, _MOON or _GEOSUN; see ephcom_derive_block()) at
+   Julian Day jd, in km and km/day, as one series evaluation.  The
+   derived coefficients of the block in datablock are built the first
+   time they are needed and kept with the header (header->derived) for as
+   long as the same block stays in datablock.  Returns 0, or -1 if jd is
+   outside the ephemeris or the file's subinterval grids do not nest.
+*/
+int ephcom_get_derived(FILE *infp, struct ephcom_Header *header, double *datablock,
+                       int body, double jd, double *pv) {
+
+    int nsub;         /* Subintervals of the derived series */
+    int subinterval;
+    double subspan;
+    int ephcom_cheby(int maxcoeffs, double x, double span, double scale, double *y,
+                     int ncoords, int ncoeffs, double *pv);
+
+    if (body < 0 || body > 2 || ephcom_load_block(infp, header, jd, datablock) < 0)
+        return(-1);
+    if ((nsub = ephcom_derive_block(header, datablock, NULL)) < 0)
+        return(-1);
+    if (header->derived == NULL) {
+        header->derived = (double *)malloc(nsub * sizeof(double));
+        header->derivedjd = EPHCOM_MINJD;
+    }
+    if (header->derivedjd != datablock[0]) {
+        ephcom_derive_block(header, datablock, header->derived);
+        header->derivedjd = datablock[0];
     }
+    nsub /= 3 * 3 * header->maxcheby;
+
+    subspan = header->ss[2] / nsub;
+    subinterval = (int)((jd - datablock[0]) / subspan);
+    if (subinterval >= nsub) /* jd is the very end of the block */
+        subinterval = nsub - 1;
+    ephcom_cheby(header->maxcheby,
+                 2.0 * (jd - datablock[0] - subinterval * subspan) / subspan - 1.0,
+                 subspan, 1.0,
+                 &header->derived[(body * nsub + subinterval) * 3 * header->maxcheby],
+                 3, header->maxcheby, pv);
 
-    return(retval);
+    return(0);
 }
 
 
 
 
 /*
-   ephcom_cheby() - interpolate at a point using Chebyshev coefficients
+   ephcom_cheby() - interpolate at a point using Chebyshev coefficients,
+   with polynomial values kept between calls in one static scratch area
+   (so not from several threads at once; see ephcom_cheby_r()).
 */
 inline int ephcom_cheby(
     int maxcoeffs, /* Maximum number of Chebyshev components possible */
     double x,      /* Value of x over [-1,1] for Chebyshev interpolation */
     double span,   /* Span in time of subinterval, for velocity */
+    double scale,  /* Factor for results, e.g. 1/AU for AU from km */
     double *y,     /* Chebyshev coefficients */
     int ncoords,   /* Total number of coordinates to interpolate */
     int ncoeffs,   /* Number of Chebyshev coefficients per coordinate */
     double *pv     /* Array to hold position in 1st half, velocity in 2nd */
     ) {
 
+    static struct ephcom_ChebyScratch scratch; /* All 0: nothing computed yet */
+    int ephcom_cheby_r(int maxcoeffs, double x, double span, double scale, double *y,
+                       int ncoords, int ncoeffs, double *pv,
+                       struct ephcom_ChebyScratch *scratch);
+
+    return(ephcom_cheby_r(maxcoeffs, x, span, scale, y, ncoords, ncoeffs, pv, &scratch));
+}
+
+
+
+
+/*
+   ephcom_cheby_r() - ephcom_cheby() with the caller's scratch area, so
+   each thread can interpolate with its own.
+*/
+int ephcom_cheby_r(int maxcoeffs, double x, double span, double scale, double *y,
+                   int ncoords, int ncoeffs, double *pv,
+                   struct ephcom_ChebyScratch *scratch) {
+
     int i, j;
-    static double *pc, *vc; /* Position and velocity polynomial coefficients. */
-    static double lastx=2.0; /* x from last call; initialize to impossible value */
-    static int init=1; /* Need to initialize pc[] and vc[] */
+    double sum;
+    double vscale; /* Velocity factor: d/dt = (2/span) d/dx, times scale */
+    double *pc, *vc; /* Position and velocity polynomial coefficients. */
 
 /*
-   Allocate position and velocity Chebyshev coefficients.
+   Allocate position and velocity Chebyshev coefficients, and grow them
+   if a later caller (e.g. an SPK segment) needs more than the first.
 */
-    if (init) {
-        pc = (double *)malloc(maxcoeffs * sizeof(double));
-        vc = (double *)malloc(maxcoeffs * sizeof(double));
-        init = 0;
+    if (maxcoeffs > scratch->npc) {
+        scratch->pc = (double *)realloc(scratch->pc, maxcoeffs * sizeof(double));
+        scratch->vc = (double *)realloc(scratch->vc, maxcoeffs * sizeof(double));
+        scratch->npc = maxcoeffs;
+        scratch->lastn = 0;
     }
+    pc = scratch->pc;
+    vc = scratch->vc;
 /*
    This need only be called once for each Julian Date,
    saving a lot of time initializing polynomial coefficients.
 */
-    if (lastx != x) {
-        lastx = x;
+    if (scratch->lastx != x || scratch->lastn < maxcoeffs) {
+        scratch->lastx = x;
+        scratch->lastn = maxcoeffs;
    /*
       Initialize position polynomial coefficients
    */
@@ -1340,18 +3374,20 @@ inline int ephcom_cheby(
    Interpolate to get position for each component
 */
     for (i=0; i<ncoords; i++) { /* Once each for x, y, and z */
-        pv[i] = 0.0;
+        sum = 0.0;
         for (j=ncoeffs-1; j >= 0; j--) 
-            pv[i] += pc[j] * y[i*ncoeffs + j];
+            sum += pc[j] * y[i*ncoeffs + j];
+        pv[i] = sum * scale;
     }
 /*
    Interpolate velocity (first derivative)
 */
+    vscale = 2.0 * scale / span;
     for (i=0; i<ncoords; i++) {
-        pv[ncoords + i] = 0.0;
+        sum = 0.0;
         for (j=ncoeffs-1; j >= 0; j--) 
-            pv[ncoords + i] += vc[j] * y[i*ncoeffs + j];
-            pv[ncoords + i] *= 2.0 / span;
+            sum += vc[j] * y[i*ncoeffs + j];
+        pv[ncoords + i] = sum * vscale;
     }
 
     return(0);
@@ -1360,6 +3396,137 @@ inline int ephcom_cheby(
 
 
 
+/*
+   Chebyshev series arithmetic, for work done on the coefficients
+   themselves rather than on interpolated values.  A series is
+   c[0]*T[0](x) + ... + c[n-1]*T[n-1](x) over [-1,1], with c[0] carrying
+   full weight as in the ephemeris data blocks.
+*/
+
+/*
+   ephcom_cheby_eval() - value of an n-term series at x, by Clenshaw's
+   recurrence.
+*/
+double ephcom_cheby_eval(int n, double *c, double x) {
+
+    int k;
+    double b0, b1, b2; /* Clenshaw recurrence terms */
+
+    b1 = b2 = 0.0;
+    for (k=n-1; k>=1; k--) {
+        b0 = 2.0*x * b1 - b2 + c[k];
+        b2 = b1;
+        b1 = b0;
+    }
+    return(c[0] + x * b1 - b2);
+}
+
+
+
+
+/*
+   ephcom_cheby_fit() - n coefficients of the series through the values
+   f[j] at the n Chebyshev nodes x[j] = cos(pi*(j+1/2)/n).  The fit is
+   exact (to rounding) for a polynomial of degree less than n.
+*/
+void ephcom_cheby_fit(int n, double *f, double *c) {
+
+    int j, k;
+    double sum;
+
+    for (k=0; k<n; k++) {
+        sum = 0.0;
+        for (j=0; j<n; j++)
+            sum += f[j] * cos(M_PI * k * (j + 0.5) / n);
+        c[k] = (k == 0 ? 1.0 : 2.0) * sum / n;
+    }
+}
+
+
+
+
+/*
+   ephcom_cheby_deriv() - coefficients d[0..n-1] of d/dx of an n-term
+   series (d[n-1] is always 0).  d may not be c.  Multiply by 2/span for
+   the derivative with respect to time over a span.
+*/
+void ephcom_cheby_deriv(int n, double *c, double *d) {
+
+    int k;
+
+    d[n-1] = 0.0;
+    if (n < 2)
+        return;
+    d[n-2] = 2.0 * (n-1) * c[n-1];
+    for (k=n-2; k>=1; k--)
+        d[k-1] = d[k+1] + 2.0 * k * c[k];
+    d[0] *= 0.5;
+}
+
+
+
+
+/*
+   ephcom_cheby_product() - the n+m-1 coefficients p[] of the product of
+   an n-term series a[] and an m-term series b[], exactly, from
+   T[i](x) * T[j](x) = (T[i+j](x) + T[|i-j|](x)) / 2.
+*/
+void ephcom_cheby_product(int n, double *a, int m, double *b, double *p) {
+
+    int i, j;
+
+    for (i=0; i<n+m-1; i++)
+        p[i] = 0.0;
+    for (i=0; i<n; i++) {
+        for (j=0; j<m; j++) {
+            p[i+j] += 0.5 * a[i] * b[j];
+            p[i > j ? i-j : j-i] += 0.5 * a[i] * b[j];
+        }
+    }
+}
+
+
+
+
+/*
+   ephcom_cheby_restrict() - m coefficients r[] of the n-term series c[]
+   restricted to [x0,x1] within [-1,1] and mapped back onto [-1,1].  With
+   m >= n this is the same polynomial, to rounding.  r may not be c.
+*/
+void ephcom_cheby_restrict(int n, double *c, double x0, double x1,
+                           int m, double *r) {
+
+    int j;
+    double f[m]; /* Series values at the nodes of [x0,x1] */
+
+    for (j=0; j<m; j++)
+        f[j] = ephcom_cheby_eval(n, c,
+                  x0 + (x1 - x0) * 0.5 * (cos(M_PI * (j + 0.5) / m) + 1.0));
+    ephcom_cheby_fit(m, f, r);
+}
+
+
+
+
+/*
+   ephcom_cheby_range() - bounds lo <= f(x) <= hi of an n-term series
+   over all of [-1,1]: c[0] -/+ the sum of |c[1..n-1]|, as |T[k](x)| <= 1.
+*/
+void ephcom_cheby_range(int n, double *c, double *lo, double *hi) {
+
+    int k;
+    double sum;
+
+    sum = 0.0;
+    for (k=1; k<n; k++)
+        sum += fabs(c[k]);
+    *lo = c[0] - sum;
+    *hi = c[0] + sum;
+}
+
+
+
+
 /*
    ephcom_jd2cal() - convert Julian Day to calendar date and time.
 
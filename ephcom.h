@@ -4,9 +4,27 @@
 #define EPHCOM_VERSION	"1.0"
 
 #define EPHCOM_MAXLINE 128  /* Maximum # characters to allow in input line */
+#define EPHCOM_ASCIIBLOCK(ncoeff) (82 * (1 + ((ncoeff) + 2) / 3)) /* Bytes of an ASCII block */
 #define EPHCOM_MINJD -999999999.5
 #define EPHCOM_MAXJD  999999999.5
 
+#define EPHCOM_ZMAGIC "EPHCOMZ1" /* Compressed container directory tag */
+#define EPHCOM_ZRAW   0 /* Compressed block method: 8-byte big-endian values */
+#define EPHCOM_ZEXP   1 /* Compressed block method: exponent delta coding */
+#define EPHCOM_ZTZ    2 /* Compressed block method: range coded exponents, zero bytes dropped */
+#define EPHCOM_TMAGIC "EPHCOMT1" /* Body-major container directory tag */
+
+#define EPHCOM_SERVE_MAGIC  0x45504853 /* "EPHS": ephserve request tag */
+#define EPHCOM_SERVE_MAXN   4096  /* Most times in one ephserve request */
+#define EPHCOM_SERVE_HEADER 1 /* ephserve request: send the ephemeris header */
+#define EPHCOM_SERVE_COORDS 2 /* ephserve request: ephcom_get_coords() pv[][] */
+#define EPHCOM_SERVE_PLEPH  3 /* ephserve request: ephcom_pleph() of one body */
+
+#define EPHCOM_MAXREADERS 256 /* Most threads sharing one ephcom_Live or ephcom_Cache */
+
+#define EPHCOM_BIGENDIAN    0 /* Binary file byte order: network order, as written here */
+#define EPHCOM_LITTLEENDIAN 1 /* Binary file byte order: as written by Fortran on a PC */
+
 /*
    Objects for pleph() ntarget and ncenter parameters.
 */
@@ -26,13 +44,56 @@
 #define EPHCOM_NUTATION		14
 #define EPHCOM_LIBRATION	15
 #define EPHCOM_GEOMOON		16 /* Original Lunar Ephemeris coordinates */
-#define EPHCOM_NUMOBJECTS	16 /* Allocate memory for 16 solar sys objs */
+#define EPHCOM_USER		17 /* User-defined object, e.g. from an SPK file */
+#define EPHCOM_NUMOBJECTS	17 /* Allocate memory for 17 solar sys objs */
+
+/*
+   Derived bodies for ephcom_get_derived().
+*/
+#define EPHCOM_DERIVED_EARTH	0 /* Earth, relative to Solar System center */
+#define EPHCOM_DERIVED_MOON	1 /* Moon, relative to Solar System center */
+#define EPHCOM_DERIVED_GEOSUN	2 /* Sun, relative to Earth */
+
+/*
+   Searches for ephcom_find_events() (ephevent.c), and the events it finds.
+*/
+#define EPHCOM_SEARCH_RANGE	1 /* Closest and farthest approaches */
+#define EPHCOM_SEARCH_LONGITUDE	2 /* Conjunctions and oppositions */
+#define EPHCOM_EVENT_MINDIST	1
+#define EPHCOM_EVENT_MAXDIST	2
+#define EPHCOM_EVENT_CONJUNCTION	3
+#define EPHCOM_EVENT_OPPOSITION	4
 
 /*
    This structure holds all the information contained in a JPLEPH header.
    When an ASCII or binary header is read, this structure is populated.
    Fill out this structure before writing an ASCII or binary header, and
    before performing any interpolations.
+
+   ephcom_readbinary_header() tells from the header which byte order a
+   binary file was written in, and sets byteorder; a file written on a
+   little-endian machine by JPL's Fortran asc2eph can be read as it is.
+   ephcom_writebinary_header() and ephcom_writebinary_block() always write
+   EPHCOM_BIGENDIAN.
+
+   ephcom_readbinary_header() also accepts a compressed container written
+   by eph2ephz; it then allocates zoffset[], and ephcom_readbinary_block()
+   decompresses each block as it is read.  Free zoffset when done.
+   Likewise for a body-major container written by eph2epht, it allocates
+   toffset[], and ephcom_readbinary_block() gathers each block from the
+   series columns; ephcom_readt_series() reads one series alone.  Free
+   toffset when done.
+
+   The header readers set prefetch to 0.  Set it to the number of blocks
+   ephcom_get_coords() should read ahead once it sees a steady (forward,
+   backward or strided) walk through the file; the data block passed in
+   is then also reused without a re-read while it still covers the time.
+
+   ephcom_screen_approach() allocates bounds[] the first time it is
+   called, and keeps there the bounding boxes of the block it last
+   screened (see ephcom_block_bounds()).  Free bounds when done.  In the
+   same way ephcom_get_derived() allocates derived[], for the Earth, Moon
+   and geocentric Sun coefficients of the current block.
 */
 struct ephcom_Header {
     int ksize;         /* block size, in first line of ASCII header */
@@ -51,6 +112,44 @@ struct ephcom_Header {
     int ipt[12][3];    /* index pointers into Chebyshev coefficients */
     int lpt[3];        /* libration pointer in a block */
     int maxcheby;      /* maximum Chebyshev coefficients for a body */
+    int byteorder;     /* EPHCOM_BIGENDIAN or EPHCOM_LITTLEENDIAN binary file */
+    long long *zoffset; /* compressed container: file offset of each block
+                          (nblocks+1 entries); NULL for a plain binary file */
+    long long *toffset; /* body-major container: file offset of the block
+                          times and of each series column (14 entries, 0
+                          for a series not in the file); NULL otherwise */
+    int prefetch;      /* blocks to read ahead in ephcom_get_coords; 0 = off */
+    int lastblock;     /* last block ephcom_get_coords read (prefetch state) */
+    int stride;        /* last stride between blocks read (prefetch state) */
+    double *bounds;    /* subinterval bounding boxes of the screened block */
+    double boundsjd;   /* start JD of the block bounds[] is for */
+    double *derived;   /* derived body coefficients of the current block */
+    double derivedjd;  /* start JD of the block derived[] is for */
+};
+/*
+   Chebyshev polynomial values T[k](x) and T'[k](x) at one x, kept between
+   calls so that interpolating several bodies at the same time computes
+   them once.  ephcom_cheby() keeps one of these for itself; threads each
+   keep their own for ephcom_cheby_r().  Start with all members 0.
+*/
+struct ephcom_ChebyScratch {
+    double *pc, *vc;   /* T[k](x) and T'[k](x) */
+    int npc;           /* Terms allocated */
+    int lastn;         /* Terms computed for lastx */
+    double lastx;      /* x they were computed for */
+};
+/*
+   State of the adaptive binary range coder of compressed blocks (see
+   ephcom_zpack_block()): low, range, cache and cachesize while coding,
+   range and code while decoding, over buf[0..size-1].
+*/
+struct ephcom_RangeCoder {
+    unsigned long long low;
+    unsigned range, code;
+    unsigned char cache;
+    long long cachesize;
+    unsigned char *buf;
+    int pos, size;     /* Next byte of buf, and bytes in it */
 };
 /*
    This structure holds all interpolated positions of planets, Sun, and Moon
@@ -62,7 +161,8 @@ struct ephcom_Header {
               km, seconds, bary, et2[0], et2[1]
 
    Then call ephcom_get_coords() to get all coordinates, then call
-   ephcom_pleph() for each desired (ntarget,ncenter) combination.
+   ephcom_pleph() for each desired (ntarget,ncenter) combination, or
+   ephcom_pleph_all() for every body relative to one center at once.
    See testeph.c for an example.  Note that unlike JPL's PLEPH()
    subroutine, you cannot call ephcom_pleph() without first initializing
    the pv[] array in ephcom_get_coords().
@@ -82,5 +182,106 @@ struct ephcom_Coords {
     double pv[EPHCOM_NUMOBJECTS][6]; /* x, y, z Position & Velocity          */
                      /* pv[00..14][]: See Object numbers in #defines above */
                      /* pv[15][]: Geocentric Moon, from original lunar eph  */
-                     /* pv[16][]: User-defined object                       */
-};
\ No newline at end of file
+                     /* pv[16][]: User-defined object, see ephspk.c         */
+};
+/*
+   One event found by ephcom_find_events().
+*/
+struct ephcom_Event {
+    double jd;        /* Julian Day of the event */
+    int type;         /* EPHCOM_EVENT_MINDIST, ... */
+    double value;     /* Distance in km for approaches; angle between the
+                         two bodies in radians for conjunctions/oppositions */
+};
+/*
+   One type 2 or 3 (Chebyshev) segment of an SPK file, as indexed by
+   ephcom_spk_open() (ephspk.c).  Times are seconds past J2000 (TDB).
+*/
+struct ephcom_SpkSegment {
+    int target;        /* NAIF code of the body */
+    int center;        /* NAIF code of the body it is relative to */
+    int type;          /* SPK data type, 2 or 3 */
+    int index;         /* Position of the segment's summary in the file */
+    double et0, et1;   /* Time covered */
+    double init;       /* Start time of the first record */
+    double intlen;     /* Time covered by each record */
+    int rsize;         /* Doubles in each record */
+    int nrecords;      /* Records in the segment */
+    int ncoeff;        /* Chebyshev coefficients per coordinate */
+    long long start;   /* File offset of the first record */
+};
+/*
+   An open SPK file: the file mapped into memory, and its segment index,
+   sorted by target.
+*/
+struct ephcom_Spk {
+    unsigned char *map; /* The whole file */
+    long long size;     /* Bytes in the file */
+    int swap;           /* 1 if the file's byte order is not this machine's */
+    int nseg;           /* Segments indexed */
+    struct ephcom_SpkSegment *seg;
+    int maxcoeff;       /* Most Chebyshev coefficients in any segment */
+    int maxrsize;       /* Longest record in any segment */
+    double *record;     /* One record, byte-swapped from the file */
+};
+/*
+   Several binary ephemerides used as one, as opened by ephcom_set_open()
+   (ephset.c); e.g. DE440 for the modern era, DE441 around it, and files
+   fitted locally by ephfit.  Where files overlap, the one listed first
+   is used.  The time covered is a list of pieces, each from one file (or
+   a gap), and is cut into cells of equal length that each give the first
+   piece they meet, so finding the file for a time takes no search.
+
+   Each file keeps its own header and data block, so setting
+   header[i].prefetch keeps that file's current block resident just as
+   for a single file.
+*/
+struct ephcom_Set {
+    int nfiles;
+    FILE **fp;                     /* One per file, in the order given */
+    struct ephcom_Header *header;  /* One per file */
+    double **datablock;            /* One per file */
+    int npieces;
+    double *piecejd;   /* Start of each piece; piecejd[npieces] is the end */
+    int *piecefile;    /* File used for each piece, or -1 for a gap */
+    double jd0;        /* Start of the first cell, piecejd[0] */
+    double cell;       /* Days in each cell */
+    int ncells;
+    int *cellpiece;    /* First piece in each cell */
+};
+/*
+   A request to ephserve (ephserve.c) over its Unix domain socket, as sent
+   by the client functions in ephclient.c, followed by n pairs of doubles
+   et2[0], et2[1] for EPHCOM_SERVE_COORDS and EPHCOM_SERVE_PLEPH.  The
+   reply is an ephcom_ServeReply, then for EPHCOM_SERVE_HEADER one
+   ephcom_Header, for EPHCOM_SERVE_COORDS n arrays pv[EPHCOM_NUMOBJECTS][6],
+   and for EPHCOM_SERVE_PLEPH n arrays r[6].  Both ends are on the same
+   machine, so everything is in its own byte order.
+*/
+struct ephcom_ServeRequest {
+    int magic;        /* EPHCOM_SERVE_MAGIC */
+    int op;           /* EPHCOM_SERVE_HEADER, ... */
+    int n;            /* Times that follow, at most EPHCOM_SERVE_MAXN */
+    int ntarg, ncntr; /* Bodies for EPHCOM_SERVE_PLEPH, as for ephcom_pleph() */
+    int km, seconds;  /* Units, as in ephcom_Coords */
+};
+struct ephcom_ServeReply {
+    int status;       /* Times evaluated (0 for a header), or -1 */
+    int n;            /* Results that follow */
+};
+/*
+   A live ephemeris handle, whose file ephcom_live_reload() can replace
+   while other threads query it (ephlive.c).  Its members are private to
+   ephlive.c.
+*/
+struct ephcom_Live;
+/*
+   A cache of data blocks shared by all the threads reading one ephemeris
+   (ephcache.c).  Its members are private to ephcache.c.
+*/
+struct ephcom_Cache;
+/*
+   A binary ephemeris's parsed header and indexes, mapped from its sidecar
+   file (ephsidecar.c).  Its members are private to ephsidecar.c.
+*/
+struct ephcom_Sidecar;
@@ -0,0 +1,363 @@
+/*
+   ephevent.c - find conjunctions, oppositions and closest approaches
+                directly from the Chebyshev coefficients in the data blocks.
+
+         A data block is cut into pieces at every subinterval boundary of
+         the bodies involved, so each body is a single polynomial over each
+         piece.  On a piece, the relative position of two bodies is the
+         difference of their coefficient series, and the event function
+         (range times range rate, or the ecliptic-pole component of the
+         cross product of two directions) is formed from products of those
+         series, again as Chebyshev coefficients.  A piece whose event
+         function is bounded away from zero by its coefficients (|c[0]|
+         larger than the sum of the other |c[k]|) is skipped without
+         evaluating anything; otherwise its roots are bracketed on a
+         Chebyshev grid and refined by bisection.
+
+         ephcom_find_events() uses the data block passed in as a one-block
+         cache, as ephcom_lighttime() does.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ephcom.h"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define EPHEVENT_OBLIQUITY (84381.448 / 3600.0 * M_PI / 180.0) /* J2000, radians */
+#define EPHEVENT_MAXROOTS  64  /* Most roots taken from one piece */
+
+
+int ephcom_load_block(FILE *infp, struct ephcom_Header *header,
+                      double jd, double *datablock);
+double ephcom_cheby_eval(int n, double *c, double x);
+void ephcom_cheby_deriv(int n, double *c, double *d);
+void ephcom_cheby_product(int n, double *a, int m, double *b, double *p);
+void ephcom_cheby_restrict(int n, double *c, double x0, double x1,
+                           int m, double *r);
+void ephcom_cheby_range(int n, double *c, double *lo, double *hi);
+
+
+/*
+   ephevent_series() - series numbers (as in ipt[][]) a body is made of:
+   none for the Solar System Barycenter, EMBary and the geocentric Moon
+   for Earth and Moon, else the body's own series.  Returns how many.
+*/
+static int ephevent_series(int body, int *series) {
+
+    switch (body) {
+        case EPHCOM_SSBARY:
+            return(0);
+        case EPHCOM_EARTH:
+        case EPHCOM_MOON:
+            series[0] = 2;
+            series[1] = 9;
+            return(2);
+        case EPHCOM_EMBARY:
+            series[0] = 2;
+            return(1);
+        default:
+            series[0] = body - 1;
+            return(1);
+    }
+}
+
+
+
+
+/*
+   ephevent_restrict() - n coefficients per coordinate, in c[0..3n-1], of
+   series number series over the piece [a,b] (days from the start of the
+   block), which lies within one of its subintervals.
+*/
+static void ephevent_restrict(struct ephcom_Header *header, double *datablock,
+                              int series, double a, double b, int n, double *c) {
+
+    int i, j;
+    int ncf, nsub, subinterval;
+    double subspan, x0, x1;
+    double *coeff;
+
+    ncf = header->ipt[series][1];
+    nsub = header->ipt[series][2];
+    subspan = header->ss[2] / nsub;
+    subinterval = (int)(0.5 * (a + b) / subspan);
+    x0 = 2.0 * (a - subinterval * subspan) / subspan - 1.0;
+    x1 = 2.0 * (b - subinterval * subspan) / subspan - 1.0;
+    for (i=0; i<3; i++) {
+        coeff = &datablock[header->ipt[series][0] - 1 + (3 * subinterval + i) * ncf];
+        if (fabs(x0 + 1.0) < 1.0E-12 && fabs(x1 - 1.0) < 1.0E-12) { /* Whole subinterval */
+            for (j=0; j<n; j++)
+                c[i*n + j] = j < ncf ? coeff[j] : 0.0;
+        }
+        else
+            ephcom_cheby_restrict(ncf, coeff, x0, x1, n, &c[i*n]);
+    }
+}
+
+
+
+
+/*
+   ephevent_body() - barycentric position coefficients of a body (numbered
+   as for ephcom_pleph(), 1 to 13) over the piece [a,b] of the block, n per
+   coordinate in c[0..3n-1], km.  work[] holds 3n scratch values.
+*/
+static void ephevent_body(struct ephcom_Header *header, double *datablock,
+                          int body, double a, double b, int n,
+                          double *c, double *work) {
+
+    int j;
+    int series[2];
+
+    switch (ephevent_series(body, series)) {
+        case 0:
+            for (j=0; j<3*n; j++)
+                c[j] = 0.0;
+            break;
+        case 1:
+            ephevent_restrict(header, datablock, series[0], a, b, n, c);
+            break;
+        case 2: /* Earth = EMBary - Moon/(1+EMRAT); Moon = Earth + Moon */
+            ephevent_restrict(header, datablock, series[0], a, b, n, c);
+            ephevent_restrict(header, datablock, series[1], a, b, n, work);
+            for (j=0; j<3*n; j++) {
+                c[j] -= work[j] / (1.0 + header->emrat);
+                if (body == EPHCOM_MOON)
+                    c[j] += work[j];
+            }
+            break;
+    }
+}
+
+
+
+
+/*
+   ephevent_roots() - roots of an n-term series over [-1,1], in increasing
+   order, with rising[k] set if the series goes from negative to positive
+   there.  A root at x = 1 is left to the next piece.  Returns how many.
+*/
+static int ephevent_roots(int n, double *f, double *root, int *rising) {
+
+    int i, j, nroots, nsamp;
+    double lo, hi;  /* Bounds of the series, then the bisection bracket */
+    double xl, xr, xm, fl, fr, fm;  /* Grid step, and bisection midpoint */
+
+    ephcom_cheby_range(n, f, &lo, &hi);
+    if (lo > 0.0 || hi < 0.0) /* Cannot be zero anywhere in the piece */
+        return(0);
+
+    nroots = 0;
+    nsamp = 2 * n;  /* Grid in theta, denser than the most roots possible */
+    xl = -1.0;
+    fl = ephcom_cheby_eval(n, f, xl);
+    for (i=1; i<=nsamp && nroots < EPHEVENT_MAXROOTS; i++) {
+        xr = i == nsamp ? 1.0 : -cos(M_PI * i / nsamp);
+        fr = ephcom_cheby_eval(n, f, xr);
+        if (fl == 0.0) {  /* Exactly on a grid point */
+            root[nroots] = xl;
+            rising[nroots++] = fr > 0.0;
+        }
+        else if (fr != 0.0 && (fl < 0.0) != (fr < 0.0)) {
+            lo = xl;
+            hi = xr;
+            for (j=0; j<100 && hi - lo > 4.0E-16; j++) {
+                xm = 0.5 * (lo + hi);
+                fm = ephcom_cheby_eval(n, f, xm);
+                if ((fm < 0.0) == (fl < 0.0))
+                    lo = xm;
+                else
+                    hi = xm;
+            }
+            root[nroots] = 0.5 * (lo + hi);
+            rising[nroots++] = fl < 0.0;
+        }
+        xl = xr;
+        fl = fr;
+    }
+
+    return(nroots);
+}
+
+
+
+
+/*
+   ephcom_find_events() - find events between Julian Days jd0 and jd1.
+   Bodies are numbered as for ephcom_pleph(), 1 to 13.
+
+   search = EPHCOM_SEARCH_RANGE: closest (EPHCOM_EVENT_MINDIST) and
+      farthest (EPHCOM_EVENT_MAXDIST) approaches of nbody1 to ncntr, where
+      the range rate is zero; value is the distance in km.  nbody2 is
+      not used.
+
+   search = EPHCOM_SEARCH_LONGITUDE: conjunctions (EPHCOM_EVENT_CONJUNCTION)
+      and oppositions (EPHCOM_EVENT_OPPOSITION) in ecliptic longitude of
+      nbody1 and nbody2 as seen from ncntr (e.g. a planet and the Sun seen
+      from Earth), using the J2000 ecliptic; value is the angle between the
+      two directions in radians.
+
+   Up to maxevents events are stored in event[], in time order.  Returns
+   the number stored, or -1 if an argument is out of range, the bodies
+   are not distinct (nbody1 and ncntr; or all three for a longitude
+   search), a body is not in the file, or a data block can't be read.
+*/
+int ephcom_find_events(FILE *infp, struct ephcom_Header *header, double *datablock,
+                       int search, int nbody1, int nbody2, int ncntr,
+                       double jd0, double jd1, struct ephcom_Event *event,
+                       int maxevents) {
+
+    int i, j, k, n;
+    int nevents;
+    int blocknum, lastblock;
+    int nseries, series[6];   /* Series of all bodies in the search */
+    int body[3];              /* nbody1, nbody2, ncntr */
+    int nroots, rising[EPHEVENT_MAXROOTS];
+    double root[EPHEVENT_MAXROOTS];
+    double ua, ub, unext;     /* Piece bounds, as fractions of the block */
+    double a, b, jd;
+    double pole[3];           /* Ecliptic pole, equatorial coordinates */
+    double r1[3], r2[3], rr, r11, r22, p1, p2;
+    double *buf, *c1, *c2, *cc, *d, *prod, *f, *work;
+
+    if ((search != EPHCOM_SEARCH_RANGE && search != EPHCOM_SEARCH_LONGITUDE) ||
+        nbody1 < 1 || nbody1 > 13 || ncntr < 1 || ncntr > 13 ||
+        (search == EPHCOM_SEARCH_LONGITUDE && (nbody2 < 1 || nbody2 > 13)))
+        return(-1);
+    if (nbody1 == ncntr ||   /* No range, or no direction, to follow */
+        (search == EPHCOM_SEARCH_LONGITUDE && (nbody2 == ncntr || nbody2 == nbody1)))
+        return(-1);
+    body[0] = nbody1;
+    body[1] = search == EPHCOM_SEARCH_LONGITUDE ? nbody2 : EPHCOM_SSBARY;
+    body[2] = ncntr;
+    nseries = 0;
+    for (i=0; i<3; i++)
+        nseries += ephevent_series(body[i], &series[nseries]);
+    for (i=0; i<nseries; i++)
+        if (header->ipt[series[i]][1] <= 0 || header->ipt[series[i]][2] <= 0)
+            return(-1);
+
+    if (jd0 < header->ss[0]) jd0 = header->ss[0];
+    if (jd1 > header->ss[1]) jd1 = header->ss[1];
+    if (jd0 >= jd1)
+        return(0);
+
+    pole[0] = 0.0;
+    pole[1] = -sin(EPHEVENT_OBLIQUITY);
+    pole[2] =  cos(EPHEVENT_OBLIQUITY);
+/*
+   Every body is carried with n coefficients per coordinate, enough to
+   hold any of them; products have 2n-1.
+*/
+    n = header->maxcheby;
+    buf = (double *)malloc((5 * 3 * n + 2 * (2 * n)) * sizeof(double));
+    c1 = buf;
+    c2 = c1 + 3 * n;
+    cc = c2 + 3 * n;
+    d = cc + 3 * n;
+    work = d + 3 * n;
+    prod = work + 3 * n;
+    f = prod + 2 * n;
+
+    nevents = 0;
+    lastblock = (int)((jd1 - header->ss[0]) / header->ss[2]);
+    if (header->ss[0] + lastblock * header->ss[2] >= jd1)
+        lastblock--;
+    for (blocknum = (int)((jd0 - header->ss[0]) / header->ss[2]);
+         blocknum <= lastblock && nevents < maxevents; blocknum++) {
+        if (ephcom_load_block(infp, header, header->ss[0] + (blocknum + 0.5) * header->ss[2],
+                              datablock) != blocknum) {
+            free(buf);
+            return(-1);
+        }
+   /*
+      Walk the pieces of the block: from each boundary, step to the nearest
+      next subinterval boundary of any series involved.
+   */
+        for (ua=0.0; ua < 1.0 - 1.0E-12 && nevents < maxevents; ua=ub) {
+            ub = 1.0;
+            for (i=0; i<nseries; i++) {
+                k = header->ipt[series[i]][2];
+                unext = (floor(ua * k + 1.0E-9) + 1.0) / k;
+                if (unext < ub)
+                    ub = unext;
+            }
+            a = ua * header->ss[2];
+            b = ub * header->ss[2];
+            if (datablock[0] + b <= jd0 || datablock[0] + a >= jd1)
+                continue;
+
+            ephevent_body(header, datablock, body[0], a, b, n, c1, work);
+            ephevent_body(header, datablock, body[1], a, b, n, c2, work);
+            ephevent_body(header, datablock, body[2], a, b, n, cc, work);
+            for (j=0; j<3*n; j++) {
+                c1[j] -= cc[j];
+                c2[j] -= cc[j];
+            }
+            for (j=0; j<2*n-1; j++)
+                f[j] = 0.0;
+            if (search == EPHCOM_SEARCH_RANGE) {
+          /*
+             f = r . dr/dx, zero where the range rate is.
+          */
+                for (i=0; i<3; i++) {
+                    ephcom_cheby_deriv(n, &c1[i*n], &d[i*n]);
+                    ephcom_cheby_product(n, &c1[i*n], n, &d[i*n], prod);
+                    for (j=0; j<2*n-1; j++)
+                        f[j] += prod[j];
+                }
+            }
+            else {
+          /*
+             f = (r1 x r2) . pole, zero where the longitudes are equal or
+             opposite.
+          */
+                for (i=0; i<3; i++) {
+                    if (pole[i] == 0.0)
+                        continue;
+                    ephcom_cheby_product(n, &c1[((i+1)%3)*n], n, &c2[((i+2)%3)*n], prod);
+                    for (j=0; j<2*n-1; j++)
+                        f[j] += pole[i] * prod[j];
+                    ephcom_cheby_product(n, &c1[((i+2)%3)*n], n, &c2[((i+1)%3)*n], prod);
+                    for (j=0; j<2*n-1; j++)
+                        f[j] -= pole[i] * prod[j];
+                }
+            }
+
+            nroots = ephevent_roots(2*n-1, f, root, rising);
+            for (k=0; k<nroots && nevents < maxevents; k++) {
+                jd = datablock[0] + a + (b - a) * 0.5 * (root[k] + 1.0);
+                if (jd < jd0 || jd >= jd1)
+                    continue;
+                for (i=0; i<3; i++) {
+                    r1[i] = ephcom_cheby_eval(n, &c1[i*n], root[k]);
+                    r2[i] = ephcom_cheby_eval(n, &c2[i*n], root[k]);
+                }
+                event[nevents].jd = jd;
+                if (search == EPHCOM_SEARCH_RANGE) {
+                    event[nevents].type = rising[k] ? EPHCOM_EVENT_MINDIST : EPHCOM_EVENT_MAXDIST;
+                    event[nevents].value = sqrt(r1[0]*r1[0] + r1[1]*r1[1] + r1[2]*r1[2]);
+                }
+                else {
+                    rr  = r1[0]*r2[0] + r1[1]*r2[1] + r1[2]*r2[2];
+                    r11 = r1[0]*r1[0] + r1[1]*r1[1] + r1[2]*r1[2];
+                    r22 = r2[0]*r2[0] + r2[1]*r2[1] + r2[2]*r2[2];
+                    p1  = r1[0]*pole[0] + r1[1]*pole[1] + r1[2]*pole[2];
+                    p2  = r2[0]*pole[0] + r2[1]*pole[1] + r2[2]*pole[2];
+                    event[nevents].type = rr - p1 * p2 > 0.0 ?   /* In the ecliptic plane */
+                                          EPHCOM_EVENT_CONJUNCTION : EPHCOM_EVENT_OPPOSITION;
+                    rr /= sqrt(r11 * r22);
+                    event[nevents].value = acos(rr > 1.0 ? 1.0 : rr < -1.0 ? -1.0 : rr);
+                }
+                nevents++;
+            }
+        }
+    }
+    free(buf);
+
+    return(nevents);
+}
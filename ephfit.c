@@ -0,0 +1,464 @@
+/*
+   ephfit - program to fit Chebyshev coefficients to a trajectory given as
+            dense state samples, and write them as a JPL binary ephemeris.
+
+         Each line of the input holds one sample:
+
+            JD x y z [vx vy vz]
+
+         in km and km/day, in increasing order of JD; lines starting
+         with '#' are skipped.  Velocities, if given, are fitted along with
+         positions.
+
+         The trajectory goes into one of the ipt[][] series of an otherwise
+         empty ephemeris, so ephcom_readbinary_header(), ephcom_get_coords()
+         and ephcom_pleph() read it as any other body: series 1 (Mercury)
+         through 11 (Sun), except 3 (EMBary) and 10 (Moon), which
+         ephcom_get_coords() mixes into Earth and Moon.
+
+         The fitter tries 1, 2, 4, ... subintervals per block and, for
+         each, the fewest coefficients that keep every position sample
+         within the tolerance, and keeps the layout with the fewest
+         coefficients per block.  Blocks are least-squares fitted in
+         parallel threads.
+
+         Format:
+
+            ephfit samples-input binary-output series km-tolerance [block-days [threads]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <string.h>    //memset()
+#include <math.h>      //sqrt()
+#include <pthread.h>
+#include <unistd.h>    //sysconf()
+#include "ephcom.h"
+
+#define EPHFIT_MAXCOEFF 24   /* Most coefficients per coordinate tried */
+#define EPHFIT_MAXSUB   256  /* Most subintervals per block tried */
+/*
+   Coefficients needed so a block holds the first header record: titles,
+   constant names, ss[], NCON, AU, EMRAT, ipt[][], NUMDE and lpt[].
+*/
+#define EPHFIT_MINCOEFF ((3*84 + 400*6 + 3*8 + 4 + 2*8 + 36*4 + 4 + 3*4 + 7) / 8)
+
+
+int ephcom_writebinary_header(FILE *outfp, struct ephcom_Header *header);
+int ephcom_writebinary_block(FILE *outfp, struct ephcom_Header *header,
+                             int blocknum, double *datablock);
+double ephcom_cheby_eval(int n, double *c, double x);
+
+
+/*
+   Samples, and the layout being fitted, shared by all threads.
+*/
+struct ephfit_Job {
+    int nsamples;
+    double *jd;            /* Sample times */
+    double (*pv)[6];       /* Sample positions and velocities */
+    int havevel;           /* 1 if velocities were given */
+    double start, step;    /* First block start JD, and days per block */
+    int nblocks;
+    int nsub, ncf;         /* Layout being fitted */
+    double *coeff;         /* If not NULL, fitted blocks go here */
+    int nextblock;         /* Next block for a thread to take */
+    double maxerr;         /* Largest position error found, km */
+    int underdetermined;   /* Set if a subinterval has too few samples */
+    pthread_mutex_t lock;
+};
+
+
+/*
+   ephfit_lsq() - Least-squares solution of the m x n system a[][] c = b[][]
+   for 3 right-hand sides at once, by Householder QR.  a[] (row-major) and
+   b[] (3 columns per row) are overwritten.  Returns 0, or -1 if a is rank
+   deficient.
+*/
+static int ephfit_lsq(int m, int n, double *a, double *b, double c[3][EPHFIT_MAXCOEFF]) {
+
+    int i, j, k, r;
+    double norm, alpha, s;
+
+    for (k=0; k<n; k++) {
+        norm = 0.0;
+        for (i=k; i<m; i++)
+            norm += a[i*n + k] * a[i*n + k];
+        norm = sqrt(norm);
+        if (norm == 0.0)
+            return(-1);
+        alpha = a[k*n + k] > 0.0 ? -norm : norm;
+        a[k*n + k] -= alpha;          /* Householder vector in column k */
+        s = -alpha * a[k*n + k];      /* v.v / 2 */
+        for (j=k+1; j<n; j++) {
+            norm = 0.0;
+            for (i=k; i<m; i++)
+                norm += a[i*n + k] * a[i*n + j];
+            norm /= s;
+            for (i=k; i<m; i++)
+                a[i*n + j] -= norm * a[i*n + k];
+        }
+        for (r=0; r<3; r++) {
+            norm = 0.0;
+            for (i=k; i<m; i++)
+                norm += a[i*n + k] * b[i*3 + r];
+            norm /= s;
+            for (i=k; i<m; i++)
+                b[i*3 + r] -= norm * a[i*n + k];
+        }
+        a[k*n + k] = alpha;           /* R diagonal */
+    }
+    for (r=0; r<3; r++) {
+        for (k=n-1; k>=0; k--) {
+            s = b[k*3 + r];
+            for (j=k+1; j<n; j++)
+                s -= a[k*n + j] * c[r][j];
+            c[r][k] = s / a[k*n + k];
+        }
+    }
+
+    return(0);
+}
+
+
+
+
+/*
+   ephfit_block() - Fit block blocknum of job with its current layout.
+   Puts the block (start and end JD, then the coefficients of each
+   subinterval, x then y then z) in block[] if it is not NULL.  Returns
+   the largest position error in km, or -1.0 if a subinterval has too few
+   samples to fit.
+*/
+static double ephfit_block(struct ephfit_Job *job, int blocknum, double *block) {
+
+    int i, j, k, m, n, sub;
+    int first, last;           /* Samples in the subinterval */
+    double t0, subspan, x, w, err, maxerr;
+    double *a, *b;
+    double c[3][EPHFIT_MAXCOEFF];
+    double tk[EPHFIT_MAXCOEFF], dk[EPHFIT_MAXCOEFF]; /* T[k](x), T'[k](x) */
+
+    n = job->ncf;
+    subspan = job->step / job->nsub;
+    maxerr = 0.0;
+    if (block != NULL) {
+        block[0] = job->start + blocknum * job->step;
+        block[1] = block[0] + job->step;
+    }
+    for (sub=0; sub<job->nsub; sub++) {
+        t0 = job->start + blocknum * job->step + sub * subspan;
+   /*
+      Samples from t0 to t0 + subspan, both ends included.
+   */
+        for (i=0, j=job->nsamples; i<j; ) {
+            k = (i + j) / 2;
+            if (job->jd[k] < t0 - 1.0E-9) i = k + 1; else j = k;
+        }
+        first = i;
+        for (last=first; last < job->nsamples && job->jd[last] <= t0 + subspan + 1.0E-9; last++)
+            ;
+        m = (last - first) * (job->havevel ? 2 : 1);
+        if (m < n + 1)
+            return(-1.0);
+   /*
+      One row per position, and one per velocity, scaled by subspan/(2n)
+      from d/dx to km: a velocity error that size would move the position
+      by about the same amount over a fraction of the subinterval.
+   */
+        a = (double *)malloc(m * n * sizeof(double));
+        b = (double *)malloc(m * 3 * sizeof(double));
+        w = 0.5 * subspan / n;
+        for (i=first, j=0; i<last; i++) {
+            x = 2.0 * (job->jd[i] - t0) / subspan - 1.0;
+            tk[0] = 1.0;
+            dk[0] = 0.0;
+            if (n > 1) {
+                tk[1] = x;
+                dk[1] = 1.0;
+            }
+            for (k=2; k<n; k++) {
+                tk[k] = 2.0*x * tk[k-1] - tk[k-2];
+                dk[k] = 2.0*x * dk[k-1] + 2.0 * tk[k-1] - dk[k-2];
+            }
+            for (k=0; k<n; k++)
+                a[j*n + k] = tk[k];
+            for (k=0; k<3; k++)
+                b[j*3 + k] = job->pv[i][k];
+            j++;
+            if (job->havevel) {
+                for (k=0; k<n; k++)
+                    a[j*n + k] = dk[k] * 2.0 / subspan * w;
+                for (k=0; k<3; k++)
+                    b[j*3 + k] = job->pv[i][3 + k] * w;
+                j++;
+            }
+        }
+        k = ephfit_lsq(m, n, a, b, c);
+        free(a);
+        free(b);
+        if (k < 0)
+            return(-1.0);
+   /*
+      Position error at every sample.
+   */
+        for (i=first; i<last; i++) {
+            x = 2.0 * (job->jd[i] - t0) / subspan - 1.0;
+            err = 0.0;
+            for (k=0; k<3; k++) {
+                w = ephcom_cheby_eval(n, c[k], x) - job->pv[i][k];
+                err += w * w;
+            }
+            if (err > maxerr)
+                maxerr = err;
+        }
+        if (block != NULL)
+            for (k=0; k<3; k++)
+                memcpy(&block[2 + (3 * sub + k) * n], c[k], n * sizeof(double));
+    }
+
+    return(sqrt(maxerr));
+}
+
+
+
+
+/*
+   ephfit_worker() - Thread body: take blocks one at a time and fit them.
+*/
+static void *ephfit_worker(void *arg) {
+
+    struct ephfit_Job *job = arg;
+    int blocknum;
+    double err;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        blocknum = job->underdetermined ? job->nblocks : job->nextblock++;
+        pthread_mutex_unlock(&job->lock);
+        if (blocknum >= job->nblocks)
+            break;
+        err = ephfit_block(job, blocknum, job->coeff == NULL ? NULL :
+                           &job->coeff[(long)blocknum * (2 + 3 * job->nsub * job->ncf)]);
+        pthread_mutex_lock(&job->lock);
+        if (err < 0.0)
+            job->underdetermined = 1;
+        else if (err > job->maxerr)
+            job->maxerr = err;
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    return(NULL);
+}
+
+
+
+
+/*
+   ephfit_run() - Fit all blocks of job with nsub subintervals of ncf
+   coefficients, in nthreads threads.  Returns the largest position error
+   in km, or -1.0 if there are too few samples for the layout.
+*/
+static double ephfit_run(struct ephfit_Job *job, int nsub, int ncf, int nthreads) {
+
+    int i;
+    pthread_t thread[64];
+
+    job->nsub = nsub;
+    job->ncf = ncf;
+    job->nextblock = 0;
+    job->maxerr = 0.0;
+    job->underdetermined = 0;
+    for (i=1; i<nthreads; i++)
+        if (pthread_create(&thread[i], NULL, ephfit_worker, job) != 0)
+            break;
+    nthreads = i;
+    ephfit_worker(job);     /* This thread works too */
+    for (i=1; i<nthreads; i++)
+        pthread_join(thread[i], NULL);
+
+    return(job->underdetermined ? -1.0 : job->maxerr);
+}
+
+
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1;
+    struct ephfit_Job job;
+    double *datablock;
+    double tol;            /* Position tolerance, km */
+    double err;
+    char line[EPHCOM_MAXLINE * 4];
+    int series;            /* ipt[][] series to hold the trajectory, 1..11 */
+    int nthreads;
+    int nalloc, nvals;
+    int nsub, ncf, bestsub, bestcf, nused;
+    int i, blocknum;
+    FILE *infp, *outfp;
+
+    if (argc < 5) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s samples-input binary-output series km-tolerance [block-days [threads]]\n\n",
+           argv[0]);
+        exit(1);
+    }
+
+    series = atoi(argv[3]);
+    if (series < 1 || series > 11 || series == 3 || series == 10) {
+        fprintf(stderr,"\nERROR: series must be 1 to 11, but not 3 (EMBary) or 10 (Moon).\n\n");
+        exit(1);
+    }
+    tol = atof(argv[4]);
+    job.step = argc > 5 ? atof(argv[5]) : 32.0;
+    nthreads = argc > 6 ? atoi(argv[6]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > 64) nthreads = 64;
+    if (tol <= 0.0 || job.step <= 0.0) {
+        fprintf(stderr,"\nERROR: tolerance and block length must be positive.\n\n");
+        exit(1);
+    }
+
+    if ((infp = fopen(argv[1],"r")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+
+    if ((outfp = fopen(argv[2],"r")) == NULL) {    //先用只读方式打开，判断文件是否存在
+        if ((outfp = fopen(argv[2],"wb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[2]);
+            exit(1);
+        }
+    }
+    else {
+        fprintf(stderr,"\nERROR: Output ephemeris file %s already exists.\n\n", argv[2]);
+        exit(1);
+    }
+/*
+   Read the samples.
+*/
+    job.nsamples = 0;
+    job.havevel = 1;
+    job.jd = NULL;
+    job.pv = NULL;
+    nalloc = 0;
+    while (fgets(line, sizeof(line), infp) != NULL) {
+        if (line[0] == '#')
+            continue;
+        if (job.nsamples == nalloc) {
+            nalloc = nalloc ? 2 * nalloc : 4096;
+            job.jd = (double *)realloc(job.jd, nalloc * sizeof(double));
+            job.pv = (double (*)[6])realloc(job.pv, nalloc * sizeof(double[6]));
+        }
+        nvals = sscanf(line, "%lf %lf %lf %lf %lf %lf %lf", &job.jd[job.nsamples],
+                       &job.pv[job.nsamples][0], &job.pv[job.nsamples][1], &job.pv[job.nsamples][2],
+                       &job.pv[job.nsamples][3], &job.pv[job.nsamples][4], &job.pv[job.nsamples][5]);
+        if (nvals < 4)
+            continue;
+        if (nvals < 7)
+            job.havevel = 0;
+        if (job.nsamples > 0 && job.jd[job.nsamples] <= job.jd[job.nsamples - 1]) {
+            fprintf(stderr,"\nERROR: samples are not in increasing order of JD at JD %.9f.\n\n",
+                    job.jd[job.nsamples]);
+            exit(1);
+        }
+        job.nsamples++;
+    }
+    fclose(infp);
+    if (job.nsamples < 2) {
+        fprintf(stderr,"\nERROR: %s has fewer than 2 samples.\n\n", argv[1]);
+        exit(1);
+    }
+    job.start = job.jd[0];
+    job.nblocks = (int)((job.jd[job.nsamples - 1] - job.start) / job.step + 1.0E-9);
+    if (job.nblocks < 1) {
+        fprintf(stderr,"\nERROR: samples span less than one %g-day block.\n\n", job.step);
+        exit(1);
+    }
+    job.coeff = NULL;
+    pthread_mutex_init(&job.lock, NULL);
+/*
+   Find the layout with the fewest coefficients per block.
+*/
+    bestsub = bestcf = 0;
+    for (nsub=1; nsub<=EPHFIT_MAXSUB; nsub*=2) {
+        if (bestsub > 0 && 3 * nsub >= bestsub * bestcf)
+            break;   /* Can't beat the best, even with 3 coefficients */
+        for (ncf=3; ncf<=EPHFIT_MAXCOEFF; ncf++) {
+            if (bestsub > 0 && nsub * ncf >= bestsub * bestcf)
+                break;
+            err = ephfit_run(&job, nsub, ncf, nthreads);
+            if (err < 0.0)    /* Too few samples, now and with more coefficients */
+                break;
+            if (err <= tol) {
+                bestsub = nsub;
+                bestcf = ncf;
+                break;
+            }
+        }
+    }
+    if (bestsub == 0) {
+        fprintf(stderr,"\nERROR: no layout up to %d subintervals of %d coefficients is within %g km.\n",
+                EPHFIT_MAXSUB, EPHFIT_MAXCOEFF, tol);
+        fprintf(stderr,"       Give more samples, a shorter block or a larger tolerance.\n\n");
+        exit(1);
+    }
+/*
+   Fit again keeping the coefficients, and lay out the ephemeris: the
+   series ends the block, padded in front when needed so the block is
+   long enough to hold the header record.  Every other series is empty.
+*/
+    nused = 3 * bestsub * bestcf;
+    job.coeff = (double *)malloc((long)job.nblocks * (2 + nused) * sizeof(double));
+    err = ephfit_run(&job, bestsub, bestcf, nthreads);
+
+    memset(&header1, 0, sizeof(header1));
+    header1.ncoeff = 2 + nused < EPHFIT_MINCOEFF ? EPHFIT_MINCOEFF : 2 + nused;
+    header1.ksize = 2 * header1.ncoeff;
+    header1.ss[0] = job.start;
+    header1.ss[1] = job.start + job.nblocks * job.step;
+    header1.ss[2] = job.step;
+    for (i=0; i<12; i++)
+        header1.ipt[i][0] = header1.ncoeff + 1;
+    header1.ipt[series-1][0] = header1.ncoeff - nused + 1;
+    header1.ipt[series-1][1] = bestcf;
+    header1.ipt[series-1][2] = bestsub;
+    header1.lpt[0] = header1.ncoeff + 1;
+    header1.maxcheby = bestcf;
+    header1.au = 149597870.700;
+    header1.emrat = 81.3005690741906200;
+    header1.clight = 299792.458;
+    header1.ncon = header1.nval = 3;
+    strcpy(header1.cnam[0], "AU    ");
+    strcpy(header1.cnam[1], "EMRAT ");
+    strcpy(header1.cnam[2], "CLIGHT");
+    header1.cval[0] = header1.au;
+    header1.cval[1] = header1.emrat;
+    header1.cval[2] = header1.clight;
+
+    datablock = (double *)malloc(header1.ncoeff * sizeof(double));
+    for (i=0; i<header1.ncoeff; i++)
+        datablock[i] = 0.0;
+    for (blocknum=0; blocknum<job.nblocks; blocknum++) {
+        memcpy(datablock, &job.coeff[(long)blocknum * (2 + nused)], 2 * sizeof(double));
+        memcpy(&datablock[header1.ipt[series-1][0] - 1],
+               &job.coeff[(long)blocknum * (2 + nused) + 2], nused * sizeof(double));
+        ephcom_writebinary_block(outfp, &header1, blocknum, datablock);
+    }
+    ephcom_writebinary_header(outfp, &header1);
+    fclose(outfp);
+
+    printf("Fitted %d samples (%s) with %d threads.\n", job.nsamples,
+           job.havevel ? "positions and velocities" : "positions", nthreads);
+    printf("Series %d: %d subintervals of %d coefficients per %g-day block; ",
+           series, bestsub, bestcf, job.step);
+    printf("largest position error %.6E km.\n", err);
+    printf("\nWrote 2 header blocks + %d data blocks, JD %.9f to %.9f.\n\n",
+           job.nblocks, header1.ss[0], header1.ss[1]);
+    if (job.start + job.nblocks * job.step < job.jd[job.nsamples - 1])
+        printf("Samples after JD %.9f, short of a whole block, were not used.\n\n",
+               header1.ss[1]);
+
+    return 0;
+}
@@ -0,0 +1,455 @@
+/*
+   ephlive.c - an ephemeris handle whose file can be replaced while
+               threads are using it, e.g. when a new DE release or an
+               extended local ephemeris arrives, without restarting.
+
+         The handle points to the current version: an open file and its
+         header.  ephcom_live_reload() opens the new file and swaps the
+         pointer in one atomic step, so a query that started before the
+         swap finishes on the old version and every query after it sees
+         the new one.  Old versions are freed by epoch-based reclamation:
+
+            - The handle has a global epoch, which every reload advances.
+            - A reader thread, for the length of one query, publishes the
+              epoch it saw in its own slot (0 when not in a query).
+            - A version replaced in epoch E is freed once no slot holds
+              an epoch of E or less, i.e. once every query that could
+              have seen it has finished.
+
+         Readers take no lock: a query whose block is cached is a few
+         atomic stores and loads besides the interpolation.  Reloads take
+         a mutex among themselves only.
+
+         The data blocks of each version are kept in one cache shared by
+         all readers (see ephcache.c), of the size given when the handle
+         is opened; each reader has its own Chebyshev scratch area (see
+         ephcom_cheby_r()).
+
+         Needs POSIX threads and pread(), and a C11 compiler for atomics.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "ephcom.h"
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_byteorder(unsigned char *fixed);
+double ephcom_getdouble(unsigned char *ch, int byteorder);
+int ephcom_getint(unsigned char *ch, int byteorder);
+int ephcom_nextcoeff(struct ephcom_Header *header);
+int ephcom_series_extent(struct ephcom_Header *header, int series, int *first);
+struct ephcom_Cache *ephcom_cache_open(FILE *infp, struct ephcom_Header *header,
+                                       long long budget);
+void ephcom_cache_close(struct ephcom_Cache *cache);
+double *ephcom_cache_acquire(struct ephcom_Cache *cache, int reader, int blocknum);
+void ephcom_cache_release(struct ephcom_Cache *cache, int reader);
+int ephcom_interp_coords_r(struct ephcom_Header *header, struct ephcom_Coords *coords,
+                           double *datablock, struct ephcom_ChebyScratch *scratch);
+
+
+/*
+   One version of the ephemeris.
+*/
+struct ephlive_Version {
+    FILE *fp;
+    struct ephcom_Header header;
+    struct ephcom_Cache *cache;    /* Its data blocks */
+    unsigned long long serial;     /* 1 for the first file, then 2, ... */
+    unsigned long long retired;    /* Epoch it was replaced in */
+    struct ephlive_Version *next;  /* Next version waiting to be freed */
+};
+
+/*
+   One reader thread's slot, alone on its cache line(s): the alignment
+   makes every slot start a line and round up to whole lines.
+*/
+struct ephlive_Reader {
+    _Alignas(64) atomic_ullong epoch; /* Epoch of the query under way, or 0 */
+    atomic_int used;               /* 1 while a thread has the slot */
+    struct ephcom_ChebyScratch scratch;
+};
+
+struct ephcom_Live {
+    _Atomic(struct ephlive_Version *) current;
+    atomic_ullong epoch;           /* Starts at 1, so 0 can mean "idle" */
+    pthread_mutex_t writer;        /* Held by ephcom_live_reload() */
+    struct ephlive_Version *retired; /* Versions not yet freed */
+    unsigned long long serial;     /* Serial of the latest version */
+    long long cachebytes;          /* Block cache budget of each version */
+    struct ephlive_Reader reader[EPHCOM_MAXREADERS];
+};
+
+
+/*
+   ephlive_check() - Whether the file open on fp is a whole binary
+   ephemeris: a JPL title, a sensible SS, NCON and IPT/LPT, and every data
+   block (or, for a compressed or body-major container, its directory and
+   columns) within the file.  ephcom_readbinary_header() exits on a file
+   that fails these, which a reload must not do to a running program, so
+   they are checked first.  Returns 0, or -1 with a message on stderr.
+*/
+static int ephlive_check(FILE *fp, char *filename) {
+
+    unsigned char fixed[204];  /* SS through LPT, as in the file */
+    unsigned char tag[16];     /* Container magic, then nblocks */
+    unsigned char ch[8];
+    char title[4];
+    struct ephcom_Header h;    /* Just SS, NCON, IPT and LPT */
+    struct stat sb;
+    long long size, end, offset, last;
+    int i, j, order, nblocks, first, n;
+
+    if (fstat(fileno(fp), &sb) != 0)
+        goto bad;
+    size = sb.st_size;
+    rewind(fp);
+    if (fread(title, 1, 4, fp) != 4 || strncmp(title, "JPL ", 4) != 0 ||
+        fseek(fp, 3 * 84 + 400 * 6, SEEK_SET) != 0 ||
+        fread(fixed, 1, sizeof(fixed), fp) != sizeof(fixed))
+        goto bad;
+    order = ephcom_byteorder(fixed);
+    for (i=0; i<3; i++)
+        h.ss[i] = ephcom_getdouble(&fixed[8*i], order);
+    h.ncon = ephcom_getint(&fixed[24], order);
+    for (i=0; i<12; i++)
+        for (j=0; j<3; j++)
+            h.ipt[i][j] = ephcom_getint(&fixed[44 + 4*(3*i + j)], order);
+    for (i=0; i<3; i++)
+        h.lpt[i] = ephcom_getint(&fixed[192 + 4*i], order);
+    for (i=0; i<13; i++) {  /* Keep ephcom_nextcoeff() from overflowing */
+        n = i < 12 ? h.ipt[i][0] : h.lpt[0];
+        if (n < 0 || n > 100000 ||
+            (i < 12 ? h.ipt[i][1] : h.lpt[1]) * (long long)(i < 12 ? h.ipt[i][2] : h.lpt[2]) > 100000)
+            goto bad;
+    }
+    h.ncoeff = ephcom_nextcoeff(&h) - 1;
+    if (!(h.ss[2] > 0.0 && h.ss[1] > h.ss[0] && (h.ss[1] - h.ss[0]) / h.ss[2] < 1.0E7) ||
+        h.ncon < 0 || h.ncon > 400 || h.ncon > h.ncoeff || h.ncoeff > 1000000)
+        goto bad;
+    nblocks = (int)((h.ss[1] - h.ss[0]) / h.ss[2] + 0.5);
+/*
+   Data blocks follow the two header records, unless the third record
+   starts with a container's tag.
+*/
+    end = (nblocks + 2LL) * h.ncoeff * 8;
+    if (size >= 2LL * h.ncoeff * 8 + 16) {
+        fseek(fp, 2L * h.ncoeff * 8, SEEK_SET);
+        if (fread(tag, 1, 16, fp) != 16)
+            goto bad;
+        if (memcmp(tag, EPHCOM_ZMAGIC, 8) == 0) {
+            if (ephcom_getint(&tag[8], EPHCOM_BIGENDIAN) != nblocks)
+                goto bad;
+            end = 2LL * h.ncoeff * 8 + 16 + 8LL * (nblocks + 1);
+            for (last=0, i=0; i<=nblocks; i++) {
+                if (fread(ch, 1, 8, fp) != 8)
+                    goto bad;
+                for (offset=0, j=0; j<8; j++)
+                    offset = (offset << 8) | ch[j];
+                if (offset < end || offset <= last)
+                    goto bad;
+                last = offset;
+            }
+            end = last;
+        }
+        else if (memcmp(tag, EPHCOM_TMAGIC, 8) == 0) {
+            if (ephcom_getint(&tag[8], EPHCOM_BIGENDIAN) != nblocks)
+                goto bad;
+            end = 2LL * h.ncoeff * 8 + 16;
+            for (i=-1; i<=12; i++) {
+                n = ephcom_series_extent(&h, i, &first);
+                end += (long long)nblocks * n * 8;
+            }
+        }
+    }
+    if (end > size)
+        goto bad;
+
+    return(0);
+
+bad:
+    fprintf(stderr,"\nERROR: %s is not a complete binary JPL ephemeris.\n\n", filename);
+    return(-1);
+}
+
+
+/*
+   ephlive_open() - Open filename as a new version, with a block cache of
+   cachebytes.  Returns NULL (with a message on stderr) if it can't be
+   opened, fails ephlive_check(), or there is no memory for it.
+*/
+static struct ephlive_Version *ephlive_open(char *filename, long long cachebytes) {
+
+    struct ephlive_Version *v;
+
+    if ((v = (struct ephlive_Version *)calloc(1, sizeof(struct ephlive_Version))) == NULL) {
+        fprintf(stderr,"\nERROR: No memory to open %s.\n\n", filename);
+        return(NULL);
+    }
+    if ((v->fp = fopen(filename, "rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", filename);
+        free(v);
+        return(NULL);
+    }
+    if (ephlive_check(v->fp, filename) != 0) {
+        fclose(v->fp);
+        free(v);
+        return(NULL);
+    }
+    ephcom_readbinary_header(v->fp, &v->header);
+    if ((v->cache = ephcom_cache_open(v->fp, &v->header, cachebytes)) == NULL) {
+        fprintf(stderr,"\nERROR: No memory to open %s.\n\n", filename);
+        fclose(v->fp);
+        free(v->header.zoffset);
+        free(v->header.toffset);
+        free(v);
+        return(NULL);
+    }
+
+    return(v);
+}
+
+
+/*
+   ephlive_free() - Close a version and free everything it holds.
+*/
+static void ephlive_free(struct ephlive_Version *v) {
+
+    ephcom_cache_close(v->cache);
+    fclose(v->fp);
+    free(v->header.zoffset);
+    free(v->header.toffset);
+    free(v->header.bounds);
+    free(v->header.derived);
+    free(v);
+}
+
+
+/*
+   ephlive_collect() - Free every retired version that no query can still
+   be using.  Called with live->writer held.
+*/
+static void ephlive_collect(struct ephcom_Live *live) {
+
+    int i;
+    unsigned long long e;
+    struct ephlive_Version **link, *v;
+
+    for (link=&live->retired; (v = *link) != NULL; ) {
+        for (i=0; i<EPHCOM_MAXREADERS; i++) {
+            e = atomic_load(&live->reader[i].epoch);
+            if (e != 0 && e <= v->retired)
+                break;
+        }
+        if (i < EPHCOM_MAXREADERS) {
+            link = &v->next;   /* Still in use; try again next time */
+            continue;
+        }
+        *link = v->next;
+        ephlive_free(v);
+    }
+}
+
+
+
+
+/*
+   ephcom_live_open() - Open binary ephemeris filename as a live handle,
+   keeping up to cachebytes of its data blocks in memory (and as much of
+   every file it is reloaded with).  Returns the handle, or NULL (with a
+   message on stderr) if the file can't be opened or there is no memory.
+   The handle is allocated on a 64-byte boundary, for its reader slots.
+*/
+struct ephcom_Live *ephcom_live_open(char *filename, long long cachebytes) {
+
+    struct ephcom_Live *live;
+    struct ephlive_Version *v;
+    int i;
+
+    if ((v = ephlive_open(filename, cachebytes)) == NULL)
+        return(NULL);
+    if (posix_memalign((void **)&live, 64, sizeof(struct ephcom_Live)) != 0) {
+        fprintf(stderr,"\nERROR: No memory to open %s.\n\n", filename);
+        ephlive_free(v);
+        return(NULL);
+    }
+    memset(live, 0, sizeof(struct ephcom_Live));
+    live->cachebytes = cachebytes;
+    live->serial = v->serial = 1;
+    atomic_init(&live->current, v);
+    atomic_init(&live->epoch, 1);
+    for (i=0; i<EPHCOM_MAXREADERS; i++) {
+        atomic_init(&live->reader[i].epoch, 0);
+        atomic_init(&live->reader[i].used, 0);
+    }
+    pthread_mutex_init(&live->writer, NULL);
+
+    return(live);
+}
+
+
+
+
+/*
+   ephcom_live_reload() - Replace the ephemeris behind live with binary
+   file filename.  Queries already under way finish on the old file,
+   which is closed once the last of them is done (at this or a later
+   reload, or at ephcom_live_close()).  Returns 0, or -1 (with a message
+   on stderr, and the old file still in use) if filename can't be opened
+   or is not a complete binary ephemeris.
+*/
+int ephcom_live_reload(struct ephcom_Live *live, char *filename) {
+
+    struct ephlive_Version *v, *old;
+
+    if ((v = ephlive_open(filename, live->cachebytes)) == NULL)
+        return(-1);
+    pthread_mutex_lock(&live->writer);
+    v->serial = ++live->serial;
+    old = atomic_exchange(&live->current, v);
+    old->retired = atomic_fetch_add(&live->epoch, 1);
+    old->next = live->retired;
+    live->retired = old;
+    ephlive_collect(live);
+    pthread_mutex_unlock(&live->writer);
+
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_live_close() - Close every version of the ephemeris and free the
+   handle.  No thread may be using it.
+*/
+void ephcom_live_close(struct ephcom_Live *live) {
+
+    struct ephlive_Version *v;
+    int i;
+
+    while ((v = live->retired) != NULL) {
+        live->retired = v->next;
+        ephlive_free(v);
+    }
+    ephlive_free(atomic_load(&live->current));
+    for (i=0; i<EPHCOM_MAXREADERS; i++) {
+        free(live->reader[i].scratch.pc);
+        free(live->reader[i].scratch.vc);
+    }
+    pthread_mutex_destroy(&live->writer);
+    free(live);
+}
+
+
+
+
+/*
+   ephcom_live_join() - Take a reader slot for the calling thread, to pass
+   to the other ephcom_live_ functions.  Returns it, or -1 if all
+   EPHCOM_MAXREADERS slots are taken.
+*/
+int ephcom_live_join(struct ephcom_Live *live) {
+
+    int i, idle;
+
+    for (i=0; i<EPHCOM_MAXREADERS; i++) {
+        idle = 0;
+        if (atomic_compare_exchange_strong(&live->reader[i].used, &idle, 1))
+            return(i);
+    }
+    return(-1);
+}
+
+
+
+
+/*
+   ephcom_live_leave() - Give up a reader slot.
+*/
+void ephcom_live_leave(struct ephcom_Live *live, int reader) {
+
+    atomic_store(&live->reader[reader].used, 0);
+}
+
+
+
+
+/*
+   ephcom_live_header() - Copy the header of the current version into
+   header (with its pointers set to NULL), for the time range and
+   constants.  Returns the version's serial number, which goes up by one
+   with every reload.
+*/
+unsigned long long ephcom_live_header(struct ephcom_Live *live, int reader,
+                                      struct ephcom_Header *header) {
+
+    struct ephlive_Reader *r = &live->reader[reader];
+    struct ephlive_Version *v;
+    unsigned long long serial;
+
+    atomic_store(&r->epoch, atomic_load(&live->epoch));
+    v = atomic_load(&live->current);
+    *header = v->header;
+    serial = v->serial;
+    atomic_store(&r->epoch, 0);
+
+    header->zoffset = NULL;
+    header->toffset = NULL;
+    header->bounds = NULL;
+    header->derived = NULL;
+    return(serial);
+}
+
+
+
+
+/*
+   ephcom_live_get_coords() - ephcom_get_coords() on the current version,
+   for the thread holding reader slot reader.  Returns 0, or -1 if the
+   time is outside the ephemeris or its block can't be read.
+*/
+int ephcom_live_get_coords(struct ephcom_Live *live, int reader,
+                           struct ephcom_Coords *coords) {
+
+    struct ephlive_Reader *r = &live->reader[reader];
+    struct ephlive_Version *v;
+    struct ephcom_Header *header;
+    double jd;
+    double *datablock;
+    int blocknum, nblocks;
+    int retval;
+/*
+   Pin the current epoch, then see which version is current.  A reload
+   that swaps versions after this still leaves ours alone until we unpin.
+*/
+    atomic_store(&r->epoch, atomic_load(&live->epoch));
+    v = atomic_load(&live->current);
+    header = &v->header;
+
+    retval = 0;
+    jd = coords->et2[0] + coords->et2[1];
+    if (!(jd >= header->ss[0] && jd <= header->ss[1])) {
+        fprintf(stderr,"Time is outside ephemeris range.\n");
+        retval = -1;
+    }
+    else {
+        nblocks = (int)((header->ss[1] - header->ss[0]) / header->ss[2] + 0.5);
+        blocknum = (int)((jd - header->ss[0]) / header->ss[2]);
+        if (blocknum >= nblocks)   /* jd is the very end of the file */
+            blocknum = nblocks - 1;
+        if ((datablock = ephcom_cache_acquire(v->cache, reader, blocknum)) == NULL)
+            retval = -1;
+        else {
+            retval = ephcom_interp_coords_r(header, coords, datablock, &r->scratch);
+            ephcom_cache_release(v->cache, reader);
+        }
+    }
+
+    atomic_store(&r->epoch, 0);  /* Unpin */
+    return(retval);
+}
@@ -0,0 +1,172 @@
+/*
+   ephorient.c - nutation and lunar libration rotation matrices for many
+                 epochs at once, from the nutation and libration series of
+                 a JPL ephemeris.
+
+         Only the series needed are interpolated, reusing the data block
+         across epochs that fall in the same block.  The work is then
+         done in passes over plain arrays: angles for all epochs, then the
+         sines and cosines of each angle (computed once and shared by all
+         the matrix elements that use them), then the matrix elements.
+         Each pass is a simple loop the compiler can vectorize.
+
+         Matrices are returned in structure-of-arrays order: for n epochs,
+         element (i,j) of the matrix for epoch k is m[(3*i + j)*n + k], so
+         each of the 9 elements is a contiguous array of n values.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "ephcom.h"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+int ephcom_load_block(FILE *infp, struct ephcom_Header *header,
+                      double jd, double *datablock);
+int ephcom_interp_series(struct ephcom_Header *header, double *datablock,
+                         int series, double jd, double *pv);
+
+
+/*
+   ephorient_angles() - Interpolate series (11 for nutation, 12 for
+   libration) at every epoch, putting coordinate c of epoch k in
+   angle[c*n + k].  Returns the number of epochs done before one was
+   outside the ephemeris.
+*/
+static int ephorient_angles(FILE *infp, struct ephcom_Header *header, double *datablock,
+                            int series, int n, double et2[][2], double *angle) {
+
+    int c, k;
+    double jd;
+    double pv[6];
+
+    for (k=0; k<n; k++) {
+        jd = et2[k][0] + et2[k][1];
+        if (ephcom_load_block(infp, header, jd, datablock) < 0)
+            break;
+        ephcom_interp_series(header, datablock, series, jd, pv);
+        for (c=0; c<(series == 11 ? 2 : 3); c++)
+            angle[c*n + k] = pv[c];
+    }
+
+    return(k);
+}
+
+
+
+
+/*
+   ephcom_nutation_batch() - Nutation matrices N for epochs et2[k][0] +
+   et2[k][1], k = 0 to n-1 (Julian Days, TDB), from the file's nutation
+   in longitude dpsi and in obliquity deps and the IAU 1976 mean obliquity
+   eps, as N = R1(-(eps+deps)) R3(-dpsi) R1(eps), so that true-of-date
+   vectors are N times mean-of-date vectors.  Matrices go in m[9*n] in
+   structure-of-arrays order (see above).  Returns n, or the number of
+   leading epochs done if one is outside the ephemeris, or -1 if the file
+   has no nutations.
+*/
+int ephcom_nutation_batch(FILE *infp, struct ephcom_Header *header, double *datablock,
+                          int n, double et2[][2], double *m) {
+
+    int k, ndone;
+    double t;           /* Julian centuries from J2000 */
+    double *angle;      /* dpsi[n], deps[n], then eps[n] */
+    double *trig;       /* cos, sin of dpsi, eps, eps+deps: 6 arrays of n */
+    double *cp, *sp, *ce, *se, *ct, *st;
+
+    if (header->ipt[11][1] <= 0 || header->ipt[11][2] <= 0)
+        return(-1);
+    angle = (double *)malloc(9 * n * sizeof(double));
+    trig = angle + 3 * n;
+
+    ndone = ephorient_angles(infp, header, datablock, 11, n, et2, angle);
+/*
+   Mean obliquity of date, IAU 1976, then true obliquity.
+*/
+    for (k=0; k<ndone; k++) {
+        t = ((et2[k][0] - 2451545.0) + et2[k][1]) / 36525.0;
+        angle[2*n + k] = (84381.448 + t * (-46.8150 + t * (-0.00059 + t * 0.001813)))
+                         * M_PI / (180.0 * 3600.0);
+    }
+    cp = trig;          sp = trig + n;
+    ce = trig + 2 * n;  se = trig + 3 * n;
+    ct = trig + 4 * n;  st = trig + 5 * n;
+    for (k=0; k<ndone; k++) {
+        cp[k] = cos(angle[k]);
+        sp[k] = sin(angle[k]);
+        ce[k] = cos(angle[2*n + k]);
+        se[k] = sin(angle[2*n + k]);
+        ct[k] = cos(angle[2*n + k] + angle[n + k]);
+        st[k] = sin(angle[2*n + k] + angle[n + k]);
+    }
+    for (k=0; k<ndone; k++) {
+        m[0*n + k] =  cp[k];
+        m[1*n + k] = -sp[k] * ce[k];
+        m[2*n + k] = -sp[k] * se[k];
+        m[3*n + k] =  sp[k] * ct[k];
+        m[4*n + k] =  cp[k] * ct[k] * ce[k] + st[k] * se[k];
+        m[5*n + k] =  cp[k] * ct[k] * se[k] - st[k] * ce[k];
+        m[6*n + k] =  sp[k] * st[k];
+        m[7*n + k] =  cp[k] * st[k] * ce[k] - ct[k] * se[k];
+        m[8*n + k] =  cp[k] * st[k] * se[k] + ct[k] * ce[k];
+    }
+    free(angle);
+
+    return(ndone);
+}
+
+
+
+
+/*
+   ephcom_libration_batch() - Lunar mantle orientation matrices M for
+   epochs et2[k][0] + et2[k][1], k = 0 to n-1 (Julian Days, TDB), from the
+   file's libration Euler angles (phi, theta, psi), as
+   M = R3(psi) R1(theta) R3(phi), so that lunar body-fixed vectors are M
+   times ICRF vectors.  Matrices go in m[9*n] in structure-of-arrays order
+   (see above).  Returns n, or the number of leading epochs done if one is
+   outside the ephemeris, or -1 if the file has no librations.
+*/
+int ephcom_libration_batch(FILE *infp, struct ephcom_Header *header, double *datablock,
+                           int n, double et2[][2], double *m) {
+
+    int k, ndone;
+    double *angle;      /* phi[n], theta[n], psi[n] */
+    double *trig;       /* cos, sin of phi, theta, psi: 6 arrays of n */
+    double *cf, *sf, *ct, *st, *cs, *ss;
+
+    if (header->lpt[1] <= 0 || header->lpt[2] <= 0)
+        return(-1);
+    angle = (double *)malloc(9 * n * sizeof(double));
+    trig = angle + 3 * n;
+
+    ndone = ephorient_angles(infp, header, datablock, 12, n, et2, angle);
+    cf = trig;          sf = trig + n;
+    ct = trig + 2 * n;  st = trig + 3 * n;
+    cs = trig + 4 * n;  ss = trig + 5 * n;
+    for (k=0; k<ndone; k++) {
+        cf[k] = cos(angle[k]);
+        sf[k] = sin(angle[k]);
+        ct[k] = cos(angle[n + k]);
+        st[k] = sin(angle[n + k]);
+        cs[k] = cos(angle[2*n + k]);
+        ss[k] = sin(angle[2*n + k]);
+    }
+    for (k=0; k<ndone; k++) {
+        m[0*n + k] =  cs[k] * cf[k] - ss[k] * ct[k] * sf[k];
+        m[1*n + k] =  cs[k] * sf[k] + ss[k] * ct[k] * cf[k];
+        m[2*n + k] =  ss[k] * st[k];
+        m[3*n + k] = -ss[k] * cf[k] - cs[k] * ct[k] * sf[k];
+        m[4*n + k] = -ss[k] * sf[k] + cs[k] * ct[k] * cf[k];
+        m[5*n + k] =  cs[k] * st[k];
+        m[6*n + k] =  st[k] * sf[k];
+        m[7*n + k] = -st[k] * cf[k];
+        m[8*n + k] =  ct[k];
+    }
+    free(angle);
+
+    return(ndone);
+}
@@ -0,0 +1,440 @@
+/*
+   ephserve - program to serve one JPL binary ephemeris to every process
+              on a machine, over a Unix domain socket.
+
+         The server maps the ephemeris file into memory once and keeps a
+         cache of data blocks already converted to doubles, shared by all
+         of its clients, so a short-lived client neither reads the file
+         nor parses the header: it connects, and gets the header and any
+         number of interpolations from the server (see ephclient.c for
+         the client side, and struct ephcom_ServeRequest in ephcom.h for
+         what goes over the socket).
+
+         The cache is direct-mapped, block k going in slot k modulo the
+         number of slots, so finding a block costs one comparison.
+
+         Client sockets are non-blocking, and each client has its own
+         request and reply buffers, filled and drained as poll() finds
+         them ready; a client that sends half a request, or stops reading
+         its reply, holds up no one else.
+
+         Format:
+
+            ephserve binary-ephemeris socket-path [cache-blocks]
+
+         cache-blocks is the number of data blocks to keep converted
+         (default 256).  The server runs until interrupted, then removes
+         the socket.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <string.h>    //memset()
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "ephcom.h"
+
+#define EPHSERVE_MAXCLIENTS 1024 /* Most clients connected at once */
+#define EPHSERVE_CACHE      256  /* Default data blocks in the cache */
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_zunpack_block(struct ephcom_Header *header, unsigned char *zblock,
+                         int nbytes, double *datablock);
+int ephcom_interp_coords(struct ephcom_Header *header, struct ephcom_Coords *coords,
+                         double *datablock);
+int ephcom_pleph(struct ephcom_Coords *coords, int ntarg, int ncntr, double *r);
+int ephcom_series_extent(struct ephcom_Header *header, int series, int *first);
+void ephcom_swap64(void *buf, int n);
+int ephcom_hostorder(void);
+
+
+/*
+   Everything the server keeps.
+*/
+static struct ephcom_Header header;
+static unsigned char *map;    /* The ephemeris file */
+static long long mapsize;
+static int nblocks;
+static int ncache;            /* Slots in the block cache */
+static double *cache;         /* ncache blocks of header.ncoeff doubles */
+static int *cachetag;         /* Block in each slot, or -1 */
+static volatile sig_atomic_t stop = 0;
+
+/*
+   One connected client: the request being received, then the reply
+   being sent.
+*/
+struct ephserve_Client {
+    struct ephcom_ServeRequest request;
+    double (*et2)[2];         /* Times of the request */
+    size_t et2size;           /* Bytes allocated for et2 */
+    size_t nin;               /* Bytes of request and times received */
+    unsigned char *reply;     /* ephcom_ServeReply, then the results */
+    size_t replysize;         /* Bytes allocated for reply */
+    size_t nout, sent;        /* Bytes of reply to send, and sent */
+};
+
+
+static void ephserve_stop(int sig) {
+
+    (void)sig;
+    stop = 1;
+}
+
+
+/*
+   ephserve_grow() - Make buf at least nbytes long.  Returns 0, or -1 if
+   it can't.
+*/
+static int ephserve_grow(void **buf, size_t *size, size_t nbytes) {
+
+    void *p;
+
+    if (nbytes <= *size)
+        return(0);
+    if ((p = realloc(*buf, nbytes)) == NULL)
+        return(-1);
+    *buf = p;
+    *size = nbytes;
+    return(0);
+}
+
+
+/*
+   ephserve_block() - Data block blocknum from the cache, converting it
+   from the mapped file first if it is not there.  Returns NULL if the
+   file is too short for it.
+*/
+static double *ephserve_block(int blocknum) {
+
+    int slot;
+    int i, first, n;
+    long long offset, nbytes;
+    double *block;
+
+    slot = blocknum % ncache;
+    block = &cache[(long long)slot * header.ncoeff];
+    if (cachetag[slot] == blocknum)
+        return(block);
+/*
+   The slot is overwritten from here on, so it holds no block until it is
+   all there: a refill that fails part way must not leave the old tag on
+   a half-overwritten block for the next request to use.
+*/
+    cachetag[slot] = -1;
+
+    if (header.zoffset != NULL) { /* Compressed container */
+        offset = header.zoffset[blocknum];
+        nbytes = header.zoffset[blocknum + 1] - offset;
+        if (offset + nbytes > mapsize ||
+            ephcom_zunpack_block(&header, map + offset, (int)nbytes, block) != header.ncoeff)
+            return(NULL);
+    }
+    else if (header.toffset != NULL) { /* Body-major container */
+        memset(block, 0, header.ncoeff * sizeof(double));
+        for (i=-1; i<=12; i++) {
+            if ((n = ephcom_series_extent(&header, i, &first)) == 0)
+                continue;
+            offset = header.toffset[i + 1] + (long long)blocknum * n * 8;
+            if (offset + n * 8LL > mapsize)
+                return(NULL);
+            memcpy(&block[first], map + offset, n * 8);
+        }
+        if (header.byteorder != ephcom_hostorder())
+            ephcom_swap64(block, header.ncoeff);
+    }
+    else {
+        nbytes = header.ncoeff * 8LL;
+        offset = (blocknum + 2) * nbytes;
+        if (offset + nbytes > mapsize)
+            return(NULL);
+        memcpy(block, map + offset, nbytes);
+        if (header.byteorder != ephcom_hostorder())
+            ephcom_swap64(block, header.ncoeff);
+    }
+    cachetag[slot] = blocknum;
+
+    return(block);
+}
+
+
+/*
+   ephserve_answer() - Answer the request client c has sent in full,
+   putting the whole reply in its reply buffer.  Returns 0, or -1 if
+   there is no memory for the reply.
+*/
+static int ephserve_answer(struct ephserve_Client *c) {
+
+    struct ephcom_ServeRequest *request = &c->request;
+    struct ephcom_ServeReply reply;
+    struct ephcom_Coords coords;
+    struct ephcom_Header copy;
+    double jd;
+    double *block, *out;
+    int k, blocknum, width;
+
+    if (request->op == EPHCOM_SERVE_HEADER) {
+        copy = header;  /* The pointers in it mean nothing to the client */
+        copy.zoffset = NULL;
+        copy.toffset = NULL;
+        copy.bounds = copy.derived = NULL;
+        reply.status = 0;
+        reply.n = 1;
+        if (ephserve_grow((void **)&c->reply, &c->replysize, sizeof(reply) + sizeof(copy)) < 0)
+            return(-1);
+        memcpy(c->reply, &reply, sizeof(reply));
+        memcpy(c->reply + sizeof(reply), &copy, sizeof(copy));
+        c->nout = sizeof(reply) + sizeof(copy);
+        c->sent = 0;
+        return(0);
+    }
+
+    width = request->op == EPHCOM_SERVE_COORDS ? EPHCOM_NUMOBJECTS * 6 : 6;
+    reply.status = 0;
+    reply.n = request->n;
+    if ((request->op != EPHCOM_SERVE_COORDS && request->op != EPHCOM_SERVE_PLEPH) ||
+        (request->op == EPHCOM_SERVE_PLEPH &&
+         (request->ntarg < 1 || request->ntarg > 15 || request->ncntr < 1 || request->ncntr > 15))) {
+        reply.status = -1;
+        reply.n = 0;
+    }
+    c->nout = sizeof(reply) + reply.n * width * sizeof(double);
+    if (ephserve_grow((void **)&c->reply, &c->replysize, c->nout) < 0)
+        return(-1);
+    out = (double *)(c->reply + sizeof(reply));
+    memset(&coords, 0, sizeof(coords));  /* Nutation leaves pv[13][4..5] alone */
+    coords.km = request->km;
+    coords.seconds = request->seconds;
+    for (k=0; k<reply.n; k++) {
+        memset(&out[k * width], 0, width * sizeof(double));
+        jd = c->et2[k][0] + c->et2[k][1];
+        if (!(jd >= header.ss[0] && jd <= header.ss[1]))
+            continue;
+        blocknum = (int)((jd - header.ss[0]) / header.ss[2]);
+        if (blocknum >= nblocks)   /* jd is the very end of the file */
+            blocknum = nblocks - 1;
+        if ((block = ephserve_block(blocknum)) == NULL)
+            continue;
+        coords.et2[0] = c->et2[k][0];
+        coords.et2[1] = c->et2[k][1];
+        if (ephcom_interp_coords(&header, &coords, block) < 0)
+            continue;
+        if (request->op == EPHCOM_SERVE_COORDS)
+            memcpy(&out[k * width], coords.pv, sizeof(coords.pv));
+        else
+            ephcom_pleph(&coords, request->ntarg, request->ncntr, &out[k * width]);
+        reply.status++;
+    }
+    memcpy(c->reply, &reply, sizeof(reply));
+    c->sent = 0;
+
+    return(0);
+}
+
+
+/*
+   ephserve_input() - Read what client fd has sent, without waiting for
+   more, and answer the request once it is all there.  Returns 0, or -1
+   if the client has gone or sent something else.
+*/
+static int ephserve_input(int fd, struct ephserve_Client *c) {
+
+    ssize_t k;
+    size_t need;  /* Bytes of request and times in all */
+    char *p;
+
+    for (;;) {
+        if (c->nin < sizeof(c->request)) {
+            need = sizeof(c->request);
+            p = (char *)&c->request + c->nin;
+        }
+        else {
+            if (c->request.magic != EPHCOM_SERVE_MAGIC ||
+                c->request.n < 0 || c->request.n > EPHCOM_SERVE_MAXN)
+                return(-1);
+            need = sizeof(c->request) + c->request.n * 2 * sizeof(double);
+            if (c->nin == need)
+                break;
+            if (ephserve_grow((void **)&c->et2, &c->et2size, need - sizeof(c->request)) < 0)
+                return(-1);
+            p = (char *)c->et2 + (c->nin - sizeof(c->request));
+        }
+        if ((k = read(fd, p, need - c->nin)) <= 0) {
+            if (k < 0 && errno == EINTR)
+                continue;
+            if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return(0);  /* The rest comes later */
+            return(-1);
+        }
+        c->nin += k;
+    }
+
+    c->nin = 0;
+    return(ephserve_answer(c));
+}
+
+
+/*
+   ephserve_output() - Send as much of client fd's reply as it will take
+   without waiting.  Returns 0, or -1 if the client has gone.
+*/
+static int ephserve_output(int fd, struct ephserve_Client *c) {
+
+    ssize_t k;
+
+    while (c->sent < c->nout) {
+        if ((k = write(fd, c->reply + c->sent, c->nout - c->sent)) <= 0) {
+            if (k < 0 && errno == EINTR)
+                continue;
+            if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return(0);
+            return(-1);
+        }
+        c->sent += k;
+    }
+    c->nout = c->sent = 0;
+
+    return(0);
+}
+
+
+int main(int argc, char *argv[]){
+
+    struct sockaddr_un addr;
+    struct pollfd client[EPHSERVE_MAXCLIENTS + 1]; /* client[0] listens */
+    static struct ephserve_Client conn[EPHSERVE_MAXCLIENTS + 1]; /* For client[] */
+    struct stat sb;
+    int nclients;
+    int gone;             /* Client has hung up or misbehaved */
+    int listenfd, fd, probe;
+    int i;
+    FILE *infp;
+
+    if (argc < 3) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-ephemeris socket-path [cache-blocks]\n\n",
+           argv[0]);
+        exit(1);
+    }
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+    ephcom_readbinary_header(infp, &header);
+    nblocks = (int)((header.ss[1] - header.ss[0]) / header.ss[2] + 0.5);
+    if (fstat(fileno(infp), &sb) != 0 ||
+        (map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fileno(infp), 0)) == MAP_FAILED) {
+        fprintf(stderr,"\nERROR: Can't map %s.\n\n", argv[1]);
+        exit(1);
+    }
+    mapsize = sb.st_size;
+    fclose(infp);
+
+    ncache = argc > 3 ? atoi(argv[3]) : EPHSERVE_CACHE;
+    if (ncache < 1) ncache = 1;
+    if (ncache > nblocks) ncache = nblocks;
+    cache = (double *)malloc((long long)ncache * header.ncoeff * sizeof(double));
+    cachetag = (int *)malloc(ncache * sizeof(int));
+    for (i=0; i<ncache; i++)
+        cachetag[i] = -1;
+/*
+   Listen on the socket.  A socket file left by a server that is no
+   longer running is removed; one with a server behind it is not.
+*/
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[2]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr,"\nERROR: Socket path %s is too long.\n\n", argv[2]);
+        exit(1);
+    }
+    strcpy(addr.sun_path, argv[2]);
+    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == EADDRINUSE) {
+        probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr,"\nERROR: A server is already running on %s.\n\n", argv[2]);
+            exit(1);
+        }
+        close(probe);
+        unlink(argv[2]);
+        if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr,"\nERROR: Can't listen on %s.\n\n", argv[2]);
+            exit(1);
+        }
+    }
+    if (listen(listenfd, 64) != 0) {
+        fprintf(stderr,"\nERROR: Can't listen on %s.\n\n", argv[2]);
+        exit(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, ephserve_stop);
+    signal(SIGTERM, ephserve_stop);
+
+    printf("Serving %s (DE%d, %d blocks) on %s.\n", argv[1], header.numde, nblocks, argv[2]);
+    fflush(stdout);
+/*
+   Read requests, and write replies, for whichever clients are ready.  A
+   client is either sending a request (POLLIN) or being sent its reply
+   (POLLOUT), never both.
+*/
+    client[0].fd = listenfd;
+    client[0].events = POLLIN;
+    nclients = 0;
+    while (!stop) {
+        if (poll(client, nclients + 1, -1) < 0)
+            continue;  /* Interrupted: check for a stop signal */
+        for (i=nclients; i>0; i--) {
+            if (client[i].revents == 0)
+                continue;
+            if (client[i].revents & POLLIN)
+                gone = ephserve_input(client[i].fd, &conn[i]) < 0;
+            else  /* Hung up, or an error, with nothing left to read */
+                gone = (client[i].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+            if (!gone && conn[i].nout > 0)
+                gone = ephserve_output(client[i].fd, &conn[i]) < 0;
+            if (gone) {
+                close(client[i].fd);
+                free(conn[i].et2);
+                free(conn[i].reply);
+                client[i] = client[nclients];
+                conn[i] = conn[nclients--];
+                continue;
+            }
+            client[i].events = conn[i].nout > 0 ? POLLOUT : POLLIN;
+        }
+        if (client[0].revents & POLLIN) {
+            if ((fd = accept(listenfd, NULL, NULL)) >= 0) {
+                if (nclients < EPHSERVE_MAXCLIENTS &&
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0) {
+                    nclients++;
+                    client[nclients].fd = fd;
+                    client[nclients].events = POLLIN;
+                    client[nclients].revents = 0;
+                    memset(&conn[nclients], 0, sizeof(conn[nclients]));
+                }
+                else
+                    close(fd);
+            }
+        }
+    }
+
+    for (i=1; i<=nclients; i++) {
+        close(client[i].fd);
+        free(conn[i].et2);
+        free(conn[i].reply);
+    }
+    close(listenfd);
+    unlink(argv[2]);
+    munmap(map, mapsize);
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*
+   ephset.c - use several JPL binary ephemerides as one, e.g. DE440 for
+              the modern era, DE441 for the long range around it, and
+              files fitted locally with ephfit beyond both.
+
+         ephcom_set_open() opens each file, checks that all of them agree
+         on the constants the interpolation depends on (AU, EMRAT, CLIGHT)
+         and carry the same bodies, and lays out which file serves which
+         time: the first file listed that covers a time is the one used.
+         That timeline is indexed by cells of equal length, no longer than
+         the shortest block in the set, each holding the first piece of
+         the timeline it meets.  ephcom_set_find() then goes from a time
+         to its cell by one division, and from there to its piece in at
+         most a step or two, however many files and pieces there are.
+
+         ephcom_set_get_coords() is ephcom_get_coords() for the set: it
+         sends each query to the right file's header and data block.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ephcom.h"
+
+#define EPHSET_MAXCELLS 10000000  /* Most index cells, for very long sets */
+#define EPHSET_TOLERANCE 1.0e-9   /* Relative difference allowed in constants */
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_get_coords(FILE *infp, struct ephcom_Header *header,
+                      struct ephcom_Coords *coords, double *datablock);
+void ephcom_set_close(struct ephcom_Set *set);
+
+
+/*
+   ephset_compare() - qsort() comparison of two Julian Days.
+*/
+static int ephset_compare(const void *p1, const void *p2) {
+
+    double jd1 = *(const double *)p1;
+    double jd2 = *(const double *)p2;
+
+    return(jd1 < jd2 ? -1 : jd1 > jd2 ? 1 : 0);
+}
+
+
+/*
+   ephset_differ() - 1 if two constants differ by more than the set allows.
+*/
+static int ephset_differ(double x1, double x2) {
+
+    return(fabs(x1 - x2) > EPHSET_TOLERANCE * fabs(x1));
+}
+
+
+
+
+/*
+   ephcom_set_open() - Open the nfiles binary ephemerides filename[0..]
+   as one set, earlier files taking precedence where they overlap.
+   Returns 0, or -1 (with a message on stderr, and nothing left open) if
+   a file can't be opened or doesn't match the first one.
+*/
+int ephcom_set_open(struct ephcom_Set *set, int nfiles, char *filename[]) {
+
+    int i, j, k, n;
+    double *edge;     /* Every file's start and end, sorted */
+    double step;      /* Shortest block in the set */
+    struct ephcom_Header *h0, *h;
+
+    memset(set, 0, sizeof(struct ephcom_Set));
+    if (nfiles < 1)
+        return(-1);
+    set->fp = (FILE **)calloc(nfiles, sizeof(FILE *));
+    set->header = (struct ephcom_Header *)calloc(nfiles, sizeof(struct ephcom_Header));
+    set->datablock = (double **)calloc(nfiles, sizeof(double *));
+/*
+   Open every file and check it against the first.
+*/
+    h0 = &set->header[0];
+    for (i=0; i<nfiles; i++) {
+        h = &set->header[i];
+        if ((set->fp[i] = fopen(filename[i], "rb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", filename[i]);
+            ephcom_set_close(set);
+            return(-1);
+        }
+        set->nfiles = i + 1;
+        ephcom_readbinary_header(set->fp[i], h);
+        set->datablock[i] = (double *)calloc(h->ncoeff, sizeof(double));
+        if (ephset_differ(h0->au, h->au) || ephset_differ(h0->emrat, h->emrat) ||
+            (h0->clight > 0.0 && h->clight > 0.0 && ephset_differ(h0->clight, h->clight))) {
+            fprintf(stderr,"\nERROR: %s and %s have different AU, EMRAT or CLIGHT.\n\n",
+                    filename[0], filename[i]);
+            ephcom_set_close(set);
+            return(-1);
+        }
+        for (j=0; j<13; j++) {
+            if (((j < 12 ? h0->ipt[j][1] : h0->lpt[1]) > 0) !=
+                ((j < 12 ? h->ipt[j][1] : h->lpt[1]) > 0)) {
+                fprintf(stderr,"\nERROR: %s and %s do not carry the same bodies",
+                        filename[0], filename[i]);
+                fprintf(stderr," (coefficient series %d).\n\n", j + 1);
+                ephcom_set_close(set);
+                return(-1);
+            }
+        }
+    }
+/*
+   Cut the time covered at every file's start and end, give each piece
+   to the first file that covers it, and join neighbouring pieces from
+   the same file.
+*/
+    edge = (double *)malloc(2 * nfiles * sizeof(double));
+    step = set->header[0].ss[2];
+    for (i=0; i<nfiles; i++) {
+        edge[2*i]     = set->header[i].ss[0];
+        edge[2*i + 1] = set->header[i].ss[1];
+        if (set->header[i].ss[2] < step)
+            step = set->header[i].ss[2];
+    }
+    qsort(edge, 2 * nfiles, sizeof(double), ephset_compare);
+    set->piecejd = (double *)malloc(2 * nfiles * sizeof(double));
+    set->piecefile = (int *)malloc(2 * nfiles * sizeof(int));
+    n = 0;
+    for (k=0; k<2*nfiles - 1; k++) {
+        if (edge[k + 1] <= edge[k])
+            continue;
+        for (i=0; i<nfiles; i++)
+            if (set->header[i].ss[0] <= edge[k] && set->header[i].ss[1] >= edge[k + 1])
+                break;
+        if (i == nfiles)
+            i = -1;  /* A gap between files */
+        if (n == 0 || set->piecefile[n - 1] != i) {
+            set->piecejd[n] = edge[k];
+            set->piecefile[n] = i;
+            n++;
+        }
+    }
+    set->npieces = n;
+    set->piecejd[n] = edge[2*nfiles - 1];
+    free(edge);
+/*
+   Index the pieces by cell.
+*/
+    set->jd0 = set->piecejd[0];
+    set->cell = step;
+    if ((set->piecejd[n] - set->jd0) / set->cell > EPHSET_MAXCELLS)
+        set->cell = (set->piecejd[n] - set->jd0) / EPHSET_MAXCELLS;
+    set->ncells = (int)((set->piecejd[n] - set->jd0) / set->cell) + 1;
+    set->cellpiece = (int *)malloc(set->ncells * sizeof(int));
+    for (k=0, j=0; k<set->ncells; k++) {
+        while (j < n - 1 && set->piecejd[j + 1] <= set->jd0 + k * set->cell)
+            j++;
+        set->cellpiece[k] = j;
+    }
+
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_set_close() - Close every file in a set and free its index.
+*/
+void ephcom_set_close(struct ephcom_Set *set) {
+
+    int i;
+
+    for (i=0; i<set->nfiles; i++) {
+        fclose(set->fp[i]);
+        free(set->datablock[i]);
+        free(set->header[i].zoffset);
+        free(set->header[i].toffset);
+        free(set->header[i].bounds);
+        free(set->header[i].derived);
+    }
+    free(set->fp);
+    free(set->header);
+    free(set->datablock);
+    free(set->piecejd);
+    free(set->piecefile);
+    free(set->cellpiece);
+    memset(set, 0, sizeof(struct ephcom_Set));
+}
+
+
+
+
+/*
+   ephcom_set_find() - Which file of the set serves Julian Day jd.
+   Returns its number, or -1 if no file covers jd.
+*/
+int ephcom_set_find(struct ephcom_Set *set, double jd) {
+
+    int k, p;
+
+    if (!(jd >= set->piecejd[0] && jd <= set->piecejd[set->npieces]))
+        return(-1);
+    k = (int)((jd - set->jd0) / set->cell);
+    if (k >= set->ncells)
+        k = set->ncells - 1;
+    for (p=set->cellpiece[k]; p < set->npieces - 1 && jd >= set->piecejd[p + 1]; p++)
+        ;
+    return(set->piecefile[p]);
+}
+
+
+
+
+/*
+   ephcom_set_get_coords() - ephcom_get_coords() for a set: fill coords
+   from whichever file serves coords->et2[0] + coords->et2[1].  Returns
+   the number of the file used, or -1 if none covers that time.
+*/
+int ephcom_set_get_coords(struct ephcom_Set *set, struct ephcom_Coords *coords) {
+
+    int i;
+
+    if ((i = ephcom_set_find(set, coords->et2[0] + coords->et2[1])) < 0) {
+        fprintf(stderr,"Time is outside ephemeris set range.\n");
+        return(-1);
+    }
+    if (ephcom_get_coords(set->fp[i], &set->header[i], coords, set->datablock[i]) < 0)
+        return(-1);
+
+    return(i);
+}
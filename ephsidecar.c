@@ -0,0 +1,459 @@
+/*
+   ephsidecar.c - keep what ephcom_readbinary_header() works out from an
+                  ephemeris in a sidecar file, so that opening it again
+                  is one mmap() and a check, not a parse.
+
+         The sidecar holds, in this machine's byte order and laid out to
+         be used where it is mapped:
+
+            - the parsed ephcom_Header (its pointers zeroed),
+            - a hash table of the constant names, for
+              ephcom_sidecar_constant(),
+            - where each coefficient series lies in a block, for
+              ephcom_sidecar_series(),
+            - the file offset of every data block, for
+              ephcom_sidecar_offset(), and the column offsets of a
+              body-major container.
+
+         It is tied to one ephemeris file by that file's size and
+         modification time and a checksum of every header byte the parse
+         reads (and the block directory, for a container), all of which
+         ephcom_sidecar_open() checks before trusting it.  A sidecar that
+         no longer matches is ignored, or rebuilt if asked.  Sidecars are
+         written to a temporary file and renamed into place, so a reader
+         never sees half of one.
+
+         Needs POSIX mmap().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ephcom.h"
+
+#define EPHSIDECAR_MAGIC   "EPHCOMX1"
+#define EPHSIDECAR_ENDIAN  0x01020304  /* Reads otherwise on another machine */
+#define EPHSIDECAR_VERSION 1
+#define EPHSIDECAR_RECORD1 (3*84 + 400*6 + 3*8 + 4 + 2*8 + 36*4 + 4 + 3*4) /* Bytes used */
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_series_extent(struct ephcom_Header *header, int series, int *first);
+int ephcom_sidecar_write(char *ephname, char *sidename);
+void ephcom_sidecar_close(struct ephcom_Sidecar *sidecar);
+
+
+/*
+   The start of a sidecar file.  Every *_off is a byte offset into the
+   file, a multiple of 8.
+*/
+struct ephsidecar_Top {
+    char magic[8];                 /* EPHSIDECAR_MAGIC */
+    unsigned endian;               /* EPHSIDECAR_ENDIAN */
+    int version;                   /* EPHSIDECAR_VERSION */
+    int headerbytes;               /* sizeof(struct ephcom_Header) */
+    int nblocks;                   /* Data blocks in the ephemeris */
+    int ncoeff, ncon;              /* Where the checksummed bytes are */
+    long long filesize;            /* Ephemeris file size, */
+    long long mtime;               /* modification time, */
+    unsigned long long checksum;   /* and the header bytes hash to this */
+    long long header_off;          /* struct ephcom_Header */
+    long long column_off;          /* 14 long longs: header->toffset[], or 0s */
+    long long hash_off;            /* nhash ints: constant number + 1, or 0 */
+    int nhash;                     /* A power of 2 */
+    int container;                 /* 0 plain, 1 compressed, 2 body-major */
+    long long series_off;          /* 13 struct ephsidecar_Series */
+    long long block_off;           /* nblocks+1 long longs: block file offsets */
+    long long total;               /* Bytes in the sidecar */
+};
+
+/*
+   Where one coefficient series lies in a data block.
+*/
+struct ephsidecar_Series {
+    int first;                     /* First coefficient, from 0 */
+    int n;                         /* Coefficients in all, 0 if none */
+    int ncf;                       /* Per coordinate and subinterval */
+    int nsub;                      /* Subintervals */
+    int ncoords;                   /* 2 for nutation, else 3 */
+    int pad;
+};
+
+struct ephcom_Sidecar {
+    unsigned char *map;
+    long long mapsize;
+    struct ephsidecar_Top *top;
+};
+
+
+/*
+   ephsidecar_hash() - FNV-1a hash of n bytes, continuing from h, taken
+   8 bytes at a time while it can be.  Start with h = 0.
+*/
+static unsigned long long ephsidecar_hash(unsigned long long h, unsigned char *p, long long n) {
+
+    unsigned long long w;
+
+    for (h ^= 14695981039346656037ULL; n >= 8; p += 8, n -= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    while (n-- > 0)
+        h = (h ^ *p++) * 1099511628211ULL;
+    return(h);
+}
+
+
+/*
+   ephsidecar_name() - A constant name as it is in cnam[]: 6 characters,
+   padded with blanks.
+*/
+static void ephsidecar_name(char *name, char *padded) {
+
+    int i;
+
+    for (i=0; i<6 && name[i] != '\0'; i++)
+        padded[i] = name[i];
+    for ( ; i<6; i++)
+        padded[i] = ' ';
+    padded[6] = '\0';
+}
+
+
+/*
+   ephsidecar_check() - Checksum of the ephemeris open on fd, laid out as
+   top says: the part of the first header record that is used, the
+   constant values in the second, and a container's tag and block
+   directory.  They are read in one piece.  Returns 0, or -1 if the file
+   is too short for them.
+*/
+static int ephsidecar_check(int fd, struct ephsidecar_Top *top, unsigned long long *checksum) {
+
+    unsigned char *buf;
+    long long record, nbytes;
+    int retval;
+
+    record = top->ncoeff * 8LL;
+    nbytes = top->container == 1 ? 2 * record + 16 + 8LL * (top->nblocks + 1) :
+             top->container == 2 ? 2 * record + 16 : record + top->ncon * 8LL;
+    buf = (unsigned char *)malloc(nbytes);
+    retval = -1;
+    if (pread(fd, buf, nbytes, 0) == nbytes) {
+        *checksum = ephsidecar_hash(0, buf, EPHSIDECAR_RECORD1);
+        *checksum = ephsidecar_hash(*checksum, buf + record, top->ncon * 8LL);
+        if (nbytes > 2 * record)
+            *checksum = ephsidecar_hash(*checksum, buf + 2 * record, nbytes - 2 * record);
+        retval = 0;
+    }
+    free(buf);
+    return(retval);
+}
+
+
+/*
+   ephsidecar_round() - n rounded up to a multiple of 8.
+*/
+static long long ephsidecar_round(long long n) {
+
+    return((n + 7) & ~7LL);
+}
+
+
+/*
+   ephsidecar_layout() - Set the *_off members and total of top from its
+   nhash and nblocks.
+*/
+static void ephsidecar_layout(struct ephsidecar_Top *top) {
+
+    top->header_off = ephsidecar_round(sizeof(struct ephsidecar_Top));
+    top->column_off = top->header_off + ephsidecar_round(sizeof(struct ephcom_Header));
+    top->hash_off   = top->column_off + 14 * sizeof(long long);
+    top->series_off = top->hash_off + ephsidecar_round(top->nhash * sizeof(int));
+    top->block_off  = top->series_off + ephsidecar_round(13 * sizeof(struct ephsidecar_Series));
+    top->total      = top->block_off + (top->nblocks + 1) * sizeof(long long);
+}
+
+
+
+
+/*
+   ephcom_sidecar_write() - Parse binary ephemeris ephname once and write
+   what was found to sidecar file sidename.  Returns 0, or -1 (with a
+   message on stderr) if either file can't be opened.
+*/
+int ephcom_sidecar_write(char *ephname, char *sidename) {
+
+    struct ephcom_Header header;
+    struct ephsidecar_Top top;
+    struct ephsidecar_Series *series;
+    struct stat sb;
+    unsigned char *buf;
+    long long *column, *offset;
+    int *hash;
+    char name[7];
+    char *tmpname;
+    int i, k, first;
+    FILE *infp, *outfp;
+
+    if ((infp = fopen(ephname, "rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", ephname);
+        return(-1);
+    }
+    memset(&header, 0, sizeof(header));  /* So unused members write as 0 */
+    ephcom_readbinary_header(infp, &header);
+    fstat(fileno(infp), &sb);
+/*
+   Lay out the sidecar.
+*/
+    memset(&top, 0, sizeof(top));
+    memcpy(top.magic, EPHSIDECAR_MAGIC, 8);
+    top.endian = EPHSIDECAR_ENDIAN;
+    top.version = EPHSIDECAR_VERSION;
+    top.headerbytes = sizeof(struct ephcom_Header);
+    top.nblocks = (int)((header.ss[1] - header.ss[0]) / header.ss[2] + 0.5);
+    top.ncoeff = header.ncoeff;
+    top.ncon = header.ncon;
+    top.filesize = sb.st_size;
+    top.mtime = sb.st_mtime;
+    top.container = header.zoffset != NULL ? 1 : header.toffset != NULL ? 2 : 0;
+    for (top.nhash=8; top.nhash < 2 * header.ncon; top.nhash *= 2)
+        ;
+    ephsidecar_layout(&top);
+    if (ephsidecar_check(fileno(infp), &top, &top.checksum) != 0) {
+        fprintf(stderr,"\nERROR: %s is too short for its header.\n\n", ephname);
+        fclose(infp);
+        return(-1);
+    }
+/*
+   Fill it in.
+*/
+    buf = (unsigned char *)calloc(1, top.total);
+    memcpy(buf, &top, sizeof(top));
+    column = (long long *)(buf + top.column_off);
+    hash   = (int *)(buf + top.hash_off);
+    series = (struct ephsidecar_Series *)(buf + top.series_off);
+    offset = (long long *)(buf + top.block_off);
+    for (i=0; i<=top.nblocks; i++)
+        offset[i] = header.zoffset != NULL ? header.zoffset[i] :
+                    (long long)(i + 2) * header.ncoeff * 8;
+    for (i=0; i<14; i++)
+        column[i] = header.toffset != NULL ? header.toffset[i] : 0;
+    for (i=0; i<13; i++) {
+        series[i].n = ephcom_series_extent(&header, i, &first);
+        series[i].first = first;
+        series[i].ncf  = i == 12 ? header.lpt[1] : header.ipt[i][1];
+        series[i].nsub = i == 12 ? header.lpt[2] : header.ipt[i][2];
+        series[i].ncoords = (i == 11 ? 2 : 3);
+    }
+    for (i=0; i<header.ncon; i++) {
+        ephsidecar_name(header.cnam[i], name);
+        k = (int)(ephsidecar_hash(0, (unsigned char *)name, 6) & (top.nhash - 1));
+        while (hash[k] != 0)
+            k = (k + 1) & (top.nhash - 1);
+        hash[k] = i + 1;
+    }
+    free(header.zoffset);
+    free(header.toffset);
+    header.zoffset = NULL;
+    header.toffset = NULL;
+    memcpy(buf + top.header_off, &header, sizeof(header));
+    fclose(infp);
+/*
+   Write it beside its final name and move it there in one step.
+*/
+    tmpname = (char *)malloc(strlen(sidename) + 32);
+    sprintf(tmpname, "%s.%ld.tmp", sidename, (long)getpid());
+    if ((outfp = fopen(tmpname, "wb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", tmpname);
+        free(tmpname);
+        free(buf);
+        return(-1);
+    }
+    k = fwrite(buf, 1, top.total, outfp) == (size_t)top.total;
+    if (fclose(outfp) != 0 || !k || rename(tmpname, sidename) != 0) {
+        fprintf(stderr,"\nERROR: Can't write %s.\n\n", sidename);
+        unlink(tmpname);
+        free(tmpname);
+        free(buf);
+        return(-1);
+    }
+    free(tmpname);
+    free(buf);
+
+    return(0);
+}
+
+
+
+
+/*
+   ephcom_sidecar_open() - Open binary ephemeris ephname for input into
+   *infp, and fill header from its sidecar file sidename instead of
+   parsing it, as ephcom_readbinary_header() would have filled it (free
+   header->zoffset and header->toffset when done).  If the sidecar is
+   missing or no longer matches the ephemeris, it is rebuilt first when
+   build is 1; otherwise NULL is returned, and the caller can open the
+   ephemeris the usual way.  Returns the mapped sidecar, for the other
+   ephcom_sidecar_ functions, or NULL with nothing left open.
+*/
+struct ephcom_Sidecar *ephcom_sidecar_open(char *ephname, char *sidename, int build,
+                                           FILE **infp, struct ephcom_Header *header) {
+
+    struct ephcom_Sidecar *sidecar;
+    struct ephsidecar_Top *top, layout;
+    struct stat sb, sc;
+    unsigned long long checksum;
+    void *map;
+    int fd, ok;
+
+    if ((*infp = fopen(ephname, "rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", ephname);
+        return(NULL);
+    }
+    fstat(fileno(*infp), &sb);
+/*
+   Map the sidecar and check that it is one, written here, for this
+   version of the ephemeris.
+*/
+    map = MAP_FAILED;
+    ok = 0;
+    if ((fd = open(sidename, O_RDONLY)) >= 0) {
+        if (fstat(fd, &sc) == 0 && sc.st_size >= (off_t)sizeof(struct ephsidecar_Top))
+            map = mmap(NULL, sc.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (map != MAP_FAILED) {
+        top = (struct ephsidecar_Top *)map;
+        layout = *top;
+        ephsidecar_layout(&layout);
+        ok = memcmp(top->magic, EPHSIDECAR_MAGIC, 8) == 0 &&
+             top->endian == EPHSIDECAR_ENDIAN && top->version == EPHSIDECAR_VERSION &&
+             top->headerbytes == (int)sizeof(struct ephcom_Header) &&
+             top->nblocks >= 0 && top->ncoeff > 0 && top->ncon >= 0 && top->ncon <= 400 &&
+             top->nhash >= 2 * top->ncon && (top->nhash & (top->nhash - 1)) == 0 &&
+             top->container >= 0 && top->container <= 2 &&
+             memcmp(&layout, top, sizeof(layout)) == 0 && top->total == sc.st_size &&
+             top->filesize == sb.st_size && top->mtime == sb.st_mtime &&
+             ephsidecar_check(fileno(*infp), top, &checksum) == 0 &&
+             checksum == top->checksum;
+        if (!ok)
+            munmap(map, sc.st_size);
+    }
+    if (!ok) {
+        fclose(*infp);
+        *infp = NULL;
+        if (build && ephcom_sidecar_write(ephname, sidename) == 0)
+            return(ephcom_sidecar_open(ephname, sidename, 0, infp, header));
+        return(NULL);
+    }
+
+    sidecar = (struct ephcom_Sidecar *)malloc(sizeof(struct ephcom_Sidecar));
+    sidecar->map = (unsigned char *)map;
+    sidecar->mapsize = sc.st_size;
+    sidecar->top = top;
+/*
+   The header is copied, as the interpolation routines keep their state
+   in it; only a container's block directory or columns are allocated.
+*/
+    memcpy(header, sidecar->map + top->header_off, sizeof(struct ephcom_Header));
+    if (top->container == 1) {
+        header->zoffset = (long long *)malloc((top->nblocks + 1) * sizeof(long long));
+        memcpy(header->zoffset, sidecar->map + top->block_off,
+               (top->nblocks + 1) * sizeof(long long));
+    }
+    if (top->container == 2) {
+        header->toffset = (long long *)malloc(14 * sizeof(long long));
+        memcpy(header->toffset, sidecar->map + top->column_off, 14 * sizeof(long long));
+    }
+
+    return(sidecar);
+}
+
+
+
+
+/*
+   ephcom_sidecar_close() - Unmap a sidecar.  The ephemeris file and the
+   header filled by ephcom_sidecar_open() are the caller's to close and
+   free.
+*/
+void ephcom_sidecar_close(struct ephcom_Sidecar *sidecar) {
+
+    munmap(sidecar->map, sidecar->mapsize);
+    free(sidecar);
+}
+
+
+
+
+/*
+   ephcom_sidecar_constant() - Look up a header constant by name ("AU",
+   "EMRAT", ...; trailing blanks optional) and put its value in *value.
+   Returns its number in cnam[], or -1 if the ephemeris has no such
+   constant.
+*/
+int ephcom_sidecar_constant(struct ephcom_Sidecar *sidecar, char *name, double *value) {
+
+    struct ephsidecar_Top *top = sidecar->top;
+    struct ephcom_Header *header;
+    int *hash;
+    char padded[7];
+    int k, i, n;
+
+    header = (struct ephcom_Header *)(sidecar->map + top->header_off);
+    hash = (int *)(sidecar->map + top->hash_off);
+    ephsidecar_name(name, padded);
+    k = (int)(ephsidecar_hash(0, (unsigned char *)padded, 6) & (top->nhash - 1));
+    for (n=0; n < top->nhash && (i = hash[k]) > 0 && i <= header->ncon; n++) {
+        if (strncmp(header->cnam[i - 1], padded, 6) == 0) {
+            *value = header->cval[i - 1];
+            return(i - 1);
+        }
+        k = (k + 1) & (top->nhash - 1);
+    }
+    return(-1);
+}
+
+
+
+
+/*
+   ephcom_sidecar_series() - Where series (0 to 12, as for
+   ephcom_interp_series()) lies in a data block, as
+   ephcom_series_extent() gives it: sets *first, and *ncf and *nsub if
+   not NULL, and returns the number of coefficients, 0 if none.
+*/
+int ephcom_sidecar_series(struct ephcom_Sidecar *sidecar, int series,
+                          int *first, int *ncf, int *nsub) {
+
+    struct ephsidecar_Series *s;
+
+    if (series < 0 || series > 12)
+        return(0);
+    s = (struct ephsidecar_Series *)(sidecar->map + sidecar->top->series_off) + series;
+    *first = s->first;
+    if (ncf != NULL) *ncf = s->ncf;
+    if (nsub != NULL) *nsub = s->nsub;
+    return(s->n);
+}
+
+
+
+
+/*
+   ephcom_sidecar_offset() - File offset of data block blocknum (0 on up)
+   in the ephemeris, or of the end of the last block for blocknum =
+   nblocks; for a body-major container, whose blocks are spread over
+   its columns, the offset the block would have in a plain file.
+   Returns -1 for any other blocknum.
+*/
+long long ephcom_sidecar_offset(struct ephcom_Sidecar *sidecar, int blocknum) {
+
+    if (blocknum < 0 || blocknum > sidecar->top->nblocks)
+        return(-1);
+    return(((long long *)(sidecar->map + sidecar->top->block_off))[blocknum]);
+}
@@ -0,0 +1,381 @@
+/*
+   ephspk.c - read Chebyshev segments (SPK types 2 and 3) from a NAIF
+              DAF/SPK kernel, for asteroids, comets and spacecraft to use
+              alongside the planets of a JPL ephemeris.
+
+         ephcom_spk_open() maps the kernel into memory (or reads it whole
+         where mmap() is not available) and builds an index of its
+         segments, sorted by body, from the summary records.  Coefficients
+         are then used straight from the mapped file, and evaluated with
+         ephcom_cheby(), the same routine ephcom_get_coords() uses.  Both
+         little- and big-endian kernels are read on any machine.
+
+         ephcom_spk_coords() puts the position and velocity of one SPK body
+         in coords->pv[EPHCOM_USER-1], following the chain of segment
+         centers (e.g. asteroid -> Sun) until it reaches a body already in
+         coords->pv[], so that ephcom_pleph(coords, EPHCOM_USER, ncntr, r)
+         then gives the body relative to any of the usual centers.
+
+         Only segments in the J2000 frame (frame code 1), the frame of the
+         JPL ephemerides, are indexed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ephcom.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define EPHSPK_RECORD 1024  /* Bytes in a DAF record */
+
+
+unsigned char gnulliver();
+int ephcom_cheby(int maxcoeffs, double x, double span, double scale, double *y,
+                 int ncoords, int ncoeffs, double *pv);
+void ephcom_spk_close(struct ephcom_Spk *spk);
+
+
+/*
+   ephspk_double(), ephspk_int() - value at byte offset off in the mapped
+   file, in this machine's byte order.
+*/
+static double ephspk_double(struct ephcom_Spk *spk, long long off) {
+
+    int i;
+    union {
+        double d;
+        unsigned char ch[8];
+    } bytes;
+
+    for (i=0; i<8; i++)
+        bytes.ch[i] = spk->map[off + (spk->swap ? 7 - i : i)];
+    return(bytes.d);
+}
+
+
+static int ephspk_int(struct ephcom_Spk *spk, long long off) {
+
+    int i;
+    union {
+        int u;
+        unsigned char ch[4];
+    } bytes;
+
+    for (i=0; i<4; i++)
+        bytes.ch[i] = spk->map[off + (spk->swap ? 3 - i : i)];
+    return(bytes.u);
+}
+
+
+/*
+   Order segments by body, then with later segments in the file first, as
+   those take precedence where coverage overlaps.
+*/
+static int ephspk_compare(const void *p1, const void *p2) {
+
+    const struct ephcom_SpkSegment *s1 = p1, *s2 = p2;
+
+    if (s1->target != s2->target)
+        return(s1->target < s2->target ? -1 : 1);
+    return(s2->index - s1->index);
+}
+
+
+
+
+/*
+   ephcom_spk_open() - Open a DAF/SPK kernel and index its type 2 and 3
+   segments.  Returns the number of segments indexed, or -1 (with a
+   message on stderr) if the file can't be read or is not an SPK file.
+*/
+int ephcom_spk_open(char *filename, struct ephcom_Spk *spk) {
+
+    int i, k;
+    int nd, ni;       /* Doubles and integers in each segment summary */
+    int nsum;         /* Summaries in a summary record */
+    int nalloc;
+    int frame, begin, end;
+    long long rec;    /* Byte offset of a summary record */
+    long long sum;    /* Byte offset of one summary */
+    struct ephcom_SpkSegment *seg;
+#if defined(__unix__) || defined(__APPLE__)
+    int fd;
+    struct stat sb;
+#else
+    FILE *infp;
+#endif
+
+    memset(spk, 0, sizeof(struct ephcom_Spk));
+#if defined(__unix__) || defined(__APPLE__)
+    if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &sb) != 0) {
+        fprintf(stderr,"\nERROR: Can't open SPK file %s.\n\n", filename);
+        return(-1);
+    }
+    spk->size = sb.st_size;
+    spk->map = spk->size < EPHSPK_RECORD ? MAP_FAILED :
+               mmap(NULL, spk->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (spk->map == MAP_FAILED) {
+        spk->map = NULL;
+        fprintf(stderr,"\nERROR: Can't map SPK file %s.\n\n", filename);
+        return(-1);
+    }
+#else
+    if ((infp = fopen(filename, "rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open SPK file %s.\n\n", filename);
+        return(-1);
+    }
+    fseek(infp, 0L, SEEK_END);
+    spk->size = ftell(infp);
+    rewind(infp);
+    spk->map = (unsigned char *)malloc(spk->size > 0 ? spk->size : 1);
+    if (spk->size < EPHSPK_RECORD ||
+        fread(spk->map, 1, spk->size, infp) != (size_t)spk->size) {
+        fclose(infp);
+        ephcom_spk_close(spk);
+        fprintf(stderr,"\nERROR: Can't read SPK file %s.\n\n", filename);
+        return(-1);
+    }
+    fclose(infp);
+#endif
+/*
+   File record: ID word, ND and NI, first summary record, and the byte
+   order ("BIG-IEEE" or "LTL-IEEE"; old files have none, so then take the
+   order in which ND reads as 2, as it always is for SPK).
+*/
+    if (strncmp((char *)spk->map, "DAF/SPK ", 8) != 0) {
+        ephcom_spk_close(spk);
+        fprintf(stderr,"\nERROR: %s is not a DAF/SPK file.\n\n", filename);
+        return(-1);
+    }
+    if (strncmp((char *)spk->map + 88, "BIG-IEEE", 8) == 0)
+        spk->swap = gnulliver() != 0;
+    else if (strncmp((char *)spk->map + 88, "LTL-IEEE", 8) == 0)
+        spk->swap = gnulliver() == 0;
+    else
+        spk->swap = ephspk_int(spk, 8) != 2;
+    nd = ephspk_int(spk, 8);
+    ni = ephspk_int(spk, 12);
+    if (nd != 2 || ni != 6) {
+        ephcom_spk_close(spk);
+        fprintf(stderr,"\nERROR: %s has ND=%d, NI=%d; SPK files have 2 and 6.\n\n",
+                filename, nd, ni);
+        return(-1);
+    }
+/*
+   Walk the chain of summary records.
+*/
+    nalloc = 0;
+    k = 0;
+    for (rec = (ephspk_int(spk, 76) - 1LL) * EPHSPK_RECORD;
+         rec >= 0 && rec + EPHSPK_RECORD <= spk->size;
+         rec = ((long long)ephspk_double(spk, rec) - 1) * EPHSPK_RECORD) {
+        nsum = (int)ephspk_double(spk, rec + 16);
+        for (i=0; i<nsum && 24 + (i + 1) * 40 <= EPHSPK_RECORD; i++, k++) {
+            sum = rec + 24 + i * 40;   /* 2 doubles, 6 ints: 5 double words */
+            if (spk->nseg == nalloc) {
+                nalloc = nalloc ? 2 * nalloc : 64;
+                spk->seg = (struct ephcom_SpkSegment *)realloc(spk->seg,
+                               nalloc * sizeof(struct ephcom_SpkSegment));
+            }
+            seg = &spk->seg[spk->nseg];
+            seg->index  = k;
+            seg->et0    = ephspk_double(spk, sum);
+            seg->et1    = ephspk_double(spk, sum + 8);
+            seg->target = ephspk_int(spk, sum + 16);
+            seg->center = ephspk_int(spk, sum + 20);
+            frame       = ephspk_int(spk, sum + 24);
+            seg->type   = ephspk_int(spk, sum + 28);
+            begin       = ephspk_int(spk, sum + 32);
+            end         = ephspk_int(spk, sum + 36);
+            if ((seg->type != 2 && seg->type != 3) || frame != 1 ||
+                begin < 1 || end - 4 < begin || (long long)end * 8 > spk->size)
+                continue;
+       /*
+          Segment directory, in the last 4 words: INIT, INTLEN, RSIZE, N.
+       */
+            seg->start    = (begin - 1LL) * 8;
+            seg->init     = ephspk_double(spk, (end - 4LL) * 8);
+            seg->intlen   = ephspk_double(spk, (end - 3LL) * 8);
+            seg->rsize    = (int)ephspk_double(spk, (end - 2LL) * 8);
+            seg->nrecords = (int)ephspk_double(spk, (end - 1LL) * 8);
+            seg->ncoeff   = (seg->rsize - 2) / (seg->type == 2 ? 3 : 6);
+            if (seg->ncoeff < 1 || seg->intlen <= 0.0 ||
+                (long long)seg->rsize * seg->nrecords > end - 4 - begin + 1)
+                continue;
+            if (seg->ncoeff > spk->maxcoeff)
+                spk->maxcoeff = seg->ncoeff;
+            if (seg->rsize > spk->maxrsize)
+                spk->maxrsize = seg->rsize;
+            spk->nseg++;
+        }
+    }
+    if (spk->nseg > 0)
+        qsort(spk->seg, spk->nseg, sizeof(struct ephcom_SpkSegment), ephspk_compare);
+    spk->record = (double *)malloc((spk->maxrsize > 0 ? spk->maxrsize : 1) * sizeof(double));
+
+    return(spk->nseg);
+}
+
+
+
+
+/*
+   ephcom_spk_close() - Unmap an SPK file and free its index.
+*/
+void ephcom_spk_close(struct ephcom_Spk *spk) {
+
+    if (spk->map != NULL) {
+#if defined(__unix__) || defined(__APPLE__)
+        munmap(spk->map, spk->size);
+#else
+        free(spk->map);
+#endif
+    }
+    free(spk->seg);
+    free(spk->record);
+    memset(spk, 0, sizeof(struct ephcom_Spk));
+}
+
+
+
+
+/*
+   ephcom_spk_state() - Position and velocity of NAIF body target relative
+   to its segment's center at et seconds past J2000 (TDB), in km and km/sec,
+   from the highest-priority segment covering et.  Returns the NAIF code of
+   the center, or -1 if no segment covers target at et (so a center can
+   never be -1, which is not a NAIF body).
+*/
+int ephcom_spk_state(struct ephcom_Spk *spk, int target, double et, double *pv) {
+
+    int i, lo, hi, mid;
+    int rec;
+    double *record;
+    double x;         /* Normalized Chebyshev time, in interval [-1,1]. */
+    double y[12];     /* Type 3: position and velocity series, with derivatives */
+    struct ephcom_SpkSegment *seg;
+
+/*
+   Binary search for the first segment of target.
+*/
+    lo = 0;
+    hi = spk->nseg;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (spk->seg[mid].target < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (seg = NULL; lo < spk->nseg && spk->seg[lo].target == target; lo++) {
+        if (et >= spk->seg[lo].et0 && et <= spk->seg[lo].et1) {
+            seg = &spk->seg[lo];
+            break;
+        }
+    }
+    if (seg == NULL)
+        return(-1);
+
+    rec = (int)((et - seg->init) / seg->intlen);
+    if (rec >= seg->nrecords)  /* et is the very end of the segment */
+        rec = seg->nrecords - 1;
+    if (rec < 0)
+        rec = 0;
+/*
+   Use the record in place if it is in this machine's byte order;
+   mapped files start on a page, so the doubles are aligned.
+*/
+    record = (double *)(spk->map + seg->start + (long long)rec * seg->rsize * 8);
+    if (spk->swap) {
+        for (i=0; i<seg->rsize; i++)
+            spk->record[i] = ephspk_double(spk, seg->start + ((long long)rec * seg->rsize + i) * 8);
+        record = spk->record;
+    }
+/*
+   record[0] is the middle of the record's interval and record[1] its
+   radius, both in seconds, so d/dt = (2/span) d/dx with span = 2*radius.
+*/
+    x = (et - record[0]) / record[1];
+    if (seg->type == 2)
+        ephcom_cheby(spk->maxcoeff, x, 2.0 * record[1], 1.0, &record[2],
+                     3, seg->ncoeff, pv);
+    else {
+        ephcom_cheby(spk->maxcoeff, x, 2.0 * record[1], 1.0, &record[2],
+                     6, seg->ncoeff, y);
+        for (i=0; i<6; i++)
+            pv[i] = y[i];
+    }
+
+    return(seg->center);
+}
+
+
+
+
+/*
+   ephcom_spk_coords() - Position and velocity of NAIF body target at the
+   time in coords, relative to the Solar System Barycenter, in the units
+   set in coords, put in coords->pv[EPHCOM_USER-1].  Segments are chained
+   through their centers until one is a body already in coords->pv[] (the
+   barycenters 0 to 10, or Mercury 199, Venus 299, Earth 399 and Moon 301),
+   so call ephcom_get_coords() first.  Returns 0, or -1 if the chain can't
+   be followed at this time.
+*/
+int ephcom_spk_coords(struct ephcom_Spk *spk, struct ephcom_Header *header,
+                      struct ephcom_Coords *coords, int target) {
+
+    int i, n;
+    int body;         /* ephcom body number of the chain's last center */
+    double et;        /* Seconds past J2000 */
+    double pv[6], sum[6];
+    double posscale, velscale;
+/*
+   ephcom body numbers for NAIF codes 0 to 10: SSB, the 9 planetary
+   barycenters (Mercury, Venus, EMBary, Mars ...), and the Sun.
+*/
+    static int naifbody[11] = {
+        EPHCOM_SSBARY, EPHCOM_MERCURY, EPHCOM_VENUS, EPHCOM_EMBARY, EPHCOM_MARS,
+        EPHCOM_JUPITER, EPHCOM_SATURN, EPHCOM_URANUS, EPHCOM_NEPTUNE, EPHCOM_PLUTO,
+        EPHCOM_SUN};
+
+    et = ((coords->et2[0] - 2451545.0) + coords->et2[1]) * 86400.0;
+    for (i=0; i<6; i++)
+        sum[i] = 0.0;
+    for (n=0; n<100; n++) {  /* Guard against a cycle of segments */
+        if (target >= 0 && target <= 10)
+            body = naifbody[target];
+        else if (target == 199)
+            body = EPHCOM_MERCURY;
+        else if (target == 299)
+            body = EPHCOM_VENUS;
+        else if (target == 399)
+            body = EPHCOM_EARTH;
+        else if (target == 301)
+            body = EPHCOM_MOON;
+        else
+            body = 0;
+        if (body > 0)
+            break;
+        if ((target = ephcom_spk_state(spk, target, et, pv)) < 0)
+            return(-1);
+        for (i=0; i<6; i++)
+            sum[i] += pv[i];
+    }
+    if (n == 100)
+        return(-1);
+
+    posscale = coords->km ? 1.0 : 1.0 / header->au;
+    velscale = posscale * (coords->seconds ? 1.0 : 86400.0);
+    for (i=0; i<3; i++) {
+        coords->pv[EPHCOM_USER-1][i]   = coords->pv[body-1][i]   + sum[i] * posscale;
+        coords->pv[EPHCOM_USER-1][i+3] = coords->pv[body-1][i+3] + sum[i+3] * velscale;
+    }
+
+    return(0);
+}
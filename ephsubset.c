@@ -0,0 +1,191 @@
+/*
+   ephsubset - program to write a JPL binary ephemeris holding only the
+               bodies a client needs, e.g. the Sun, Earth and Moon.
+
+         Bodies are numbered as for ephcom_pleph(): 1 Mercury to 9 Pluto,
+         10 Moon, 11 Sun, 13 Earth-Moon barycenter, 14 nutations and
+         15 librations (12, the solar system barycenter, needs nothing).
+         The Earth (3) and the Moon (10) each need both the Earth-Moon
+         barycenter and geocentric Moon series, as ephcom_get_coords()
+         forms the one from the other.
+
+         The series kept stay in the same order, with the same numbers of
+         coefficients and subintervals, and the block ends with the last
+         of them, so ncoeff is what ephcom_readbinary_header() derives
+         from the new ipt[][] and lpt[].  Series left out have no
+         coefficients and point past the end of the block.  If that
+         leaves the block too short to hold the header records, it is
+         padded in front, as ephfit does.  The output is an ordinary
+         binary ephemeris, read and interpolated as it is; the bodies
+         left out come back as zeros.
+
+         Format:
+
+            ephsubset binary-input binary-output body [body ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include "ephcom.h"
+
+#define EPHSUBSET_MINCOEFF ((3*84 + 400*6 + 3*8 + 4 + 2*8 + 36*4 + 4 + 3*4 + 7) / 8)
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_readbinary_block(FILE *infp, struct ephcom_Header *header,
+                            int blocknum, double *datablock);
+int ephcom_writebinary_header(FILE *outfp, struct ephcom_Header *header);
+int ephcom_writebinary_block(FILE *outfp, struct ephcom_Header *header,
+                             int blocknum, double *datablock);
+int ephcom_repack_block(struct ephcom_Header *inheader, double *inblock,
+                        struct ephcom_Header *outheader, double *outblock);
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1, header2; /* Input and output headers */
+    double *datablock1, *datablock2;       /* Input and output data blocks */
+    int keep[13];       /* 1 for each series kept */
+    int body;
+    int ptr, ncf, nsub, ncoords;
+    int nused;          /* Coefficients of the series kept, with the JDs */
+    int pad;            /* Unused coefficients before the first series */
+    int nblocks;
+    int i, blocknum;
+    FILE *infp, *outfp;
+/*
+   Names of the objects in Chebyshev coefficient arrays.
+*/
+    static char *ephcom_coeffname[13] = {
+        "Mercury", "Venus", "EMBary", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune",
+        "Pluto", "Moon", "Sun", "Nutation", "Libration"};
+
+    if (argc < 4) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-input binary-output body [body ...]\n\n",
+           argv[0]);
+        exit(1);
+    }
+/*
+   Which series the bodies asked for need.
+*/
+    for (i=0; i<13; i++)
+        keep[i] = 0;
+    for (i=3; i<argc; i++) {
+        body = atoi(argv[i]);
+        if (body >= 1 && body <= 9 && body != 3)
+            keep[body - 1] = 1;
+        else if (body == 3 || body == 10)
+            keep[2] = keep[9] = 1;
+        else if (body == 11)
+            keep[10] = 1;
+        else if (body == 13)
+            keep[2] = 1;
+        else if (body == 14 || body == 15)
+            keep[body - 3] = 1;
+        else if (body != 12) {
+            fprintf(stderr,"\nERROR: %s is not a body from 1 to 15.\n\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+
+    if ((outfp = fopen(argv[2],"r")) == NULL) {    //先用只读方式打开，判断文件是否存在
+        if ((outfp = fopen(argv[2],"wb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[2]);
+            exit(1);
+        }
+    }
+    else {
+        fprintf(stderr,"\nERROR: Output ephemeris file %s already exists.\n\n", argv[2]);
+        exit(1);
+    }
+
+    ephcom_readbinary_header(infp, &header1);
+    nblocks = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+/*
+   Lay out the reduced block: the series kept, in the same order, after
+   whatever padding the header records need.
+*/
+    nused = 2;
+    for (i=0; i<13; i++) {
+        ncf  = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+        nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+        ncoords = (i == 11 ? 2 : 3);
+        if (ncf <= 0 || nsub <= 0)
+            keep[i] = 0;
+        if (keep[i])
+            nused += ncf * nsub * ncoords;
+    }
+    if (nused == 2) {
+        fprintf(stderr,"\nERROR: %s has none of the bodies asked for.\n\n", argv[1]);
+        exit(1);
+    }
+    pad = 0;
+    if (nused < EPHSUBSET_MINCOEFF)
+        pad = EPHSUBSET_MINCOEFF - nused;
+    if (nused + pad < header1.ncon)
+        pad = header1.ncon - nused;
+
+    header2 = header1;
+    header2.ncoeff = nused + pad;
+    header2.ksize = 2 * header2.ncoeff;
+    header2.maxcheby = 0;
+    ptr = 3 + pad;
+    for (i=0; i<13; i++) {
+        ncf  = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+        nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+        ncoords = (i == 11 ? 2 : 3);
+        if (!keep[i]) {
+            if (i == 12) {
+                header2.lpt[0] = header2.ncoeff + 1;
+                header2.lpt[1] = header2.lpt[2] = 0;
+            }
+            else {
+                header2.ipt[i][0] = header2.ncoeff + 1;
+                header2.ipt[i][1] = header2.ipt[i][2] = 0;
+            }
+            continue;
+        }
+        if (i == 12)
+            header2.lpt[0] = ptr;
+        else
+            header2.ipt[i][0] = ptr;
+        ptr += ncf * nsub * ncoords;
+        if (ncf > header2.maxcheby)
+            header2.maxcheby = ncf;
+    }
+/*
+   Copy the series kept from every block.
+*/
+    datablock1 = (double *)malloc(header1.ncoeff * sizeof(double));
+    datablock2 = (double *)calloc(header2.ncoeff, sizeof(double)); /* Padding stays 0 */
+    for (blocknum=0; blocknum<nblocks; blocknum++) {
+        if (ephcom_readbinary_block(infp, &header1, blocknum, datablock1) <= 0) {
+            fprintf(stderr,"\nERROR: %s ends before data block %d.\n\n", argv[1], blocknum + 1);
+            exit(1);
+        }
+        ephcom_repack_block(&header1, datablock1, &header2, datablock2);
+        ephcom_writebinary_block(outfp, &header2, blocknum, datablock2);
+    }
+    ephcom_writebinary_header(outfp, &header2);
+
+    fclose(outfp);
+    fclose(infp);
+
+    printf("Kept:");
+    for (i=0; i<13; i++)
+        if (keep[i])
+            printf(" %s", ephcom_coeffname[i]);
+    printf("\n\nWrote 2 header blocks + %d data blocks, %d coefficients per data block (was %d",
+           nblocks, header2.ncoeff, header1.ncoeff);
+    if (pad > 0)
+        printf("; %d of them padding", pad);
+    printf(").\n\n");
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+   ephtrunc - program to write a JPL binary ephemeris with trailing
+              Chebyshev coefficients dropped, for clients that do not
+              need full precision.
+
+         For every body, the number of coefficients kept is the smallest
+         that leaves the sum of the dropped coefficients' magnitudes
+         within the tolerance in every subinterval of every block.  Since
+         |T[n](x)| <= 1 on [-1,1], that sum bounds the error the drop can
+         cause, and the program reports it (and the matching bound on
+         velocity) for each body.
+
+         The output is an ordinary binary ephemeris whose ipt[][1] and
+         lpt[1] entries hold the reduced counts, so ephcom_readbinary_header()
+         and ephcom_get_coords() read it as is and evaluate only the
+         coefficients kept.
+
+         Format:
+
+            ephtrunc binary-input binary-output km-tolerance [radian-tolerance]
+
+         km-tolerance applies to positions; radian-tolerance to nutation
+         and libration angles, which are kept in full if it is omitted or 0.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>    //exit()
+#include <math.h>      //fabs()
+#include "ephcom.h"
+
+
+int ephcom_readbinary_header(FILE *infp, struct ephcom_Header *header);
+int ephcom_readbinary_block(FILE *infp, struct ephcom_Header *header,
+                            int blocknum, double *datablock);
+int ephcom_writebinary_header(FILE *outfp, struct ephcom_Header *header);
+int ephcom_writebinary_block(FILE *outfp, struct ephcom_Header *header,
+                             int blocknum, double *datablock);
+int ephcom_repack_block(struct ephcom_Header *inheader, double *inblock,
+                        struct ephcom_Header *outheader, double *outblock);
+
+
+int main(int argc, char *argv[]){
+
+    struct ephcom_Header header1, header2; /* Input and output headers */
+    double *datablock1, *datablock2;       /* Input and output data blocks */
+    double tol[13];     /* Error tolerance for each body */
+    double perr[13];    /* Largest bound on position error for each body */
+    double verr[13];    /* Largest bound on velocity error for each body */
+    double tail, vtail; /* Dropped coefficients' sum, and for velocity */
+    double *coeff;
+    int nkeep[13];      /* Coefficients kept for each body */
+    int ptr, ncf, nsub, ncoords;
+    int nblocks;
+    int i, j, k, n, blocknum;
+    FILE *infp, *outfp;
+/*
+   Names of the objects in Chebyshev coefficient arrays.
+*/
+    static char *ephcom_coeffname[13] = {
+        "Mercury", "Venus", "EMBary", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune",
+        "Pluto", "Moon", "Sun", "Nutation", "Libration"};
+
+    if (argc < 4) {
+        fprintf(stderr,
+           "\nFormat:\n\n         %s binary-input binary-output km-tolerance [radian-tolerance]\n\n",
+           argv[0]);
+        exit(1);
+    }
+
+    if ((infp = fopen(argv[1],"rb")) == NULL) {
+        fprintf(stderr,"\nERROR: Can't open %s for input.\n\n", argv[1]);
+        exit(1);
+    }
+
+    if ((outfp = fopen(argv[2],"r")) == NULL) {    //先用只读方式打开，判断文件是否存在
+        if ((outfp = fopen(argv[2],"wb")) == NULL) {
+            fprintf(stderr,"\nERROR: Can't open %s for output.\n\n", argv[2]);
+            exit(1);
+        }
+    }
+    else {
+        fprintf(stderr,"\nERROR: Output ephemeris file %s already exists.\n\n", argv[2]);
+        exit(1);
+    }
+
+    for (i=0; i<11; i++)
+        tol[i] = atof(argv[3]);
+    tol[11] = tol[12] = argc > 4 ? atof(argv[4]) : 0.0;
+
+    ephcom_readbinary_header(infp, &header1);
+    nblocks = (int)((header1.ss[1] - header1.ss[0]) / header1.ss[2] + 0.5);
+    datablock1 = (double *)malloc(header1.ncoeff * sizeof(double));
+/*
+   First pass: find how many coefficients each body needs, over all blocks.
+   Keep at least 2 so there is still a velocity.
+*/
+    for (i=0; i<13; i++)
+        nkeep[i] = 0;
+    for (blocknum=0; blocknum<nblocks; blocknum++) {
+        if (ephcom_readbinary_block(infp, &header1, blocknum, datablock1) <= 0) {
+            fprintf(stderr,"\nERROR: %s ends before data block %d.\n\n", argv[1], blocknum + 1);
+            exit(1);
+        }
+        for (i=0; i<13; i++) {
+            ptr  = i == 12 ? header1.lpt[0] : header1.ipt[i][0];
+            ncf  = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+            nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+            ncoords = (i == 11 ? 2 : 3);
+            for (j=0; j<nsub*ncoords; j++) {
+                coeff = &datablock1[ptr - 1 + j * ncf];
+                n = ncf;
+                if (tol[i] > 0.0) {
+                    for (tail=0.0; n > 2 && tail + fabs(coeff[n-1]) <= tol[i]; n--)
+                        tail += fabs(coeff[n-1]);
+                }
+                if (n > nkeep[i])
+                    nkeep[i] = n;
+            }
+        }
+    }
+/*
+   Lay out the reduced block: same bodies and subintervals, in the same
+   order, each with its new number of coefficients.
+*/
+    header2 = header1;
+    ptr = 3;
+    for (i=0; i<13; i++) {
+        nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+        ncoords = (i == 11 ? 2 : 3);
+        if (i == 12) {
+            header2.lpt[0] = ptr;
+            header2.lpt[1] = nkeep[i];
+        }
+        else {
+            header2.ipt[i][0] = ptr;
+            header2.ipt[i][1] = nkeep[i];
+        }
+        ptr += nkeep[i] * nsub * ncoords;
+    }
+    header2.ncoeff = ptr - 1;
+    header2.ksize = 2 * header2.ncoeff;
+    header2.maxcheby = 0;
+    for (i=0; i<13; i++)
+        if (nkeep[i] > header2.maxcheby)
+            header2.maxcheby = nkeep[i];
+    if (header2.ncoeff * 8 < 3*84 + 400*6 + 3*8 + 4 + 2*8 + 36*4 + 4 + 3*4 ||
+        header2.ncoeff < header2.ncon) {
+        fprintf(stderr,"\nERROR: %d coefficients per block is too few to hold the header.\n", header2.ncoeff);
+        fprintf(stderr,"       Use a smaller tolerance.\n\n");
+        exit(1);
+    }
+/*
+   Second pass: write the reduced blocks and measure the error bounds.
+*/
+    datablock2 = (double *)malloc(header2.ncoeff * sizeof(double));
+    for (i=0; i<13; i++)
+        perr[i] = verr[i] = 0.0;
+    for (blocknum=0; blocknum<nblocks; blocknum++) {
+        ephcom_readbinary_block(infp, &header1, blocknum, datablock1);
+        for (i=0; i<13; i++) {
+            ptr  = i == 12 ? header1.lpt[0] : header1.ipt[i][0];
+            ncf  = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+            nsub = i == 12 ? header1.lpt[2] : header1.ipt[i][2];
+            ncoords = (i == 11 ? 2 : 3);
+            for (j=0; j<nsub*ncoords; j++) {
+                coeff = &datablock1[ptr - 1 + j * ncf];
+                tail = vtail = 0.0;
+                for (k=nkeep[i]; k<ncf; k++) {
+                    tail += fabs(coeff[k]);
+                    vtail += (double)k * k * fabs(coeff[k]); /* |T'[k](x)| <= k*k */
+                }
+                vtail *= 2.0 * nsub / header1.ss[2];
+                if (tail > perr[i]) perr[i] = tail;
+                if (vtail > verr[i]) verr[i] = vtail;
+            }
+        }
+        ephcom_repack_block(&header1, datablock1, &header2, datablock2);
+        ephcom_writebinary_block(outfp, &header2, blocknum, datablock2);
+    }
+    ephcom_writebinary_header(outfp, &header2);
+
+    fclose(outfp);
+    fclose(infp);
+
+    printf("Body         Coefficients    Max position error    Max velocity error\n");
+    for (i=0; i<13; i++) {
+        ncf = i == 12 ? header1.lpt[1] : header1.ipt[i][1];
+        printf("%-10s  %5d -> %5d    %18.10E %s   %18.10E %s\n",
+               ephcom_coeffname[i], ncf, nkeep[i],
+               perr[i], i < 11 ? "km " : "rad", verr[i], i < 11 ? "km/day " : "rad/day");
+    }
+    printf("\nWrote 2 header blocks + %d data blocks, %d coefficients per data block (was %d).\n\n",
+           nblocks, header2.ncoeff, header1.ncoeff);
+
+    return 0;
+}